@@ -2,6 +2,7 @@
 # usage: ./brute-map.bash pid file [window-size] < regions
 # Sometimes region offsets aren't available, but we know that some regions map a file
 # Fix the region offsets by bruteforcing the offsets from a known file
+# NOTE: ptrace-brute-map does the same natively with a single attach
 while read -r region; do
    offset=$(printf '%d' "0x$(awk '{print $3}' <<<"$region")")
    if ((offset == 0)); then
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+// Shared logic of bintrim and binsearch, for tools that do the same in-process
+
+static inline size_t
+bin_span(const unsigned char *data, const size_t len, const unsigned char byte)
+{
+   // number of leading bytes equal to byte
+   size_t i = 0;
+#ifdef __SSE2__
+   const __m128i v = _mm_set1_epi8(byte);
+   for (; i + 64 <= len; i += 64) {
+      const __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)), v);
+      const __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 16)), v);
+      const __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 32)), v);
+      const __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 48)), v);
+      if (_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d))) != 0xffff)
+         break;
+   }
+   for (; i + 16 <= len; i += 16) {
+      const unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)), v));
+      if (mask != 0xffff)
+         return i + __builtin_ctz(~mask);
+   }
+#else
+   const uint64_t v = 0x0101010101010101ull * byte;
+   for (uint64_t w; i + sizeof(w) <= len; i += sizeof(w)) {
+      memcpy(&w, data + i, sizeof(w));
+      if (w != v)
+         break;
+   }
+#endif
+   for (; i < len && data[i] == byte; ++i);
+   return i;
+}
+
+static inline size_t
+bin_rspan(const unsigned char *data, const size_t len, const unsigned char byte)
+{
+   // number of trailing bytes equal to byte
+   size_t i = len;
+#ifdef __SSE2__
+   const __m128i v = _mm_set1_epi8(byte);
+   for (; i >= 64; i -= 64) {
+      const __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i - 64)), v);
+      const __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i - 48)), v);
+      const __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i - 32)), v);
+      const __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i - 16)), v);
+      if (_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d))) != 0xffff)
+         break;
+   }
+   for (; i >= 16; i -= 16) {
+      const unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i - 16)), v));
+      if (mask != 0xffff)
+         return len - i + (__builtin_clz(~mask & 0xffff) - 16);
+   }
+#else
+   const uint64_t v = 0x0101010101010101ull * byte;
+   for (uint64_t w; i >= sizeof(w); i -= sizeof(w)) {
+      memcpy(&w, data + i - sizeof(w), sizeof(w));
+      if (w != v)
+         break;
+   }
+#endif
+   for (; i > 0 && data[i - 1] == byte; --i);
+   return len - i;
+}
+
+static inline size_t
+bin_mismatch(const unsigned char *a, const unsigned char *b, const size_t len)
+{
+   // index of the first differing byte, len if there is none
+   size_t i = 0;
+#ifdef __SSE2__
+   for (; i + 64 <= len; i += 64) {
+      const __m128i x = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+      const __m128i y = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 16)), _mm_loadu_si128((const __m128i*)(b + i + 16)));
+      const __m128i z = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 32)), _mm_loadu_si128((const __m128i*)(b + i + 32)));
+      const __m128i w = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 48)), _mm_loadu_si128((const __m128i*)(b + i + 48)));
+      if (_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(x, y), _mm_and_si128(z, w))) != 0xffff)
+         break;
+   }
+   for (; i + 16 <= len; i += 16) {
+      const unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+      if (mask != 0xffff)
+         return i + __builtin_ctz(~mask);
+   }
+#else
+   for (uint64_t x, y; i + sizeof(x) <= len; i += sizeof(x)) {
+      memcpy(&x, a + i, sizeof(x));
+      memcpy(&y, b + i, sizeof(y));
+      if (x != y)
+         break;
+   }
+#endif
+   for (; i < len && a[i] == b[i]; ++i);
+   return i;
+}
+
+static inline size_t
+bin_trim(const unsigned char *data, const size_t len, const unsigned char trim, size_t *out_start)
+{
+   const size_t start = bin_span(data, len, trim);
+   *out_start = start;
+   return len - start - bin_rspan(data + start, len - start, trim);
+}
+
+static inline const unsigned char*
+bin_search(const unsigned char *haystack, const size_t haystack_len, const unsigned char *needle, const size_t needle_len)
+{
+   if (!needle_len || needle_len > haystack_len)
+      return NULL;
+
+#ifdef _GNU_SOURCE
+   return memmem(haystack, haystack_len, needle, needle_len);
+#else
+   for (const unsigned char *s = haystack; (s = memchr(s, needle[0], haystack_len - needle_len + 1 - (s - haystack))); ++s) {
+      if (!memcmp(s, needle, needle_len))
+         return s;
+   }
+   return NULL;
+#endif
+}
@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <util.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Rolling-hash (rsync style) index of a haystack
+// The index is built once and mmapped afterwards, so looking up a needle doesn't touch the haystack at all.
+// Every block_size aligned block of the haystack gets a weak rolling checksum and a strong hash,
+// needle is then rolled byte by byte and every weak hit is confirmed with the strong hash.
+
+#define BININDEX_MAGIC "BININDX1"
+
+struct binindex_header {
+   char magic[8];
+   uint64_t block_size, haystack_size, num_entries, bucket_bits;
+   // uint32_t buckets[num_buckets_for_bits(bucket_bits)];
+   // struct binindex_entry entries[num_entries];
+};
+
+struct binindex_entry {
+   uint32_t weak, block;
+   uint64_t strong;
+};
+
+struct binindex {
+   const struct binindex_header *header;
+   const uint32_t *buckets;
+   const struct binindex_entry *entries;
+   size_t mapped;
+};
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr, "usage: %s index build haystack [block-size]\n"
+                   "       %s index first < needle\n"
+                   "       %s index all < needle\n", argv0, argv0, argv0);
+   exit(EXIT_FAILURE);
+}
+
+struct weak {
+   uint32_t a, b;
+};
+
+static inline uint32_t
+weak_digest(const struct weak *w)
+{
+   return (w->a & 0xffff) | (w->b << 16);
+}
+
+static inline struct weak
+weak_for_block(const unsigned char *data, const size_t len)
+{
+   struct weak w = {0};
+   for (size_t i = 0; i < len; ++i) {
+      w.a += data[i];
+      w.b += (len - i) * data[i];
+   }
+   return w;
+}
+
+static inline void
+weak_roll(struct weak *w, const unsigned char out, const unsigned char in, const size_t len)
+{
+   w->a += in - out;
+   w->b += w->a - len * out;
+}
+
+static inline uint64_t
+strong_for_block(const unsigned char *data, const size_t len)
+{
+   uint64_t h = 0x9e3779b97f4a7c15ull ^ len;
+   size_t i = 0;
+   for (uint64_t v; i + sizeof(v) <= len; i += sizeof(v)) {
+      memcpy(&v, data + i, sizeof(v));
+      h = (h ^ (v * 0xff51afd7ed558ccdull)) * 0xc4ceb9fe1a85ec53ull;
+      h ^= h >> 29;
+   }
+   for (; i < len; ++i)
+      h = (h ^ data[i]) * 0x100000001b3ull;
+   return h ^ (h >> 32);
+}
+
+static inline uint32_t
+bucket_for_weak(const uint32_t weak, const uint64_t bucket_bits)
+{
+   return (bucket_bits ? (uint32_t)(weak * 0x9e3779b1u) >> (32 - bucket_bits) : 0);
+}
+
+static inline size_t
+num_buckets_for_bits(const uint64_t bucket_bits)
+{
+   // one extra bucket for the end sentinel, padded so entries stay 8 byte aligned
+   return (((size_t)1 << bucket_bits) + 2) & ~(size_t)1;
+}
+
+static bool
+block_is_uniform(const unsigned char *data, const size_t len)
+{
+   // uniform blocks (mostly zero padding) would match everywhere, they carry no information
+   return (len > 0 && data[0] == data[len - 1] && !memcmp(data, data + 1, len - 1));
+}
+
+static uint64_t BUCKET_BITS;
+
+static int
+entry_cmp(const void *a, const void *b)
+{
+   const struct binindex_entry *ea = a, *eb = b;
+   const uint32_t ba = bucket_for_weak(ea->weak, BUCKET_BITS), bb = bucket_for_weak(eb->weak, BUCKET_BITS);
+   if (ba != bb) return (ba < bb ? -1 : 1);
+   if (ea->weak != eb->weak) return (ea->weak < eb->weak ? -1 : 1);
+   return (ea->block < eb->block ? -1 : ea->block > eb->block);
+}
+
+static void
+build(const char *index_path, const char *haystack_path, const size_t block_size)
+{
+   FILE *f;
+   if (!(f = fopen(haystack_path, "rb")))
+      err(EXIT_FAILURE, "fopen(%s)", haystack_path);
+
+   unsigned char *block;
+   if (!(block = malloc(block_size)))
+      err(EXIT_FAILURE, "malloc");
+
+   const size_t step = 1024;
+   size_t num_entries = 0, allocated = 0, haystack_size = 0;
+   struct binindex_entry *entries = NULL;
+   for (size_t rd, i = 0; (rd = fread(block, 1, block_size, f)); ++i) {
+      haystack_size += rd;
+
+      if (rd < block_size || block_is_uniform(block, rd))
+         continue;
+
+      if (i > (uint32_t)~0)
+         errx(EXIT_FAILURE, "haystack has too many blocks, use bigger block size");
+
+      if (num_entries >= allocated && !(entries = realloc(entries, sizeof(*entries) * (allocated += step))))
+         err(EXIT_FAILURE, "realloc");
+
+      const struct weak w = weak_for_block(block, block_size);
+      entries[num_entries++] = (struct binindex_entry){
+         .weak = weak_digest(&w),
+         .block = i,
+         .strong = strong_for_block(block, block_size)
+      };
+   }
+
+   if (ferror(f))
+      err(EXIT_FAILURE, "fread(%s)", haystack_path);
+
+   fclose(f);
+   free(block);
+
+   struct binindex_header header = {
+      .magic = BININDEX_MAGIC,
+      .block_size = block_size,
+      .haystack_size = haystack_size,
+      .num_entries = num_entries,
+   };
+
+   // aim for ~1 entry per bucket
+   while (header.bucket_bits < 31 && ((size_t)1 << header.bucket_bits) < num_entries)
+      ++header.bucket_bits;
+
+   BUCKET_BITS = header.bucket_bits;
+   qsort(entries, num_entries, sizeof(*entries), entry_cmp);
+
+   const size_t num_buckets = num_buckets_for_bits(header.bucket_bits);
+   uint32_t *buckets;
+   if (!(buckets = calloc(num_buckets, sizeof(*buckets))))
+      err(EXIT_FAILURE, "calloc");
+
+   for (size_t i = 0; i < num_entries; ++i)
+      ++buckets[bucket_for_weak(entries[i].weak, header.bucket_bits) + 1];
+
+   for (size_t i = 1; i < num_buckets; ++i)
+      buckets[i] += buckets[i - 1];
+
+   if (!(f = fopen(index_path, "wb")))
+      err(EXIT_FAILURE, "fopen(%s)", index_path);
+
+   if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+       fwrite(buckets, sizeof(*buckets), num_buckets, f) != num_buckets ||
+       fwrite(entries, sizeof(*entries), num_entries, f) != num_entries)
+      err(EXIT_FAILURE, "fwrite(%s)", index_path);
+
+   if (fclose(f) != 0)
+      err(EXIT_FAILURE, "fclose(%s)", index_path);
+
+   warnx("indexed %zu of %zu blocks (%zu bytes) with block size of %zu bytes", num_entries, (haystack_size + block_size - 1) / block_size, haystack_size, block_size);
+   free(buckets);
+   free(entries);
+}
+
+static void
+binindex_open(struct binindex *index, const char *path)
+{
+   *index = (struct binindex){0};
+
+   int fd;
+   if ((fd = open(path, O_RDONLY)) == -1)
+      err(EXIT_FAILURE, "open(%s)", path);
+
+   struct stat st;
+   if (fstat(fd, &st) != 0)
+      err(EXIT_FAILURE, "fstat(%s)", path);
+
+   if ((size_t)st.st_size < sizeof(*index->header))
+      errx(EXIT_FAILURE, "%s: not a binindex file", path);
+
+   void *mapped;
+   if ((mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+      err(EXIT_FAILURE, "mmap(%s)", path);
+
+   close(fd);
+   index->mapped = st.st_size;
+   index->header = mapped;
+
+   if (memcmp(index->header->magic, BININDEX_MAGIC, sizeof(index->header->magic)) || index->header->bucket_bits > 31 || !index->header->block_size)
+      errx(EXIT_FAILURE, "%s: not a binindex file", path);
+
+   // num_entries is checked against what is left after the buckets, so a crafted count can't wrap the size
+   const size_t num_buckets = num_buckets_for_bits(index->header->bucket_bits);
+   const size_t tables = index->mapped - sizeof(*index->header);
+   if (num_buckets > tables / sizeof(*index->buckets) ||
+       index->header->num_entries > (tables - num_buckets * sizeof(*index->buckets)) / sizeof(*index->entries))
+      errx(EXIT_FAILURE, "%s: truncated binindex file", path);
+
+   index->buckets = (const uint32_t*)(index->header + 1);
+   index->entries = (const struct binindex_entry*)(index->buckets + num_buckets);
+}
+
+static void
+binindex_close(struct binindex *index)
+{
+   if (index->header)
+      munmap((void*)index->header, index->mapped);
+   *index = (struct binindex){0};
+}
+
+struct candidates {
+   size_t *offsets, num, allocated;
+};
+
+static void
+candidates_push(struct candidates *c, const size_t offset)
+{
+   const size_t step = 1024;
+   if (c->num >= c->allocated && !(c->offsets = realloc(c->offsets, sizeof(*c->offsets) * (c->allocated += step))))
+      err(EXIT_FAILURE, "realloc");
+   c->offsets[c->num++] = offset;
+}
+
+static int
+size_t_cmp(const void *a, const void *b)
+{
+   const size_t sa = *(const size_t*)a, sb = *(const size_t*)b;
+   return (sa < sb ? -1 : sa > sb);
+}
+
+static size_t
+lookup(const struct binindex *index, const unsigned char *needle, const size_t needle_size, struct candidates *c)
+{
+   const size_t bs = index->header->block_size;
+   if (needle_size < bs)
+      return 0;
+
+   size_t hits = 0;
+   struct weak w = weak_for_block(needle, bs);
+   for (size_t p = 0; p + bs <= needle_size;) {
+      const uint32_t weak = weak_digest(&w);
+      const uint32_t bucket = bucket_for_weak(weak, index->header->bucket_bits);
+
+      bool matched = false, has_strong = false;
+      uint64_t strong = 0;
+      for (size_t i = index->buckets[bucket]; i < index->buckets[bucket + 1] && i < index->header->num_entries; ++i) {
+         const struct binindex_entry *e = &index->entries[i];
+         if (e->weak != weak)
+            continue;
+
+         if (!has_strong) {
+            strong = strong_for_block(needle + p, bs);
+            has_strong = true;
+         }
+
+         const size_t block_offset = (size_t)e->block * bs;
+         if (e->strong != strong || block_offset < p || block_offset - p + needle_size > index->header->haystack_size)
+            continue;
+
+         candidates_push(c, block_offset - p);
+         matched = true;
+      }
+
+      hits += matched;
+
+      // like rsync, skip the matched block entirely
+      const size_t next = p + (matched ? bs : 1);
+      if (next + bs > needle_size)
+         break;
+
+      if (matched) {
+         w = weak_for_block(needle + next, bs);
+      } else {
+         weak_roll(&w, needle[p], needle[p + bs], bs);
+      }
+
+      p = next;
+   }
+
+   return hits;
+}
+
+static unsigned char*
+read_all(FILE *f, size_t *out_size)
+{
+   const size_t step = 4096 * 1024;
+   size_t size = 0, allocated = 0;
+   unsigned char *data = NULL;
+   for (size_t rd = 0;; size += rd) {
+      if (size >= allocated && !(data = realloc(data, (allocated += step))))
+         err(EXIT_FAILURE, "realloc");
+
+      if (!(rd = fread(data + size, 1, allocated - size, f)))
+         break;
+   }
+
+   if (ferror(f))
+      err(EXIT_FAILURE, "fread");
+
+   *out_size = size;
+   return data;
+}
+
+int
+main(int argc, const char *argv[])
+{
+   if (argc < 3)
+      usage(argv[0]);
+
+   enum {
+      BUILD,
+      FIRST,
+      ALL
+   } mode;
+
+   if (!strcmp(argv[2], "build"))
+      mode = BUILD;
+   else if (!strcmp(argv[2], "first"))
+      mode = FIRST;
+   else if (!strcmp(argv[2], "all"))
+      mode = ALL;
+   else
+      errx(EXIT_FAILURE, "mode must be build, first or all");
+
+   if (mode == BUILD) {
+      if (argc < 4)
+         usage(argv[0]);
+
+      const size_t block_size = (argc > 4 ? hexdecstrtoull(argv[4], NULL) : 1024);
+      if (!block_size || block_size > (uint32_t)~0)
+         errx(EXIT_FAILURE, "invalid block size");
+
+      build(argv[1], argv[3], block_size);
+      return EXIT_SUCCESS;
+   }
+
+   struct binindex index;
+   binindex_open(&index, argv[1]);
+
+   size_t needle_size;
+   unsigned char *needle = read_all(stdin, &needle_size);
+
+   if (needle_size < index.header->block_size)
+      warnx("needle is smaller than the block size of the index (%zu < %zu)", needle_size, (size_t)index.header->block_size);
+
+   struct candidates c = {0};
+   lookup(&index, needle, needle_size, &c);
+   qsort(c.offsets, c.num, sizeof(*c.offsets), size_t_cmp);
+
+   // candidates confirmed by the most blocks win, ties are printed in offset order
+   size_t best = 0;
+   for (size_t i = 0, run; i < c.num; i += run) {
+      for (run = 1; i + run < c.num && c.offsets[i + run] == c.offsets[i]; ++run);
+      best = (run > best ? run : best);
+   }
+
+   for (size_t i = 0, run; i < c.num; i += run) {
+      for (run = 1; i + run < c.num && c.offsets[i + run] == c.offsets[i]; ++run);
+
+      if (run != best)
+         continue;
+
+      printf("%zu\n", c.offsets[i]);
+
+      if (mode == FIRST)
+         break;
+   }
+
+   free(c.offsets);
+   free(needle);
+   binindex_close(&index);
+   return (best ? EXIT_SUCCESS : EXIT_FAILURE);
+}
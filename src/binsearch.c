@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <util.h>
+#include <bin.h>
 #include <err.h>
 
 static bool FOUND = false;
@@ -18,12 +19,8 @@ usage(const char *argv0)
 static const char*
 search(const char *haystack, const char *needle, const size_t window_size)
 {
-   for (const char *s = haystack; s < haystack + window_size; ++s) {
-      if (memcmp(s, needle, window_size))
-         continue;
-      return s;
-   }
-   return NULL;
+   // haystack holds two windows, match may start anywhere in the first one
+   return (const char*)bin_search((const unsigned char*)haystack, (window_size ? window_size * 2 - 1 : 0), (const unsigned char*)needle, window_size);
 }
 
 static void
@@ -3,43 +3,226 @@
 #include <stdbool.h>
 #include <string.h>
 #include <util.h>
+#include <bin.h>
 #include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-int
-main(int argc, const char *argv[])
+// Trailing trim bytes are only counted, and written back if they turn out not to be trailing after all.
+// Memory use stays constant no matter how long the runs are.
+
+static void
+usage(const char *argv0)
 {
-   unsigned char trim = 0;
+   fprintf(stderr, "usage: %s [trim-byte] < data\n"
+                   "       %s trim-byte truncate file\n"
+                   "       %s 0 punch file\n"
+                   "       truncate trims the file in place, punch turns zero runs into holes and keeps the offsets\n", argv0, argv0, argv0);
+   exit(EXIT_FAILURE);
+}
 
-   if (argc > 1)
-      trim = hexdecstrtoull(argv[1], NULL);
+static void
+write_or_die(const void *ptr, const size_t size)
+{
+   if (size && fwrite(ptr, 1, size, stdout) != size)
+      err(EXIT_FAILURE, "fwrite");
+}
 
+static void
+write_pending(const unsigned char trim, size_t pending)
+{
+   unsigned char fill[4096];
+   memset(fill, trim, sizeof(fill));
+   for (size_t w; pending > 0; pending -= w)
+      write_or_die(fill, (w = (pending > sizeof(fill) ? sizeof(fill) : pending)));
+}
+
+static void
+trim_stream(const unsigned char trim, unsigned char *buf, const size_t buf_size)
+{
    bool leading = true;
-   size_t rd, out_sz = 0, out_allocated = 0;
-   char buf[4096], *out = NULL;
-   while ((rd = fread(buf, 1, sizeof(buf), stdin))) {
-      for (const char *s = buf; s < buf + rd; ++s) {
-         if (*s == trim && leading)
+   size_t pending = 0;
+   for (size_t rd; (rd = fread(buf, 1, buf_size, stdin));) {
+      const unsigned char *s = buf;
+      size_t len = rd;
+
+      if (leading) {
+         const size_t skip = bin_span(s, len, trim);
+         if (skip == len)
             continue;
 
-         if (out_sz >= out_allocated) {
-            if (!(out = realloc(out, out_allocated += sizeof(buf))))
-               err(EXIT_FAILURE, "realloc");
+         s += skip; len -= skip;
+         leading = false;
+      }
+
+      const size_t tail = bin_rspan(s, len, trim);
+      if (tail < len) {
+         write_pending(trim, pending);
+         write_or_die(s, len - tail);
+         pending = tail;
+      } else {
+         pending += tail;
+      }
+   }
+
+   if (ferror(stdin))
+      err(EXIT_FAILURE, "fread");
+}
+
+static size_t
+file_span(const int fd, const unsigned char trim, unsigned char *buf, const size_t buf_size, const off_t size)
+{
+   size_t span = 0;
+   for (ssize_t rd; (off_t)span < size && (rd = pread(fd, buf, buf_size, span)) > 0;) {
+      const size_t s = bin_span(buf, rd, trim);
+      span += s;
+      if (s < (size_t)rd)
+         break;
+   }
+   return span;
+}
+
+static size_t
+file_rspan(const int fd, const unsigned char trim, unsigned char *buf, const size_t buf_size, const off_t size)
+{
+   size_t span = 0;
+   while ((off_t)span < size) {
+      const size_t left = size - span, len = (left > buf_size ? buf_size : left);
+      const ssize_t rd = pread(fd, buf, len, left - len);
+      if (rd != (ssize_t)len)
+         err(EXIT_FAILURE, "pread");
+
+      const size_t s = bin_rspan(buf, len, trim);
+      span += s;
+      if (s < len)
+         break;
+   }
+   return span;
+}
+
+static void
+shift_file(const int fd, const off_t by, const off_t size, unsigned char *buf, const size_t buf_size)
+{
+   // leading run isn't block aligned, so the data has to be moved down by hand
+   for (off_t off = 0; off + by < size;) {
+      const ssize_t rd = pread(fd, buf, buf_size, off + by);
+      if (rd <= 0)
+         err(EXIT_FAILURE, "pread");
+      if (pwrite(fd, buf, rd, off) != rd)
+         err(EXIT_FAILURE, "pwrite");
+      off += rd;
+   }
+}
+
+static void
+trim_file_truncate(const char *path, const unsigned char trim, unsigned char *buf, const size_t buf_size)
+{
+   int fd;
+   if ((fd = open(path, O_RDWR)) == -1)
+      err(EXIT_FAILURE, "open(%s)", path);
+
+   struct stat st;
+   if (fstat(fd, &st) != 0)
+      err(EXIT_FAILURE, "fstat(%s)", path);
+
+   const size_t lead = file_span(fd, trim, buf, buf_size, st.st_size);
+   const size_t tail = ((off_t)lead < st.st_size ? file_rspan(fd, trim, buf, buf_size, st.st_size) : 0);
+   off_t size = st.st_size - tail;
+
+   if (tail > 0 && ftruncate(fd, size) != 0)
+      err(EXIT_FAILURE, "ftruncate(%s)", path);
+
+   if (lead > 0) {
+      if (st.st_blksize > 0 && lead % st.st_blksize == 0 && (off_t)lead < size &&
+          fallocate(fd, FALLOC_FL_COLLAPSE_RANGE, 0, lead) == 0) {
+         size -= lead;
+      } else {
+         shift_file(fd, lead, size, buf, buf_size);
+         if (ftruncate(fd, (size -= lead)) != 0)
+            err(EXIT_FAILURE, "ftruncate(%s)", path);
+      }
+   }
+
+   warnx("trimmed %zu leading and %zu trailing bytes of %s", lead, tail, path);
+   close(fd);
+}
+
+static void
+trim_file_punch(const char *path, unsigned char *buf, const size_t buf_size)
+{
+   int fd;
+   if ((fd = open(path, O_RDWR)) == -1)
+      err(EXIT_FAILURE, "open(%s)", path);
+
+   struct stat st;
+   if (fstat(fd, &st) != 0)
+      err(EXIT_FAILURE, "fstat(%s)", path);
+
+   // holes read back as zero, so only block aligned zero runs can be punched
+   const size_t bs = (st.st_blksize > 0 ? (size_t)st.st_blksize : 4096);
+   const size_t chunk = buf_size - buf_size % bs;
+   size_t punched = 0, run_start = 0, run_len = 0;
+   for (off_t off = 0; off < st.st_size;) {
+      const ssize_t rd = pread(fd, buf, chunk, off);
+      if (rd <= 0)
+         err(EXIT_FAILURE, "pread");
+
+      for (size_t i = 0; i < (size_t)rd; i += bs) {
+         const size_t len = ((size_t)rd - i > bs ? bs : (size_t)rd - i);
+         if (len == bs && bin_span(buf + i, len, 0) == len) {
+            run_start = (run_len ? run_start : off + i);
+            run_len += len;
+            continue;
          }
 
-         out[out_sz++] = *s;
-         leading = false;
+         if (run_len && fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, run_start, run_len) != 0)
+            err(EXIT_FAILURE, "fallocate(%s, PUNCH_HOLE)", path);
+
+         punched += run_len;
+         run_len = 0;
       }
 
-      const char *s;
-      for (s = out + (out_sz ? out_sz - 1 : 0); s > out && *s == trim; --s);
+      off += rd;
+   }
+
+   if (run_len && fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, run_start, run_len) != 0)
+      err(EXIT_FAILURE, "fallocate(%s, PUNCH_HOLE)", path);
+
+   warnx("punched %zu bytes of holes to %s", punched + run_len, path);
+   close(fd);
+}
+
+int
+main(int argc, const char *argv[])
+{
+   unsigned char trim = 0;
+
+   if (argc > 1)
+      trim = hexdecstrtoull(argv[1], NULL);
 
-      const size_t to_write = (size_t)(s - out);
-      if (fwrite(out, 1, to_write, stdout) != to_write)
-         err(EXIT_FAILURE, "fwrite");
+   const size_t buf_size = 1024 * 1024;
+   unsigned char *buf;
+   if (!(buf = malloc(buf_size)))
+      err(EXIT_FAILURE, "malloc");
 
-      memmove(out, s, (out_sz = out_sz - to_write));
+   if (argc > 2) {
+      if (argc < 4)
+         usage(argv[0]);
+
+      if (!strcmp(argv[2], "truncate")) {
+         trim_file_truncate(argv[3], trim, buf, buf_size);
+      } else if (!strcmp(argv[2], "punch")) {
+         if (trim != 0)
+            errx(EXIT_FAILURE, "only zero runs can be punched");
+         trim_file_punch(argv[3], buf, buf_size);
+      } else {
+         errx(EXIT_FAILURE, "mode must be truncate or punch");
+      }
+   } else {
+      trim_stream(trim, buf, buf_size);
    }
 
-   free(out);
+   free(buf);
    return EXIT_SUCCESS;
 }
@@ -10,3 +10,21 @@ proc_address_rw(int argc, const char *argv[], bool (*)(struct mem_io*, const pid
 
 int
 proc_region_rw(int argc, const char *argv[], bool (*)(struct mem_io*, const pid_t));
+
+int
+proc_brute_map(int argc, const char *argv[], bool (*)(struct mem_io*, const pid_t));
+
+int
+proc_memscan(int argc, const char *argv[], bool (*)(struct mem_io*, const pid_t));
+
+int
+proc_pointer_scan(int argc, const char *argv[], bool (*)(struct mem_io*, const pid_t));
+
+int
+proc_pe_map(int argc, const char *argv[], bool (*)(struct mem_io*, const pid_t));
+
+int
+proc_page_scan(int argc, const char *argv[], bool (*)(struct mem_io*, const pid_t));
+
+int
+proc_strings(int argc, const char *argv[], bool (*)(struct mem_io*, const pid_t));
@@ -1,15 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
 #include "mem/io.h"
 #include "mem/io-stream.h"
 #include "util.h"
+#include "hex.h"
 
 static void
 usage(const char *argv0)
 {
    fprintf(stderr, "usage: %s pid write offset [len] < data\n"
-                   "       %s pid read offset len\n", argv0, argv0);
+                   "       %s pid read offset len\n"
+                   "       %s pid hexdump offset len\n"
+                   "       %s pid batch [binary] < requests\n"
+                   "       batch text requests are lines of: r address len, or w address hex-bytes\n"
+                   "       and are answered with lines of: done [hex-bytes]\n"
+                   "       batch binary requests are { address:u64 len:u32 op:u8 ('r' or 'w') pad:u8[3] } followed by len bytes for writes\n"
+                   "       and are answered with { done:u32 } followed by done bytes for reads\n"
+                   "       answers are in request order and flushed whenever all requests read so far are answered\n"
+                   "       hexdump reads like read, but as xxd compatible hex with the addresses\n", argv0, argv0, argv0, argv0);
    exit(EXIT_FAILURE);
 }
 
@@ -17,9 +31,11 @@ struct options {
    size_t offset, len;
    enum {
       MODE_WRITE,
-      MODE_READ
+      MODE_READ,
+      MODE_HEXDUMP,
+      MODE_BATCH
    } mode;
-   bool has_len;
+   bool has_len, binary;
 };
 
 static inline void
@@ -29,14 +45,23 @@ options_init(struct options *opt, size_t argc, const char *argv[])
    *opt = (struct options){0};
 
    {
-      bool w = false, r = false;
+      bool w = false, r = false, x = false, b = false;
       const char *mode = argv[arg++];
-      if (!(w = !strcmp(mode, "write")) && !(r = !strcmp(mode, "read")))
-         errx(EXIT_FAILURE, "mode must be write or read");
+      if (!(w = !strcmp(mode, "write")) && !(r = !strcmp(mode, "read")) && !(x = !strcmp(mode, "hexdump")) && !(b = !strcmp(mode, "batch")))
+         errx(EXIT_FAILURE, "mode must be write, read, hexdump or batch");
 
-      opt->mode = (w ? MODE_WRITE : MODE_READ);
+      opt->mode = (w ? MODE_WRITE : (r ? MODE_READ : (x ? MODE_HEXDUMP : MODE_BATCH)));
    }
 
+   if (opt->mode == MODE_BATCH) {
+      if (argc >= arg + 1 && !(opt->binary = !strcmp(argv[arg], "binary")) && strcmp(argv[arg], "text"))
+         errx(EXIT_FAILURE, "batch format must be text or binary");
+      return;
+   }
+
+   if (argc < arg + 1)
+      errx(EXIT_FAILURE, "%s needs an offset", (opt->mode == MODE_WRITE ? "write" : (opt->mode == MODE_READ ? "read" : "hexdump")));
+
    opt->offset = hexdecstrtoull(argv[arg++], NULL);
 
    if (argc >= arg + 1) {
@@ -44,14 +69,226 @@ options_init(struct options *opt, size_t argc, const char *argv[])
       opt->has_len = true;
    }
 
-   if (opt->mode == MODE_READ && !opt->has_len)
+   if (opt->mode != MODE_WRITE && !opt->has_len)
       usage(argv[0]);
 }
 
+// Batch mode
+// Requests are parsed from whatever input is available, consecutive reads and consecutive writes
+// each go out as one batch, so order between reads and writes is kept.
+
+#define BATCH_MAX_REQUESTS 4096
+#define BATCH_MAX_DATA (16 * 1024 * 1024)
+
+struct batch_request {
+   uint64_t address;
+   uint32_t len;
+   uint8_t op, pad[3];
+};
+
+struct batch {
+   struct batch_request *requests;
+   struct mem_io_batch *io;
+   unsigned char *data;
+   size_t num_requests, data_len, data_allocated, trw;
+   bool binary;
+};
+
+static void
+batch_answer(struct batch *batch, const size_t i)
+{
+   const struct batch_request *req = &batch->requests[i];
+   const uint32_t done = batch->io[i].done;
+
+   if (batch->binary) {
+      if (fwrite(&done, sizeof(done), 1, stdout) != 1 || (req->op == 'r' && fwrite(batch->io[i].ptr, 1, done, stdout) != done))
+         err(EXIT_FAILURE, "fwrite");
+      return;
+   }
+
+   printf("%u", done);
+   if (req->op == 'r' && done > 0) {
+      putchar(' ');
+      char hex[4096];
+      for (uint32_t b = 0; b < done; b += sizeof(hex) / 2) {
+         const size_t n = (done - b > sizeof(hex) / 2 ? sizeof(hex) / 2 : done - b);
+         hex_encode(hex, (unsigned char*)batch->io[i].ptr + b, n);
+         fwrite(hex, 1, n * 2, stdout);
+      }
+   }
+   putchar('\n');
+}
+
+static void
+batch_flush(struct batch *batch, const struct mem_io *io)
+{
+   for (size_t i = 0; i < batch->num_requests;) {
+      size_t n = 1;
+      for (; i + n < batch->num_requests && batch->requests[i + n].op == batch->requests[i].op; ++n);
+
+      // ptr of every entry was stored as an offset into data, which may have been reallocated since
+      for (size_t j = i; j < i + n; ++j)
+         batch->io[j].ptr = batch->data + (uintptr_t)batch->io[j].ptr;
+
+      if (batch->requests[i].op == 'r') {
+         batch->trw += mem_io_read_batch(io, batch->io + i, n);
+      } else if (batch->requests[i].op == 'w') {
+         batch->trw += mem_io_write_batch(io, batch->io + i, n);
+      }
+
+      for (size_t j = i; j < i + n; ++j)
+         batch_answer(batch, j);
+
+      i += n;
+   }
+
+   if (fflush(stdout) != 0)
+      err(EXIT_FAILURE, "fflush");
+
+   batch->num_requests = batch->data_len = 0;
+}
+
+static void*
+batch_push(struct batch *batch, const struct mem_io *io, const struct batch_request *req)
+{
+   if (batch->num_requests >= BATCH_MAX_REQUESTS || (batch->data_len > 0 && batch->data_len + req->len > BATCH_MAX_DATA))
+      batch_flush(batch, io);
+
+   if (!batch->requests) {
+      if (!(batch->requests = malloc(sizeof(*batch->requests) * BATCH_MAX_REQUESTS)) || !(batch->io = malloc(sizeof(*batch->io) * BATCH_MAX_REQUESTS)))
+         err(EXIT_FAILURE, "malloc");
+   }
+
+   if (batch->data_len + req->len + 1 > batch->data_allocated) {
+      const size_t want = batch->data_len + req->len + 1, doubled = batch->data_allocated * 2;
+      if (!(batch->data = realloc(batch->data, (batch->data_allocated = (want > doubled ? want : doubled)))))
+         err(EXIT_FAILURE, "realloc");
+   }
+
+   const size_t i = batch->num_requests++;
+   batch->requests[i] = *req;
+   batch->io[i] = (struct mem_io_batch){ .ptr = (void*)(uintptr_t)batch->data_len, .offset = req->address, .size = req->len };
+   batch->data_len += req->len;
+   return batch->data + batch->data_len - req->len;
+}
+
+static size_t
+batch_parse_text(struct batch *batch, const struct mem_io *io, const char *in, const size_t len)
+{
+   size_t ate = 0;
+   for (const char *nl; (nl = memchr(in + ate, '\n', len - ate)); ate = nl - in + 1) {
+      const char *line = in + ate;
+      while (line < nl && isspace((unsigned char)*line))
+         ++line;
+
+      if (line == nl || *line == '#')
+         continue;
+
+      // malformed requests still get an answer with done of 0, so answers stay in request order
+      struct batch_request req = { .op = *line };
+      char *end;
+      req.address = hexdecstrtoull(line + 1 + strspn(line + 1, " \t"), &end);
+      end += strspn(end, " \t");
+
+      // checked before narrowing, so lengths past 32 bits don't wrap into valid ones
+      const char *hex = end;
+      uint64_t len = 0;
+      if (req.op == 'r') {
+         len = hexdecstrtoull(end, NULL);
+      } else if (req.op == 'w') {
+         len = strspn(hex, "0123456789abcdefABCDEF") / 2;
+      } else {
+         warnx("unknown request: %.*s", (int)(nl - line), line);
+      }
+
+      if (len > BATCH_MAX_DATA) {
+         warnx("request of %" PRIu64 " bytes is larger than %u bytes", len, BATCH_MAX_DATA);
+         len = 0;
+      }
+      req.len = len;
+
+      unsigned char *data = batch_push(batch, io, &req);
+      for (uint32_t i = 0; req.op == 'w' && i < req.len; ++i)
+         sscanf(hex + i * 2, "%2hhx", &data[i]);
+   }
+   return ate;
+}
+
+static size_t
+batch_parse_binary(struct batch *batch, const struct mem_io *io, const unsigned char *in, const size_t len)
+{
+   size_t ate = 0;
+   for (struct batch_request req; len - ate >= sizeof(req); ate += sizeof(req) + (req.op == 'w' ? req.len : 0)) {
+      memcpy(&req, in + ate, sizeof(req));
+
+      if (req.len > BATCH_MAX_DATA)
+         errx(EXIT_FAILURE, "request of %u bytes is larger than %u bytes", req.len, BATCH_MAX_DATA);
+
+      if (req.op == 'w' && len - ate - sizeof(req) < req.len)
+         break;
+
+      unsigned char *data = batch_push(batch, io, &req);
+      if (req.op == 'w')
+         memcpy(data, in + ate + sizeof(req), req.len);
+   }
+   return ate;
+}
+
+static size_t
+batch_run(const struct mem_io *io, const bool binary)
+{
+   struct batch batch = { .binary = binary };
+   unsigned char *in = NULL;
+   size_t len = 0, allocated = 0;
+
+   for (;;) {
+      const size_t step = 64 * 1024;
+      if (len + step > allocated && !(in = realloc(in, (allocated = len + step))))
+         err(EXIT_FAILURE, "realloc");
+
+      const ssize_t rd = read(STDIN_FILENO, in + len, allocated - len);
+      if (rd < 0 && errno == EINTR)
+         continue;
+
+      if (rd < 0)
+         err(EXIT_FAILURE, "read");
+
+      // last line doesn't need a newline
+      if (rd == 0 && !binary && len > 0 && in[len - 1] != '\n')
+         in[len++] = '\n';
+
+      len += (rd > 0 ? rd : 0);
+      const size_t ate = (binary ? batch_parse_binary(&batch, io, in, len) : batch_parse_text(&batch, io, (const char*)in, len));
+      memmove(in, in + ate, len - ate);
+      len -= ate;
+
+      // everything available is answered before blocking for more
+      batch_flush(&batch, io);
+
+      if (rd == 0)
+         break;
+   }
+
+   if (len > 0)
+      warnx("ignoring %zu bytes of incomplete request", len);
+
+   free(in);
+   free(batch.requests);
+   free(batch.io);
+   free(batch.data);
+   return batch.trw;
+}
+
+static size_t
+hexdump_stream_write(const struct mem_io_ostream *stream, const void *ptr, const size_t size)
+{
+   return hexdump_write(stream->backing, ptr, size);
+}
+
 int
 proc_address_rw(int argc, const char *argv[], bool (*mem_io_init)(struct mem_io*, const pid_t))
 {
-   if (argc < 4)
+   if (argc < 3)
       usage(argv[0]);
 
    const pid_t pid = strtoull(argv[1], NULL, 10);
@@ -64,9 +301,18 @@ proc_address_rw(int argc, const char *argv[], bool (*mem_io_init)(struct mem_io*
        return EXIT_FAILURE;
 
    size_t trw = 0;
-   if (opt.mode == MODE_WRITE) {
+   if (opt.mode == MODE_BATCH) {
+      trw = batch_run(&io, opt.binary);
+   } else if (opt.mode == MODE_WRITE) {
       struct mem_io_istream stream = mem_io_istream_from_file(stdin);
       trw = mem_io_write_from_stream(&io, &stream, opt.offset, (opt.has_len ? opt.len : (size_t)~0));
+   } else if (opt.mode == MODE_HEXDUMP) {
+      struct hexdump dump = hexdump_init(stdout, opt.offset);
+      const struct mem_io_ostream stream = { .write = hexdump_stream_write, .backing = &dump };
+      trw = mem_io_read_to_stream(&io, &stream, opt.offset, opt.len);
+
+      if (!hexdump_finish(&dump))
+         err(EXIT_FAILURE, "fwrite");
    } else {
       struct mem_io_ostream stream = mem_io_ostream_from_file(stdout);
       trw = mem_io_read_to_stream(&io, &stream, opt.offset, opt.len);
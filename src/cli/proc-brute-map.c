@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mem/io.h"
+#include "util.h"
+#include "bin.h"
+#include "parallel.h"
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr, "usage: %s pid file [window-size] < regions\n"
+                   "       regions must be in /proc/<pid>/maps format\n"
+                   "       fixes zero offsets of regions by bruteforcing the offsets from a known file\n", argv0);
+   exit(EXIT_FAILURE);
+}
+
+struct job {
+   char *line;
+   struct region region;
+   unsigned char *data;
+   size_t len, offset;
+   bool needs_search, found;
+};
+
+struct context {
+   struct job *jobs;
+   size_t num_jobs, allocated_jobs, window_size;
+
+   struct {
+      const unsigned char *data;
+      size_t len;
+   } haystack;
+};
+
+static void
+region_cb(const char *line, void *data)
+{
+   struct context *ctx = data;
+
+   const size_t step = 1024;
+   if (ctx->num_jobs >= ctx->allocated_jobs && !(ctx->jobs = realloc(ctx->jobs, sizeof(*ctx->jobs) * (ctx->allocated_jobs += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   struct job *job = &ctx->jobs[ctx->num_jobs];
+   *job = (struct job){0};
+
+   if (!region_parse(&job->region, line))
+      return;
+
+   if (!(job->line = strdup(line)))
+      err(EXIT_FAILURE, "strdup");
+
+   job->needs_search = (job->region.offset == 0);
+   ctx->num_jobs++;
+}
+
+static void
+read_regions(struct context *ctx, struct mem_io *io)
+{
+   // only place where the target is touched, everything is read in one go while attached
+   for (size_t i = 0; i < ctx->num_jobs; ++i) {
+      struct job *job = &ctx->jobs[i];
+      if (!job->needs_search)
+         continue;
+
+      const size_t len = job->region.end - job->region.start + 1;
+      if (!(job->data = malloc(len)))
+         err(EXIT_FAILURE, "malloc");
+
+      const size_t rd = io->read(io, job->data, job->region.start, len);
+
+      size_t start;
+      job->len = bin_trim(job->data, rd, 0, &start);
+      job->len = (ctx->window_size && job->len > ctx->window_size ? ctx->window_size : job->len);
+      memmove(job->data, job->data + start, job->len);
+
+      unsigned char *shrunk;
+      if (job->len > 0 && (shrunk = realloc(job->data, job->len)))
+         job->data = shrunk;
+   }
+}
+
+static void
+search_cb(const size_t i, void *data)
+{
+   struct context *ctx = data;
+   struct job *job = &ctx->jobs[i];
+
+   if (!job->needs_search || !job->len)
+      return;
+
+   const unsigned char *match;
+   if ((match = bin_search(ctx->haystack.data, ctx->haystack.len, job->data, job->len))) {
+      job->offset = match - ctx->haystack.data;
+      job->found = true;
+   }
+
+   free(job->data);
+   job->data = NULL;
+}
+
+static void
+map_haystack(struct context *ctx, const char *path)
+{
+   int fd;
+   if ((fd = open(path, O_RDONLY)) == -1)
+      err(EXIT_FAILURE, "open(%s)", path);
+
+   struct stat st;
+   if (fstat(fd, &st) != 0)
+      err(EXIT_FAILURE, "fstat(%s)", path);
+
+   ctx->haystack.len = st.st_size;
+
+   void *mapped = NULL;
+   if (ctx->haystack.len > 0 && (mapped = mmap(NULL, ctx->haystack.len, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+      err(EXIT_FAILURE, "mmap(%s)", path);
+
+   close(fd);
+   ctx->haystack.data = mapped;
+}
+
+static void
+print_job(const struct job *job)
+{
+   if (!job->needs_search) {
+      printf("%s\n", job->line);
+      return;
+   }
+
+   if (!job->found)
+      return;
+
+   // replace the third field (offset) and keep the rest of the line as is
+   int offset_start = 0, offset_end = 0;
+   sscanf(job->line, "%*s %*s %n%*s%n", &offset_start, &offset_end);
+   printf("%.*s%.8zx%s\n", offset_start, job->line, job->offset, job->line + offset_end);
+}
+
+int
+proc_brute_map(int argc, const char *argv[], bool (*mem_io_init)(struct mem_io*, const pid_t))
+{
+   if (argc < 3)
+      usage(argv[0]);
+
+   const pid_t pid = strtoull(argv[1], NULL, 10);
+
+   struct context ctx = {0};
+   if (argc > 3)
+      ctx.window_size = hexdecstrtoull(argv[3], NULL);
+
+   for_each_token_in_file(stdin, '\n', region_cb, &ctx);
+
+   struct mem_io io;
+   if (!mem_io_init(&io, pid))
+      return EXIT_FAILURE;
+
+   read_regions(&ctx, &io);
+   mem_io_release(&io);
+
+   map_haystack(&ctx, argv[2]);
+   parallel_for(ctx.num_jobs, search_cb, &ctx);
+
+   size_t found = 0;
+   for (size_t i = 0; i < ctx.num_jobs; ++i) {
+      print_job(&ctx.jobs[i]);
+      found += ctx.jobs[i].found;
+      free(ctx.jobs[i].line);
+   }
+
+   if (ctx.haystack.data)
+      munmap((void*)ctx.haystack.data, ctx.haystack.len);
+
+   free(ctx.jobs);
+   return (found ? EXIT_SUCCESS : EXIT_FAILURE);
+}
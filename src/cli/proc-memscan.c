@@ -0,0 +1,635 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mem/io.h"
+#include "util.h"
+#include "parallel.h"
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr, "usage: %s pid session new type op [value] [value] < regions\n"
+                   "       %s pid session filter op [value] [value]\n"
+                   "       %s pid session list [max]\n"
+                   "       regions must be in /proc/<pid>/maps format\n"
+                   "       type is u8, u16, u32, u64, i8, i16, i32, i64, f32 or f64\n"
+                   "       new takes eq value, range min max or any\n"
+                   "       filter takes eq value, range min max, changed, unchanged, increased or decreased\n", argv0, argv0, argv0);
+   exit(EXIT_FAILURE);
+}
+
+// Session file
+// Address space is split into blocks, each block stores its candidates either as
+// every slot, a bitmap of slots or delta encoded slot list, whichever is the smallest.
+// Values of the candidates from the last scan follow, so filters can compare against them.
+//
+// header | block | set | values | block | set | values ...
+
+#define MEMSCAN_MAGIC "MEMSCAN1"
+#define MEMSCAN_BLOCK_SPAN (1024 * 1024)
+
+struct memscan_header {
+   char magic[8];
+   uint32_t type, scans;
+   uint64_t num_blocks, num_candidates;
+};
+
+struct memscan_block {
+   uint64_t start;
+   uint32_t slots, count, encoding, set_size;
+};
+
+enum encoding {
+   ENCODING_ALL,
+   ENCODING_BITMAP,
+   ENCODING_DELTA,
+};
+
+enum type {
+   TYPE_U8,
+   TYPE_U16,
+   TYPE_U32,
+   TYPE_U64,
+   TYPE_I8,
+   TYPE_I16,
+   TYPE_I32,
+   TYPE_I64,
+   TYPE_F32,
+   TYPE_F64,
+   TYPE_LAST,
+};
+
+static const struct {
+   const char *name;
+   size_t size;
+} types[TYPE_LAST] = {
+   { "u8", 1 }, { "u16", 2 }, { "u32", 4 }, { "u64", 8 },
+   { "i8", 1 }, { "i16", 2 }, { "i32", 4 }, { "i64", 8 },
+   { "f32", 4 }, { "f64", 8 },
+};
+
+enum op {
+   OP_ANY,
+   OP_RANGE,
+   OP_CHANGED,
+   OP_UNCHANGED,
+   OP_INCREASED,
+   OP_DECREASED,
+};
+
+union value {
+   uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64;
+   int8_t i8; int16_t i16; int32_t i32; int64_t i64;
+   float f32; double f64;
+};
+
+struct job {
+   struct memscan_block old, block;
+   const unsigned char *old_set; // NULL on the first scan
+   unsigned char *out;
+   size_t out_size;
+};
+
+struct context {
+   struct mem_io io;
+   enum type type;
+   enum op op;
+   union value a, b;
+
+   struct job *jobs;
+   size_t num_jobs, allocated_jobs;
+};
+
+// Kernels compare 16 bytes of values at a time with gcc vector extensions,
+// lanes are only looked at one by one when some of them matched.
+// Integer lanes use the same ordered compares as float ones, so there is no float equality anywhere.
+
+#define SCAN_LANES(expr) \
+   for (size_t i = 0; i < n; i += lanes) { \
+      const size_t left = (n - i > lanes ? lanes : n - i); \
+      vec c = {0}, o = {0}; \
+      if (left == lanes) { \
+         memcpy(&c, cur + i * sizeof(c[0]), sizeof(c)); \
+         if (old) \
+            memcpy(&o, old + i * sizeof(o[0]), sizeof(o)); \
+      } else { \
+         memcpy(&c, cur + i * sizeof(c[0]), left * sizeof(c[0])); \
+         if (old) \
+            memcpy(&o, old + i * sizeof(o[0]), left * sizeof(o[0])); \
+      } \
+      const mask m = (expr); \
+      uint64_t any[2]; \
+      memcpy(any, &m, sizeof(any)); \
+      if (!(any[0] | any[1])) \
+         continue; \
+      for (size_t l = 0; l < left; ++l) \
+         bits[(i + l) / 64] |= (uint64_t)(m[l] & 1) << ((i + l) % 64); \
+   }
+
+#define SCAN_KERNEL(name, T, M) \
+static void \
+name(const unsigned char *cur, const unsigned char *old, const size_t n, const enum op op, const T a, const T b, uint64_t *bits) \
+{ \
+   typedef T vec __attribute__((vector_size(16))); \
+   typedef M mask __attribute__((vector_size(16))); \
+   const size_t lanes = sizeof(vec) / sizeof(T); \
+   const vec va = (vec){0} + a, vb = (vec){0} + b; \
+   memset(bits, 0, sizeof(*bits) * ((n + 63) / 64)); \
+   switch (op) { \
+      case OP_ANY: SCAN_LANES((mask){0} - 1); break; \
+      case OP_RANGE: SCAN_LANES((c >= va) & (c <= vb)); break; \
+      case OP_CHANGED: SCAN_LANES((c < o) | (c > o)); break; \
+      case OP_UNCHANGED: SCAN_LANES((c >= o) & (c <= o)); break; \
+      case OP_INCREASED: SCAN_LANES(c > o); break; \
+      case OP_DECREASED: SCAN_LANES(c < o); break; \
+   } \
+}
+
+SCAN_KERNEL(scan_u8, uint8_t, int8_t)
+SCAN_KERNEL(scan_u16, uint16_t, int16_t)
+SCAN_KERNEL(scan_u32, uint32_t, int32_t)
+SCAN_KERNEL(scan_u64, uint64_t, int64_t)
+SCAN_KERNEL(scan_i8, int8_t, int8_t)
+SCAN_KERNEL(scan_i16, int16_t, int16_t)
+SCAN_KERNEL(scan_i32, int32_t, int32_t)
+SCAN_KERNEL(scan_i64, int64_t, int64_t)
+SCAN_KERNEL(scan_f32, float, int32_t)
+SCAN_KERNEL(scan_f64, double, int64_t)
+
+static void
+scan(const struct context *ctx, const unsigned char *cur, const unsigned char *old, const size_t n, uint64_t *bits)
+{
+   // changed and unchanged compare the bit patterns, so NaNs and negative zeroes behave
+   const bool bitwise = (ctx->op == OP_CHANGED || ctx->op == OP_UNCHANGED);
+   const union value a = ctx->a, b = ctx->b;
+   switch (ctx->type) {
+      case TYPE_U8: scan_u8(cur, old, n, ctx->op, a.u8, b.u8, bits); break;
+      case TYPE_U16: scan_u16(cur, old, n, ctx->op, a.u16, b.u16, bits); break;
+      case TYPE_U32: scan_u32(cur, old, n, ctx->op, a.u32, b.u32, bits); break;
+      case TYPE_U64: scan_u64(cur, old, n, ctx->op, a.u64, b.u64, bits); break;
+      case TYPE_I8: (bitwise ? scan_u8(cur, old, n, ctx->op, 0, 0, bits) : scan_i8(cur, old, n, ctx->op, a.i8, b.i8, bits)); break;
+      case TYPE_I16: (bitwise ? scan_u16(cur, old, n, ctx->op, 0, 0, bits) : scan_i16(cur, old, n, ctx->op, a.i16, b.i16, bits)); break;
+      case TYPE_I32: (bitwise ? scan_u32(cur, old, n, ctx->op, 0, 0, bits) : scan_i32(cur, old, n, ctx->op, a.i32, b.i32, bits)); break;
+      case TYPE_I64: (bitwise ? scan_u64(cur, old, n, ctx->op, 0, 0, bits) : scan_i64(cur, old, n, ctx->op, a.i64, b.i64, bits)); break;
+      case TYPE_F32: (bitwise ? scan_u32(cur, old, n, ctx->op, 0, 0, bits) : scan_f32(cur, old, n, ctx->op, a.f32, b.f32, bits)); break;
+      case TYPE_F64: (bitwise ? scan_u64(cur, old, n, ctx->op, 0, 0, bits) : scan_f64(cur, old, n, ctx->op, a.f64, b.f64, bits)); break;
+      case TYPE_LAST: break;
+   }
+}
+
+static size_t
+varint_size(uint32_t v)
+{
+   size_t n = 1;
+   for (; v >= 0x80; v >>= 7, ++n);
+   return n;
+}
+
+static unsigned char*
+varint_put(unsigned char *dst, uint32_t v)
+{
+   for (; v >= 0x80; v >>= 7)
+      *dst++ = (v & 0x7f) | 0x80;
+   *dst++ = v;
+   return dst;
+}
+
+static const unsigned char*
+varint_get(const unsigned char *src, const unsigned char *end, uint32_t *out)
+{
+   uint32_t v = 0;
+   for (unsigned int shift = 0; src < end && shift < 32; shift += 7) {
+      const unsigned char c = *src++;
+      v |= (uint32_t)(c & 0x7f) << shift;
+      if (!(c & 0x80))
+         break;
+   }
+   *out = v;
+   return src;
+}
+
+static void
+encode_block(struct job *job, const uint32_t *slots, const unsigned char *values, const size_t size)
+{
+   struct memscan_block *block = &job->block;
+
+   size_t delta_size = 0;
+   for (size_t i = 0; i < block->count; ++i)
+      delta_size += varint_size(slots[i] - (i ? slots[i - 1] : 0));
+
+   const size_t bitmap_size = (block->slots + 7) / 8;
+   if (block->count == block->slots) {
+      block->encoding = ENCODING_ALL;
+      block->set_size = 0;
+   } else if (bitmap_size < delta_size) {
+      block->encoding = ENCODING_BITMAP;
+      block->set_size = bitmap_size;
+   } else {
+      block->encoding = ENCODING_DELTA;
+      block->set_size = delta_size;
+   }
+
+   job->out_size = sizeof(*block) + block->set_size + block->count * size;
+   if (!(job->out = malloc(job->out_size)))
+      err(EXIT_FAILURE, "malloc");
+
+   unsigned char *set = job->out + sizeof(*block);
+   memcpy(job->out, block, sizeof(*block));
+
+   if (block->encoding == ENCODING_BITMAP) {
+      memset(set, 0, block->set_size);
+      for (size_t i = 0; i < block->count; ++i)
+         set[slots[i] / 8] |= 1 << (slots[i] % 8);
+   } else if (block->encoding == ENCODING_DELTA) {
+      unsigned char *dst = set;
+      for (size_t i = 0; i < block->count; ++i)
+         dst = varint_put(dst, slots[i] - (i ? slots[i - 1] : 0));
+   }
+
+   memcpy(set + block->set_size, values, block->count * size);
+}
+
+static size_t
+decode_block(const struct memscan_block *block, const unsigned char *set, uint32_t *slots)
+{
+   size_t n = 0;
+   if (block->encoding == ENCODING_ALL) {
+      for (; n < block->count; ++n)
+         slots[n] = n;
+   } else if (block->encoding == ENCODING_BITMAP) {
+      for (size_t i = 0; i < block->slots && n < block->count; ++i) {
+         if (set[i / 8] & (1 << (i % 8)))
+            slots[n++] = i;
+      }
+   } else {
+      const unsigned char *end = set + block->set_size;
+      for (uint32_t slot = 0, delta; set < end && n < block->count; slots[n++] = (slot += delta))
+         set = varint_get(set, end, &delta);
+   }
+   return n;
+}
+
+static void
+scan_cb(const size_t i, void *data)
+{
+   struct context *ctx = data;
+   struct job *job = &ctx->jobs[i];
+   const struct memscan_block *old = (job->old_set ? &job->old : NULL);
+   const size_t size = types[ctx->type].size;
+   const size_t slots = (old ? old->slots : job->block.slots);
+
+   unsigned char *buf, *cur;
+   uint32_t *idx;
+   uint64_t *bits;
+   if (!(buf = malloc(slots * size)) || !(cur = malloc(slots * size)) ||
+       !(idx = malloc(sizeof(*idx) * slots)) || !(bits = malloc(sizeof(*bits) * ((slots + 63) / 64))))
+      err(EXIT_FAILURE, "malloc");
+
+   size_t n = slots;
+   const unsigned char *old_values = NULL;
+   if (old) {
+      n = decode_block(old, job->old_set, idx);
+      old_values = job->old_set + old->set_size;
+   }
+
+   // few candidates are cheaper to read one by one than the whole block
+   size_t valid = 0;
+   if (old && n < 16) {
+      for (; valid < n && ctx->io.read(&ctx->io, cur + valid * size, old->start + (size_t)idx[valid] * size, size) == size; ++valid);
+   } else {
+      const size_t rd = ctx->io.read(&ctx->io, buf, job->block.start, slots * size) / size;
+      if (old) {
+         for (; valid < n && idx[valid] < rd; ++valid)
+            memcpy(cur + valid * size, buf + (size_t)idx[valid] * size, size);
+      } else {
+         for (valid = 0; valid < rd; ++valid)
+            idx[valid] = valid;
+         memcpy(cur, buf, rd * size);
+      }
+   }
+
+   scan(ctx, cur, old_values, valid, bits);
+
+   size_t count = 0;
+   for (size_t w = 0; w < (valid + 63) / 64; ++w) {
+      for (uint64_t m = bits[w]; m; m &= m - 1) {
+         const size_t k = w * 64 + __builtin_ctzll(m);
+         idx[count] = idx[k];
+         memmove(cur + count * size, cur + k * size, size);
+         ++count;
+      }
+   }
+
+   job->block.count = count;
+   if (count > 0)
+      encode_block(job, idx, cur, size);
+
+   free(bits);
+   free(idx);
+   free(cur);
+   free(buf);
+}
+
+static size_t
+run_jobs(struct context *ctx, FILE *out, struct memscan_header *header)
+{
+   // blocks are scanned in batches, so only a batch of encoded blocks is ever kept in memory
+   const size_t batch = parallel_threads() * 4;
+   size_t bytes = 0;
+   for (size_t i = 0; i < ctx->num_jobs; i += batch) {
+      struct context sub = *ctx;
+      sub.jobs += i;
+      sub.num_jobs = (ctx->num_jobs - i > batch ? batch : ctx->num_jobs - i);
+      parallel_for(sub.num_jobs, scan_cb, &sub);
+
+      for (size_t j = 0; j < sub.num_jobs; ++j) {
+         struct job *job = &sub.jobs[j];
+         if (!job->block.count)
+            continue;
+
+         if (fwrite(job->out, 1, job->out_size, out) != job->out_size)
+            err(EXIT_FAILURE, "fwrite");
+
+         header->num_blocks++;
+         header->num_candidates += job->block.count;
+         bytes += job->out_size;
+         free(job->out);
+      }
+   }
+   return bytes;
+}
+
+static void
+push_job(struct context *ctx, const struct job *job)
+{
+   const size_t step = 1024;
+   if (ctx->num_jobs >= ctx->allocated_jobs && !(ctx->jobs = realloc(ctx->jobs, sizeof(*ctx->jobs) * (ctx->allocated_jobs += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   ctx->jobs[ctx->num_jobs++] = *job;
+}
+
+static void
+region_cb(const char *line, void *data)
+{
+   struct context *ctx = data;
+
+   struct region region;
+   char perms[5] = {0};
+   if (!region_parse(&region, line) || sscanf(line, "%*s %4s", perms) != 1 || perms[0] != 'r')
+      return;
+
+   const size_t size = types[ctx->type].size;
+   for (size_t start = region.start; start <= region.end; start += MEMSCAN_BLOCK_SPAN) {
+      const size_t span = (region.end - start + 1 > MEMSCAN_BLOCK_SPAN ? MEMSCAN_BLOCK_SPAN : region.end - start + 1);
+      if (span < size)
+         break;
+
+      push_job(ctx, &(struct job){ .block = { .start = start, .slots = span / size } });
+   }
+}
+
+static bool
+parse_value(const enum type type, const char *str, union value *v)
+{
+   char *end;
+   switch (type) {
+      case TYPE_U8: v->u8 = hexdecstrtoull(str, &end); break;
+      case TYPE_U16: v->u16 = hexdecstrtoull(str, &end); break;
+      case TYPE_U32: v->u32 = hexdecstrtoull(str, &end); break;
+      case TYPE_U64: v->u64 = hexdecstrtoull(str, &end); break;
+      case TYPE_I8: v->i8 = strtoll(str, &end, 0); break;
+      case TYPE_I16: v->i16 = strtoll(str, &end, 0); break;
+      case TYPE_I32: v->i32 = strtoll(str, &end, 0); break;
+      case TYPE_I64: v->i64 = strtoll(str, &end, 0); break;
+      case TYPE_F32: v->f32 = strtof(str, &end); break;
+      case TYPE_F64: v->f64 = strtod(str, &end); break;
+      default: return false;
+   }
+   return (end != str && *end == 0);
+}
+
+static void
+print_value(const enum type type, const unsigned char *ptr)
+{
+   union value v;
+   memcpy(&v, ptr, types[type].size);
+   switch (type) {
+      case TYPE_U8: printf("%u", v.u8); break;
+      case TYPE_U16: printf("%u", v.u16); break;
+      case TYPE_U32: printf("%u", v.u32); break;
+      case TYPE_U64: printf("%llu", (unsigned long long)v.u64); break;
+      case TYPE_I8: printf("%d", v.i8); break;
+      case TYPE_I16: printf("%d", v.i16); break;
+      case TYPE_I32: printf("%d", v.i32); break;
+      case TYPE_I64: printf("%lld", (long long)v.i64); break;
+      case TYPE_F32: printf("%g", v.f32); break;
+      case TYPE_F64: printf("%g", v.f64); break;
+      case TYPE_LAST: break;
+   }
+}
+
+static size_t
+parse_op(struct context *ctx, const bool first, const size_t argc, const char *argv[])
+{
+   static const struct {
+      const char *name;
+      enum op op;
+      size_t values;
+      bool first, filter;
+   } ops[] = {
+      { "any", OP_ANY, 0, true, false },
+      { "eq", OP_RANGE, 1, true, true },
+      { "range", OP_RANGE, 2, true, true },
+      { "changed", OP_CHANGED, 0, false, true },
+      { "unchanged", OP_UNCHANGED, 0, false, true },
+      { "increased", OP_INCREASED, 0, false, true },
+      { "decreased", OP_DECREASED, 0, false, true },
+   };
+
+   if (argc < 1)
+      errx(EXIT_FAILURE, "missing op");
+
+   for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i) {
+      if (strcmp(argv[0], ops[i].name))
+         continue;
+
+      if ((first && !ops[i].first) || (!first && !ops[i].filter))
+         errx(EXIT_FAILURE, "%s can't be used with %s", ops[i].name, (first ? "new" : "filter"));
+
+      if (argc < 1 + ops[i].values)
+         errx(EXIT_FAILURE, "%s needs %zu value(s)", ops[i].name, ops[i].values);
+
+      if (ops[i].values > 0 && !parse_value(ctx->type, argv[1], &ctx->a))
+         errx(EXIT_FAILURE, "invalid %s value `%s`", types[ctx->type].name, argv[1]);
+
+      ctx->b = ctx->a;
+      if (ops[i].values > 1 && !parse_value(ctx->type, argv[2], &ctx->b))
+         errx(EXIT_FAILURE, "invalid %s value `%s`", types[ctx->type].name, argv[2]);
+
+      ctx->op = ops[i].op;
+      return ops[i].values;
+   }
+
+   errx(EXIT_FAILURE, "unknown op `%s`", argv[0]);
+   return 0;
+}
+
+static const unsigned char*
+map_session(const char *path, size_t *out_size)
+{
+   int fd;
+   if ((fd = open(path, O_RDONLY)) == -1)
+      err(EXIT_FAILURE, "open(%s)", path);
+
+   struct stat st;
+   if (fstat(fd, &st) != 0)
+      err(EXIT_FAILURE, "fstat(%s)", path);
+
+   void *mapped;
+   if ((size_t)st.st_size < sizeof(struct memscan_header) || (mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+      errx(EXIT_FAILURE, "%s is not a memscan session", path);
+
+   close(fd);
+
+   const struct memscan_header *header = mapped;
+   if (memcmp(header->magic, MEMSCAN_MAGIC, sizeof(header->magic)) || header->type >= TYPE_LAST)
+      errx(EXIT_FAILURE, "%s is not a memscan session", path);
+
+   *out_size = st.st_size;
+   return mapped;
+}
+
+static const unsigned char*
+next_block(const unsigned char *session, const size_t size, size_t *offset, struct memscan_block *block)
+{
+   // blocks aren't aligned, the header is copied to block and the payload after it is returned
+   const struct memscan_header *header = (const struct memscan_header*)session;
+   if (*offset + sizeof(*block) > size)
+      return NULL;
+
+   memcpy(block, session + *offset, sizeof(*block));
+   const size_t block_size = sizeof(*block) + block->set_size + (size_t)block->count * types[header->type].size;
+   if (*offset + block_size > size)
+      errx(EXIT_FAILURE, "session is truncated");
+
+   const unsigned char *set = session + *offset + sizeof(*block);
+   *offset += block_size;
+   return set;
+}
+
+static void
+list(const char *path, const size_t max)
+{
+   size_t size;
+   const unsigned char *session = map_session(path, &size);
+   const struct memscan_header *header = (const struct memscan_header*)session;
+   const size_t value_size = types[header->type].size;
+
+   uint32_t *idx;
+   if (!(idx = malloc(sizeof(*idx) * (MEMSCAN_BLOCK_SPAN / value_size))))
+      err(EXIT_FAILURE, "malloc");
+
+   size_t printed = 0;
+   struct memscan_block block;
+   const unsigned char *set;
+   for (size_t offset = sizeof(*header); printed < max && (set = next_block(session, size, &offset, &block));) {
+      const size_t n = decode_block(&block, set, idx);
+      const unsigned char *values = set + block.set_size;
+      for (size_t i = 0; i < n && printed < max; ++i, ++printed) {
+         printf("%zx ", (size_t)block.start + (size_t)idx[i] * value_size);
+         print_value(header->type, values + i * value_size);
+         putchar('\n');
+      }
+   }
+
+   free(idx);
+   munmap((void*)session, size);
+}
+
+int
+proc_memscan(int argc, const char *argv[], bool (*mem_io_init)(struct mem_io*, const pid_t))
+{
+   if (argc < 4)
+      usage(argv[0]);
+
+   const pid_t pid = strtoull(argv[1], NULL, 10);
+   const char *path = argv[2], *mode = argv[3];
+
+   if (!strcmp(mode, "list")) {
+      list(path, (argc > 4 ? hexdecstrtoull(argv[4], NULL) : (size_t)~0));
+      return EXIT_SUCCESS;
+   }
+
+   struct context ctx = {0};
+   struct memscan_header header = { .magic = MEMSCAN_MAGIC };
+   const unsigned char *session = NULL;
+   size_t session_size = 0;
+
+   if (!strcmp(mode, "new")) {
+      if (argc < 6)
+         usage(argv[0]);
+
+      for (ctx.type = 0; ctx.type < TYPE_LAST && strcmp(types[ctx.type].name, argv[4]); ++ctx.type);
+      if (ctx.type == TYPE_LAST)
+         errx(EXIT_FAILURE, "unknown type `%s`", argv[4]);
+
+      parse_op(&ctx, true, argc - 5, argv + 5);
+      for_each_token_in_file(stdin, '\n', region_cb, &ctx);
+   } else if (!strcmp(mode, "filter")) {
+      session = map_session(path, &session_size);
+      memcpy(&header, session, sizeof(header));
+      ctx.type = header.type;
+      parse_op(&ctx, false, argc - 4, argv + 4);
+
+      struct memscan_block block;
+      const unsigned char *set;
+      for (size_t offset = sizeof(header); (set = next_block(session, session_size, &offset, &block));)
+         push_job(&ctx, &(struct job){ .old = block, .old_set = set, .block = { .start = block.start, .slots = block.slots } });
+   } else {
+      usage(argv[0]);
+   }
+
+   header.type = ctx.type;
+   header.scans++;
+   header.num_blocks = header.num_candidates = 0;
+
+   // written next to the old session and renamed over it, so a failed scan never loses the candidates
+   char tmp[4096];
+   snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+   FILE *out;
+   if (!(out = fopen(tmp, "wb")))
+      err(EXIT_FAILURE, "fopen(%s)", tmp);
+
+   if (fwrite(&header, 1, sizeof(header), out) != sizeof(header))
+      err(EXIT_FAILURE, "fwrite");
+
+   if (!mem_io_init(&ctx.io, pid))
+      return EXIT_FAILURE;
+
+   const size_t bytes = run_jobs(&ctx, out, &header);
+   mem_io_release(&ctx.io);
+
+   if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, 1, sizeof(header), out) != sizeof(header))
+      err(EXIT_FAILURE, "fwrite");
+
+   if (fclose(out) != 0)
+      err(EXIT_FAILURE, "fclose(%s)", tmp);
+
+   if (session)
+      munmap((void*)session, session_size);
+
+   if (rename(tmp, path) != 0)
+      err(EXIT_FAILURE, "rename(%s, %s)", tmp, path);
+
+   printf("%llu\n", (unsigned long long)header.num_candidates);
+   warnx("scan %u: %llu candidates in %llu blocks, %zu bytes", header.scans, (unsigned long long)header.num_candidates, (unsigned long long)header.num_blocks, bytes);
+   free(ctx.jobs);
+   return (header.num_candidates ? EXIT_SUCCESS : EXIT_FAILURE);
+}
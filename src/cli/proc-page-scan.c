@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "mem/io.h"
+#include "mem/io-snapshot.h"
+#include "util.h"
+#include "bin.h"
+#include "parallel.h"
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr, "usage: %s pid [pages] < regions\n"
+                   "       %s -s snapshot [pages]\n"
+                   "       regions must be in /proc/<pid>/maps format\n"
+                   "       snapshot is a file written by region-rw's snapshot mode, its regions are scanned\n"
+                   "       classifies every page as zero, text, pointers, code, random (compressed or encrypted) or data\n"
+                   "       and writes a summary per region, with the mean entropy of the readable pages in bits per byte\n"
+                   "       and the percentage of their aligned words that point into the regions\n"
+                   "       pages gets runs of pages with the same class, in /proc/<pid>/maps format with the class appended\n"
+                   "       so they can be given to region-rw, such as: grep -v 'zero]$' pages\n", argv0, argv0);
+   exit(EXIT_FAILURE);
+}
+
+// Pages are read a chunk at a time over all cores, every page is classified from its byte histogram,
+// and the number of aligned words pointing into the regions.
+
+#define PAGE_SIZE 4096
+#define CHUNK_SIZE (1024 * 1024)
+
+enum class {
+   CLASS_UNREADABLE,
+   CLASS_ZERO,
+   CLASS_CODE,
+   CLASS_TEXT,
+   CLASS_POINTERS,
+   CLASS_RANDOM,
+   CLASS_DATA,
+   CLASS_LAST,
+};
+
+static const char *class_names[CLASS_LAST] = {
+   "unreadable",
+   "zero",
+   "code",
+   "text",
+   "pointers",
+   "random",
+   "data",
+};
+
+// 25% of the words are pointers, 95% of the bytes are text, 7.5 bits per byte is random
+// A page of uniformly random bytes measures a bit below 8 bits per byte, since there are only 4096 samples.
+#define POINTERS_PER_PAGE (PAGE_SIZE / 8 / 4)
+#define TEXT_PER_PAGE (PAGE_SIZE * 95 / 100)
+#define RANDOM_ENTROPY 7.5
+
+struct named_region {
+   struct region region;
+   const char *line;
+   bool readable, exec;
+};
+
+struct chunk {
+   size_t start, len, region, first_page;
+   size_t counts[CLASS_LAST];
+   size_t pointers, words; // aligned words pointing into the regions, out of all words of readable pages
+   double entropy; // sum over readable pages
+};
+
+struct context {
+   struct mem_io io;
+   struct named_region *regions;
+   size_t num_regions, allocated_regions;
+   size_t min, max;
+
+   struct chunk *chunks;
+   size_t num_chunks, allocated_chunks;
+
+   unsigned char *classes;
+   size_t num_pages;
+
+   // n * log2(n) for every count a byte can have in a page
+   float nlogn[PAGE_SIZE + 1];
+};
+
+static bool
+is_pointer(const struct context *ctx, const uint64_t value)
+{
+   if (value < ctx->min || value > ctx->max)
+      return false;
+
+   size_t lo = 0, hi = ctx->num_regions;
+   while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (ctx->regions[mid].region.end < value)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   return (lo < ctx->num_regions && ctx->regions[lo].region.start <= value);
+}
+
+static void
+histogram(const unsigned char *data, const size_t len, uint32_t counts[256])
+{
+   // four tables, so increments of repeating bytes don't wait on each other
+   uint32_t t[4][256] = {{0}};
+   size_t i = 0;
+   for (uint32_t w; i + sizeof(w) <= len; i += sizeof(w)) {
+      memcpy(&w, data + i, sizeof(w));
+      t[0][w & 0xff]++;
+      t[1][(w >> 8) & 0xff]++;
+      t[2][(w >> 16) & 0xff]++;
+      t[3][w >> 24]++;
+   }
+   for (; i < len; ++i)
+      t[0][data[i]]++;
+
+   for (size_t b = 0; b < 256; ++b)
+      counts[b] = t[0][b] + t[1][b] + t[2][b] + t[3][b];
+}
+
+static enum class
+classify(const struct context *ctx, const struct named_region *named, const unsigned char *page, const size_t len, double *out_entropy, size_t *out_pointers)
+{
+   // content decides first, executable only tells code from data for pages nothing else matched
+   *out_entropy = 0;
+   *out_pointers = 0;
+   if (bin_span(page, len, 0) == len)
+      return CLASS_ZERO;
+
+   uint32_t counts[256];
+   histogram(page, len, counts);
+
+   // H = log2(n) - sum(c * log2(c)) / n
+   float sum = 0;
+   for (size_t b = 0; b < 256; ++b)
+      sum += ctx->nlogn[counts[b]];
+   const double entropy = *out_entropy = log2(len) - sum / len;
+
+   size_t text = counts['\t'] + counts['\n'] + counts['\r'];
+   for (size_t b = 0x20; b < 0x7f; ++b)
+      text += counts[b];
+
+   size_t pointers = 0;
+   for (size_t w = 0; w + sizeof(uint64_t) <= len; w += sizeof(uint64_t)) {
+      uint64_t v;
+      memcpy(&v, page + w, sizeof(v));
+      pointers += is_pointer(ctx, v);
+   }
+   *out_pointers = pointers;
+
+   if (text >= len * TEXT_PER_PAGE / PAGE_SIZE)
+      return CLASS_TEXT;
+
+   if (pointers >= len * POINTERS_PER_PAGE / PAGE_SIZE)
+      return CLASS_POINTERS;
+
+   if (entropy >= RANDOM_ENTROPY)
+      return CLASS_RANDOM;
+
+   return (named->exec ? CLASS_CODE : CLASS_DATA);
+}
+
+static void
+scan_cb(const size_t i, void *data)
+{
+   struct context *ctx = data;
+   struct chunk *chunk = &ctx->chunks[i];
+   const struct named_region *named = &ctx->regions[chunk->region];
+
+   unsigned char *buf;
+   if (!(buf = malloc(chunk->len)))
+      err(EXIT_FAILURE, "malloc");
+
+   // a short read leaves the rest of the chunk unreadable
+   const size_t rd = (named->readable ? ctx->io.read(&ctx->io, buf, chunk->start, chunk->len) : 0);
+   for (size_t p = 0; p * PAGE_SIZE < chunk->len; ++p) {
+      const size_t at = p * PAGE_SIZE, avail = (rd > at ? rd - at : 0), page_len = (chunk->len - at > PAGE_SIZE ? PAGE_SIZE : chunk->len - at);
+
+      double entropy = 0;
+      size_t pointers = 0;
+      const enum class class = (avail < page_len ? CLASS_UNREADABLE : classify(ctx, named, buf + at, page_len, &entropy, &pointers));
+      ctx->classes[chunk->first_page + p] = class;
+      chunk->counts[class]++;
+      chunk->entropy += entropy;
+      chunk->pointers += pointers;
+      chunk->words += (class != CLASS_UNREADABLE ? page_len / sizeof(uint64_t) : 0);
+   }
+
+   free(buf);
+}
+
+static void
+region_cb(const char *line, void *data)
+{
+   struct context *ctx = data;
+
+   struct region region;
+   char perms[5] = {0};
+   if (!region_parse(&region, line) || sscanf(line, "%*s %4s", perms) != 1)
+      return;
+
+   const size_t step = 1024;
+   if (ctx->num_regions >= ctx->allocated_regions && !(ctx->regions = realloc(ctx->regions, sizeof(*ctx->regions) * (ctx->allocated_regions += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   char *dup;
+   if (!(dup = strdup(line)))
+      err(EXIT_FAILURE, "strdup");
+
+   ctx->regions[ctx->num_regions++] = (struct named_region){ .region = region, .line = dup, .readable = (perms[0] == 'r'), .exec = (perms[2] == 'x') };
+}
+
+static int
+region_cmp(const void *a, const void *b)
+{
+   const struct named_region *x = a, *y = b;
+   return (x->region.start > y->region.start) - (x->region.start < y->region.start);
+}
+
+static void
+build_chunks(struct context *ctx)
+{
+   qsort(ctx->regions, ctx->num_regions, sizeof(*ctx->regions), region_cmp);
+
+   if (ctx->num_regions > 0) {
+      ctx->min = ctx->regions[0].region.start;
+      ctx->max = ctx->regions[ctx->num_regions - 1].region.end;
+   }
+
+   // chunks never cross regions, so summaries are sums over the chunks of a region
+   for (size_t r = 0; r < ctx->num_regions; ++r) {
+      const struct region *region = &ctx->regions[r].region;
+      for (size_t start = region->start; start <= region->end; start += CHUNK_SIZE) {
+         const size_t step = 1024;
+         if (ctx->num_chunks >= ctx->allocated_chunks && !(ctx->chunks = realloc(ctx->chunks, sizeof(*ctx->chunks) * (ctx->allocated_chunks += step))))
+            err(EXIT_FAILURE, "realloc");
+
+         const size_t left = region->end - start + 1, len = (left > CHUNK_SIZE ? CHUNK_SIZE : left);
+         ctx->chunks[ctx->num_chunks++] = (struct chunk){ .start = start, .len = len, .region = r, .first_page = ctx->num_pages };
+         ctx->num_pages += (len + PAGE_SIZE - 1) / PAGE_SIZE;
+      }
+   }
+
+   if (!(ctx->classes = malloc(ctx->num_pages + 1)))
+      err(EXIT_FAILURE, "malloc");
+}
+
+static void
+write_run(FILE *out, const struct named_region *named, const size_t start, const size_t end, const enum class class)
+{
+   // start-end perms offset dev inode path
+   const char *line = named->line;
+   int perms = 0, devino = 0, devino_end = 0, path = 0;
+   sscanf(line, "%*s %n%*s %*s %n%*s %*s%n %n", &perms, &devino, &devino_end, &path);
+   const char *name = (path > 0 ? line + path : "");
+   const size_t file_offset = (name[0] == '/' ? named->region.offset + (start - named->region.start) : named->region.offset);
+   fprintf(out, "%zx-%zx %.4s %08zx %.*s %s%s[%s]\n", start, end, line + perms, file_offset, (devino_end > devino ? devino_end - devino : 0), line + devino, name, (*name ? " " : ""), class_names[class]);
+}
+
+static void
+write_pages(const struct context *ctx, FILE *out)
+{
+   for (size_t c = 0; c < ctx->num_chunks;) {
+      const size_t r = ctx->chunks[c].region;
+      const struct region *region = &ctx->regions[r].region;
+      const size_t first = ctx->chunks[c].first_page;
+      for (; c < ctx->num_chunks && ctx->chunks[c].region == r; ++c);
+      const size_t last = (c < ctx->num_chunks ? ctx->chunks[c].first_page : ctx->num_pages);
+
+      for (size_t p = first, run = first; p < last; p = run) {
+         for (; run < last && ctx->classes[run] == ctx->classes[p]; ++run);
+         const size_t start = region->start + (p - first) * PAGE_SIZE, end = region->start + (run - first) * PAGE_SIZE;
+         write_run(out, &ctx->regions[r], start, (end > region->end ? region->end + 1 : end), ctx->classes[p]);
+      }
+   }
+}
+
+static void
+write_summary(const struct context *ctx)
+{
+   size_t totals[CLASS_LAST] = {0}, total_pointers = 0, total_words = 0;
+
+   // ptr% is the percentage of aligned words of readable pages that point into the regions
+   printf("%10s %10s %10s %10s %10s %10s %10s %7s %8s region\n", "unreadable", "zero", "code", "text", "pointers", "random", "data", "entropy", "ptr%");
+   for (size_t c = 0; c < ctx->num_chunks;) {
+      const size_t r = ctx->chunks[c].region;
+      size_t counts[CLASS_LAST] = {0}, pointers = 0, words = 0;
+      double entropy = 0;
+      for (; c < ctx->num_chunks && ctx->chunks[c].region == r; ++c) {
+         for (size_t k = 0; k < CLASS_LAST; ++k)
+            counts[k] += ctx->chunks[c].counts[k];
+         entropy += ctx->chunks[c].entropy;
+         pointers += ctx->chunks[c].pointers;
+         words += ctx->chunks[c].words;
+      }
+
+      size_t readable = 0;
+      for (size_t k = 0; k < CLASS_LAST; ++k) {
+         totals[k] += counts[k];
+         readable += counts[k] * (k != CLASS_UNREADABLE);
+      }
+
+      total_pointers += pointers;
+      total_words += words;
+
+      for (size_t k = 0; k < CLASS_LAST; ++k)
+         printf("%10zu ", counts[k]);
+      printf("%7.2f %7.2f%% %s\n", (readable ? entropy / readable : 0), (words ? pointers * 100.0 / words : 0), ctx->regions[r].line);
+   }
+
+   for (size_t k = 0; k < CLASS_LAST; ++k)
+      printf("%10zu ", totals[k]);
+   printf("%7s %7.2f%% total pages\n", "", (total_words ? total_pointers * 100.0 / total_words : 0));
+}
+
+int
+proc_page_scan(int argc, const char *argv[], bool (*mem_io_init)(struct mem_io*, const pid_t))
+{
+   const char *argv0 = argv[0];
+   const bool is_snapshot = (argc > 1 && !strcmp(argv[1], "-s"));
+   argv += is_snapshot; argc -= is_snapshot;
+
+   if (argc < 2)
+      usage(argv0);
+
+   char *invalid;
+   const pid_t pid = (is_snapshot ? 0 : strtoull(argv[1], &invalid, 10));
+   if (!is_snapshot && *invalid != 0)
+      usage(argv0);
+
+   struct context *ctx;
+   if (!(ctx = calloc(1, sizeof(*ctx))))
+      err(EXIT_FAILURE, "calloc");
+
+   for (size_t n = 1; n <= PAGE_SIZE; ++n)
+      ctx->nlogn[n] = n * log2(n);
+
+   if (is_snapshot) {
+      if (!mem_io_snapshot_init(&ctx->io, argv[1]))
+         return EXIT_FAILURE;
+
+      for_each_token_in_str(mem_io_snapshot_maps(&ctx->io), '\n', region_cb, ctx);
+      build_chunks(ctx);
+   } else {
+      for_each_token_in_file(stdin, '\n', region_cb, ctx);
+      build_chunks(ctx);
+
+      if (!mem_io_init(&ctx->io, pid))
+         return EXIT_FAILURE;
+   }
+
+   parallel_for(ctx->num_chunks, scan_cb, ctx);
+   mem_io_release(&ctx->io);
+
+   write_summary(ctx);
+
+   if (argc > 2) {
+      FILE *out;
+      if (!(out = fopen(argv[2], "wb")))
+         err(EXIT_FAILURE, "fopen(%s)", argv[2]);
+
+      write_pages(ctx, out);
+
+      if (fclose(out) != 0)
+         err(EXIT_FAILURE, "fclose(%s)", argv[2]);
+   }
+
+   for (size_t i = 0; i < ctx->num_regions; ++i)
+      free((char*)ctx->regions[i].line);
+
+   free(ctx->classes);
+   free(ctx->chunks);
+   free(ctx->regions);
+   free(ctx);
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include "mem/io.h"
+#include "mem/maps.h"
+#include "util.h"
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr, "usage: %s pid < regions\n"
+                   "       regions must be in /proc/<pid>/maps format\n"
+                   "       finds PE images (such as ones loaded by wine) in regions from the headers in memory\n"
+                   "       and replaces their regions with a region per section, with exact file offsets\n", argv0);
+   exit(EXIT_FAILURE);
+}
+
+// PE images are mapped by section, the section table tells where each section is in the file.
+// Only the headers are read, every region start is checked for a DOS header in a single batch.
+
+#define MAX_HEADERS (64 * 1024)
+
+// section characteristics
+#define SCN_CNT_UNINITIALIZED_DATA 0x00000080
+#define SCN_MEM_EXECUTE 0x20000000
+#define SCN_MEM_READ 0x40000000
+#define SCN_MEM_WRITE 0x80000000
+
+struct input {
+   char *line;
+   struct mem_region region;
+   unsigned char dos[64];
+};
+
+struct output {
+   size_t start, end;
+   char *line;
+};
+
+struct context {
+   struct mem_io io;
+   struct input *inputs;
+   size_t num_inputs, allocated_inputs;
+   struct output *outputs;
+   size_t num_outputs, allocated_outputs;
+   unsigned char *headers;
+};
+
+static uint16_t
+u16(const unsigned char *p)
+{
+   return p[0] | p[1] << 8;
+}
+
+static uint32_t
+u32(const unsigned char *p)
+{
+   return u16(p) | (uint32_t)u16(p + 2) << 16;
+}
+
+static void
+region_cb(const char *line, void *data)
+{
+   struct context *ctx = data;
+
+   struct mem_region region;
+   if (!mem_region_parse(&region, line))
+      return;
+
+   const size_t step = 1024;
+   if (ctx->num_inputs >= ctx->allocated_inputs &&
+       !(ctx->inputs = realloc(ctx->inputs, sizeof(*ctx->inputs) * (ctx->allocated_inputs += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   char *dup;
+   if (!(dup = strdup(line)))
+      err(EXIT_FAILURE, "strdup");
+
+   region.path = dup + (region.path - line);
+   ctx->inputs[ctx->num_inputs++] = (struct input){ .line = dup, .region = region };
+}
+
+static void
+push_output(struct context *ctx, const size_t start, const size_t end, const char *fmt, ...)
+{
+   const size_t step = 256;
+   if (ctx->num_outputs >= ctx->allocated_outputs &&
+       !(ctx->outputs = realloc(ctx->outputs, sizeof(*ctx->outputs) * (ctx->allocated_outputs += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   char *line = NULL;
+   if (fmt) {
+      va_list ap;
+      va_start(ap, fmt);
+      if (vasprintf(&line, fmt, ap) < 0)
+         err(EXIT_FAILURE, "vasprintf");
+      va_end(ap);
+   }
+
+   ctx->outputs[ctx->num_outputs++] = (struct output){ .start = start, .end = end, .line = line };
+}
+
+static void
+line_devino(const char *line, const char **devino, int *devino_len)
+{
+   // start-end perms offset dev inode path
+   int dev = 0, path = 0;
+   sscanf(line, "%*s %*s %*s %n%*s %*s %n", &dev, &path);
+   *devino = line + dev;
+   *devino_len = (path > dev ? path - dev : 0);
+}
+
+static size_t
+align_up(const size_t v, const size_t a)
+{
+   return (a ? (v + a - 1) / a * a : v);
+}
+
+static bool
+map_image(struct context *ctx, const struct input *input)
+{
+   const size_t base = input->region.start;
+   const uint32_t lfanew = u32(input->dos + 0x3c);
+   if (lfanew < 64 || lfanew > MAX_HEADERS - 24)
+      return false;
+
+   // first page, then the rest of the headers once SizeOfHeaders is known
+   const size_t first = ctx->io.read(&ctx->io, ctx->headers, base, 4096);
+   if (first < lfanew + 24 + 64 || memcmp(ctx->headers + lfanew, "PE\0\0", 4))
+      return false;
+
+   const unsigned char *coff = ctx->headers + lfanew + 4, *opt = coff + 20;
+   const uint16_t num_sections = u16(coff + 2), opt_size = u16(coff + 16), magic = u16(opt);
+   if ((magic != 0x10b && magic != 0x20b) || opt_size < 64)
+      return false;
+
+   const uint32_t section_alignment = u32(opt + 32), size_of_image = u32(opt + 56), size_of_headers = u32(opt + 60);
+   const size_t table = lfanew + 24 + opt_size, table_end = table + (size_t)num_sections * 40;
+   if (table_end > MAX_HEADERS || size_of_headers > size_of_image)
+      return false;
+
+   if (table_end > first && ctx->io.read(&ctx->io, ctx->headers + first, base + first, table_end - first) != table_end - first)
+      return false;
+
+   const char *devino;
+   int devino_len;
+   line_devino(input->line, &devino, &devino_len);
+   const char *path = input->region.path;
+
+   // anonymous images are named by their export name if they have one
+   char name[256] = {0};
+   if (!*path) {
+      const size_t dirs = (magic == 0x10b ? 96 : 112);
+      const uint32_t export_rva = (opt_size >= dirs + 8 && u32(opt + 92 + (magic == 0x20b) * 16) > 0 ? u32(opt + dirs) : 0);
+      unsigned char dir[16];
+      if (export_rva && ctx->io.read(&ctx->io, dir, base + export_rva, sizeof(dir)) == sizeof(dir) && u32(dir + 12))
+         ctx->io.read(&ctx->io, name, base + u32(dir + 12), sizeof(name) - 1);
+      size_t c = 0;
+      for (; c + 1 < sizeof(name) && name[c] >= 0x20 && name[c] < 0x7f; ++c);
+      name[c] = 0;
+      path = (*name ? name : "[pe]");
+   }
+
+   const size_t headers_end = base + align_up(size_of_headers, section_alignment);
+   push_output(ctx, base, headers_end, "%zx-%zx r--p %08x %.*s%s", base, headers_end, 0, devino_len, devino, path);
+
+   for (uint16_t i = 0; i < num_sections; ++i) {
+      const unsigned char *s = ctx->headers + table + i * 40;
+      const uint32_t virtual_size = u32(s + 8), va = u32(s + 12), raw_size = u32(s + 16), raw_offset = u32(s + 20), flags = u32(s + 36);
+      const size_t size = align_up((virtual_size ? virtual_size : raw_size), section_alignment);
+      const size_t file_size = (flags & SCN_CNT_UNINITIALIZED_DATA || !raw_offset ? 0 : (raw_size < size ? raw_size : size));
+      const char perms[5] = { (flags & SCN_MEM_READ ? 'r' : '-'), (flags & SCN_MEM_WRITE ? 'w' : '-'), (flags & SCN_MEM_EXECUTE ? 'x' : '-'), 'p', 0 };
+
+      if (!size || va + size > align_up(size_of_image, section_alignment))
+         continue;
+
+      // the part past the raw data is zero filled, not backed by the file
+      if (file_size > 0)
+         push_output(ctx, base + va, base + va + file_size, "%zx-%zx %s %08x %.*s%s", base + va, base + va + file_size, perms, raw_offset, devino_len, devino, path);
+
+      if (file_size < size)
+         push_output(ctx, base + va + file_size, base + va + size, "%zx-%zx %s %08x 00:00 0", base + va + file_size, base + va + size, perms, 0);
+   }
+
+   // covers the whole image, so regions of it in the input are dropped
+   push_output(ctx, base, base + align_up(size_of_image, section_alignment), NULL);
+   return true;
+}
+
+static void
+push_piece(struct context *ctx, const struct input *input, const size_t start, const size_t end)
+{
+   const struct mem_region *region = &input->region;
+   if (start == region->start && end == region->end + 1) {
+      push_output(ctx, start, end, "%s", input->line);
+      return;
+   }
+
+   const char *devino;
+   int devino_len;
+   line_devino(input->line, &devino, &devino_len);
+   const size_t offset = (region->path[0] == '/' ? region->offset + (start - region->start) : region->offset);
+   push_output(ctx, start, end, "%zx-%zx %s %08zx %.*s%s", start, end, region->perms, offset, devino_len, devino, region->path);
+}
+
+static void
+pass_through(struct context *ctx, const struct input *input, const size_t num_generated)
+{
+   // parts of the region outside of the sorted image ranges pass through, anonymous regions may have merged with an image
+   size_t start = input->region.start;
+   const size_t end = input->region.end + 1;
+   for (size_t o = 0; o < num_generated && start < end; ++o) {
+      const size_t image_start = ctx->outputs[o].start, image_end = ctx->outputs[o].end;
+      if (ctx->outputs[o].line || image_end <= start || image_start >= end)
+         continue;
+
+      if (image_start > start)
+         push_piece(ctx, input, start, image_start);
+
+      start = image_end;
+   }
+
+   if (start < end)
+      push_piece(ctx, input, start, end);
+}
+
+static int
+output_cmp(const void *a, const void *b)
+{
+   const struct output *x = a, *y = b;
+   return (x->start > y->start) - (x->start < y->start);
+}
+
+int
+proc_pe_map(int argc, const char *argv[], bool (*mem_io_init)(struct mem_io*, const pid_t))
+{
+   if (argc < 2)
+      usage(argv[0]);
+
+   const pid_t pid = strtoull(argv[1], NULL, 10);
+
+   struct context ctx = {0};
+   for_each_token_in_file(stdin, '\n', region_cb, &ctx);
+
+   if (!mem_io_init(&ctx.io, pid))
+      return EXIT_FAILURE;
+
+   if (!(ctx.headers = malloc(MAX_HEADERS)))
+      err(EXIT_FAILURE, "malloc");
+
+   struct mem_io_batch *batch;
+   if (!(batch = calloc(ctx.num_inputs + 1, sizeof(*batch))))
+      err(EXIT_FAILURE, "calloc");
+
+   // images never start at unreadable or special regions
+   size_t num_batch = 0;
+   for (size_t i = 0; i < ctx.num_inputs; ++i) {
+      const struct mem_region *region = &ctx.inputs[i].region;
+      if (region->perms[0] != 'r' || region->path[0] == '[' || region->end - region->start + 1 < sizeof(ctx.inputs[i].dos))
+         continue;
+
+      batch[num_batch++] = (struct mem_io_batch){ .ptr = ctx.inputs[i].dos, .offset = region->start, .size = sizeof(ctx.inputs[i].dos) };
+   }
+
+   mem_io_read_batch(&ctx.io, batch, num_batch);
+
+   size_t images = 0;
+   for (size_t i = 0; i < ctx.num_inputs; ++i) {
+      if (ctx.inputs[i].dos[0] == 'M' && ctx.inputs[i].dos[1] == 'Z')
+         images += map_image(&ctx, &ctx.inputs[i]);
+   }
+
+   // image ranges are the outputs without a line
+   qsort(ctx.outputs, ctx.num_outputs, sizeof(*ctx.outputs), output_cmp);
+   const size_t num_generated = ctx.num_outputs;
+   for (size_t i = 0; i < ctx.num_inputs; ++i)
+      pass_through(&ctx, &ctx.inputs[i], num_generated);
+
+   qsort(ctx.outputs, ctx.num_outputs, sizeof(*ctx.outputs), output_cmp);
+
+   for (size_t i = 0; i < ctx.num_outputs; ++i) {
+      if (ctx.outputs[i].line)
+         printf("%s\n", ctx.outputs[i].line);
+   }
+
+   warnx("resolved %zu images", images);
+
+   for (size_t i = 0; i < ctx.num_inputs; ++i)
+      free(ctx.inputs[i].line);
+   for (size_t i = 0; i < ctx.num_outputs; ++i)
+      free(ctx.outputs[i].line);
+
+   free(batch);
+   free(ctx.headers);
+   free(ctx.inputs);
+   free(ctx.outputs);
+   mem_io_release(&ctx.io);
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "mem/io.h"
+#include "mem/io-snapshot.h"
+#include "util.h"
+#include "parallel.h"
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr, "usage: %s pid target output [depth] [max-offset] [max-results] < regions\n"
+                   "       %s -s snapshot target output [depth] [max-offset] [max-results]\n"
+                   "       regions must be in /proc/<pid>/maps format\n"
+                   "       snapshot is a file written by region-rw's snapshot mode or freeze-snapshot, its regions are indexed\n"
+                   "       finds pointer paths from file backed regions to target address on 64-bit targets\n"
+                   "       each path is written as module+offset followed by offsets, starting from module+offset\n"
+                   "       the address is replaced by the pointer stored there plus the next offset, last one lands on target\n", argv0, argv0);
+   exit(EXIT_FAILURE);
+}
+
+#define CHUNK_SIZE (1024 * 1024)
+
+struct named_region {
+   struct region region;
+   const char *module;
+   size_t base;
+};
+
+struct pointer {
+   uint64_t value, address;
+};
+
+struct pointers {
+   struct pointer *data;
+   size_t len;
+};
+
+struct chunk {
+   size_t start, len;
+};
+
+struct node {
+   uint64_t address, offset;
+   size_t parent;
+};
+
+struct nodes {
+   struct node *data;
+   size_t len, allocated;
+};
+
+struct context {
+   struct mem_io io;
+   struct named_region *regions;
+   size_t num_regions, allocated_regions;
+   size_t min, max;
+
+   struct chunk *chunks;
+   size_t num_chunks, allocated_chunks;
+
+   struct pointers *sorted;
+   struct pointers index;
+
+   struct nodes graph, *found;
+   size_t level_start, level_end, max_offset;
+};
+
+static const struct named_region*
+region_for_address(const struct context *ctx, const size_t address)
+{
+   if (address < ctx->min || address > ctx->max)
+      return NULL;
+
+   size_t lo = 0, hi = ctx->num_regions;
+   while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (ctx->regions[mid].region.end < address)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   return (lo < ctx->num_regions && ctx->regions[lo].region.start <= address ? &ctx->regions[lo] : NULL);
+}
+
+static int
+pointer_cmp(const void *a, const void *b)
+{
+   const struct pointer *x = a, *y = b;
+   return (x->value > y->value) - (x->value < y->value);
+}
+
+static void
+index_cb(const size_t i, void *data)
+{
+   struct context *ctx = data;
+   const struct chunk *chunk = &ctx->chunks[i];
+   struct pointers *out = &ctx->sorted[i];
+
+   uint64_t *words;
+   if (!(words = malloc(chunk->len)))
+      err(EXIT_FAILURE, "malloc");
+
+   const size_t num_words = ctx->io.read(&ctx->io, words, chunk->start, chunk->len) / sizeof(*words);
+
+   size_t n = 0;
+   for (size_t w = 0; w < num_words; ++w)
+      n += (region_for_address(ctx, words[w]) != NULL);
+
+   *out = (struct pointers){0};
+   if (n > 0 && !(out->data = malloc(sizeof(*out->data) * n)))
+      err(EXIT_FAILURE, "malloc");
+
+   for (size_t w = 0; w < num_words; ++w) {
+      if (region_for_address(ctx, words[w]))
+         out->data[out->len++] = (struct pointer){ .value = words[w], .address = chunk->start + w * sizeof(*words) };
+   }
+
+   free(words);
+   qsort(out->data, out->len, sizeof(*out->data), pointer_cmp);
+}
+
+static void
+merge_cb(const size_t i, void *data)
+{
+   struct pointers *lists = data, *a = &lists[i * 2], *b = &lists[i * 2 + 1];
+
+   struct pointers merged = { .len = a->len + b->len };
+   if (merged.len > 0 && !(merged.data = malloc(sizeof(*merged.data) * merged.len)))
+      err(EXIT_FAILURE, "malloc");
+
+   for (size_t x = 0, y = 0, o = 0; o < merged.len; ++o)
+      merged.data[o] = (y >= b->len || (x < a->len && a->data[x].value <= b->data[y].value) ? a->data[x++] : b->data[y++]);
+
+   free(a->data);
+   free(b->data);
+   *a = merged;
+   *b = (struct pointers){0};
+}
+
+static void
+build_index(struct context *ctx)
+{
+   if (!(ctx->sorted = calloc(ctx->num_chunks + 1, sizeof(*ctx->sorted))))
+      err(EXIT_FAILURE, "calloc");
+
+   parallel_for(ctx->num_chunks, index_cb, ctx);
+
+   // sorted chunks are merged pairwise, every round is parallel
+   for (size_t n = ctx->num_chunks; n > 1; n = (n + 1) / 2) {
+      parallel_for(n / 2, merge_cb, ctx->sorted);
+      for (size_t i = 1; i < (n + 1) / 2; ++i)
+         ctx->sorted[i] = ctx->sorted[i * 2];
+      for (size_t i = (n + 1) / 2; i < n; ++i)
+         ctx->sorted[i] = (struct pointers){0};
+   }
+
+   ctx->index = ctx->sorted[0];
+   free(ctx->sorted);
+   ctx->sorted = NULL;
+}
+
+static void
+push_node(struct nodes *nodes, const struct node *node)
+{
+   const size_t step = (nodes->allocated > 64 ? nodes->allocated : 64);
+   if (nodes->len >= nodes->allocated && !(nodes->data = realloc(nodes->data, sizeof(*nodes->data) * (nodes->allocated += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   nodes->data[nodes->len++] = *node;
+}
+
+static void
+search_cb(const size_t i, void *data)
+{
+   struct context *ctx = data;
+   const size_t parent = ctx->level_start + i;
+   const uint64_t target = ctx->graph.data[parent].address;
+   const uint64_t low = (target > ctx->max_offset ? target - ctx->max_offset : 0);
+
+   // every pointer with value in [target - max_offset, target] reaches target with a small offset
+   size_t lo = 0, hi = ctx->index.len;
+   while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (ctx->index.data[mid].value < low)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   struct nodes *found = &ctx->found[i];
+   *found = (struct nodes){0};
+   for (; lo < ctx->index.len && ctx->index.data[lo].value <= target; ++lo)
+      push_node(found, &(struct node){ .address = ctx->index.data[lo].address, .offset = target - ctx->index.data[lo].value, .parent = parent });
+}
+
+static void
+print_path(const struct context *ctx, FILE *out, const struct named_region *image, const struct node *node)
+{
+   fprintf(out, "%s+0x%zx", image->module, (size_t)node->address - image->base);
+   for (; node->parent != (size_t)~0; node = &ctx->graph.data[node->parent])
+      fprintf(out, " 0x%zx", (size_t)node->offset);
+   fputc('\n', out);
+}
+
+static int
+address_cmp(const void *a, const void *b)
+{
+   const uint64_t *x = a, *y = b;
+   return (*x > *y) - (*x < *y);
+}
+
+static int
+node_cmp(const void *a, const void *b)
+{
+   const struct node *x = a, *y = b;
+   return (x->address > y->address) - (x->address < y->address);
+}
+
+static size_t
+search(struct context *ctx, FILE *out, const size_t depth, const size_t max_results)
+{
+   uint64_t *visited;
+   size_t num_visited = 0, results = 0;
+   if (!(visited = malloc(sizeof(*visited) * (ctx->level_end - ctx->level_start))))
+      err(EXIT_FAILURE, "malloc");
+
+   for (size_t i = ctx->level_start; i < ctx->level_end; ++i)
+      visited[num_visited++] = ctx->graph.data[i].address;
+
+   qsort(visited, num_visited, sizeof(*visited), address_cmp);
+
+   for (size_t level = 0; level < depth && ctx->level_start < ctx->level_end && results < max_results; ++level) {
+      const size_t n = ctx->level_end - ctx->level_start;
+      if (!(ctx->found = calloc(n, sizeof(*ctx->found))))
+         err(EXIT_FAILURE, "calloc");
+
+      parallel_for(n, search_cb, ctx);
+
+      // file backed pointers end the path, others are searched again on the next level
+      const size_t next_start = ctx->graph.len;
+      for (size_t i = 0; i < n; ++i) {
+         for (size_t f = 0; f < ctx->found[i].len; ++f) {
+            const struct node *node = &ctx->found[i].data[f];
+            const struct named_region *named = region_for_address(ctx, node->address);
+            if (named && named->module) {
+               if (results++ < max_results)
+                  print_path(ctx, out, named, node);
+            } else {
+               push_node(&ctx->graph, node);
+            }
+         }
+         free(ctx->found[i].data);
+      }
+
+      free(ctx->found);
+      ctx->found = NULL;
+
+      // same address can be reached from many parents and levels, only one is kept
+      struct node *next = ctx->graph.data + next_start;
+      const size_t num_next = ctx->graph.len - next_start;
+      qsort(next, num_next, sizeof(*next), node_cmp);
+
+      if (!(visited = realloc(visited, sizeof(*visited) * (num_visited + num_next + 1))))
+         err(EXIT_FAILURE, "realloc");
+
+      size_t kept = 0;
+      for (size_t i = 0; i < num_next; ++i) {
+         if ((kept > 0 && next[kept - 1].address == next[i].address) ||
+             bsearch(&next[i].address, visited, num_visited, sizeof(*visited), address_cmp))
+            continue;
+         next[kept++] = next[i];
+      }
+
+      for (size_t i = 0; i < kept; ++i)
+         visited[num_visited + i] = next[i].address;
+
+      num_visited += kept;
+      qsort(visited, num_visited, sizeof(*visited), address_cmp);
+      kept += next_start;
+
+      ctx->graph.len = kept;
+      ctx->level_start = next_start;
+      ctx->level_end = kept;
+      warnx("depth %zu: %zu paths, %zu pointers to follow", level + 1, results, kept - next_start);
+   }
+
+   free(visited);
+   return results;
+}
+
+static void
+region_cb(const char *line, void *data)
+{
+   struct context *ctx = data;
+
+   struct region region;
+   char perms[5] = {0};
+   int path = 0;
+   if (!region_parse(&region, line) || sscanf(line, "%*s %4s %*s %*s %*s %n", perms, &path) != 1 || perms[0] != 'r')
+      return;
+
+   const size_t step = 1024;
+   if (ctx->num_regions >= ctx->allocated_regions && !(ctx->regions = realloc(ctx->regions, sizeof(*ctx->regions) * (ctx->allocated_regions += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   struct named_region *named = &ctx->regions[ctx->num_regions++];
+   *named = (struct named_region){ .region = region, .base = region.start };
+
+   // only mappings of real files give offsets that stay the same across restarts
+   const char *name = line + path;
+   if (path > 0 && name[0] == '/' && strncmp(name, "/dev/", 5) && strncmp(name, "/memfd:", 7)) {
+      if (!(named->module = strdup(name)))
+         err(EXIT_FAILURE, "strdup");
+   }
+
+   for (size_t start = region.start; start <= region.end; start += CHUNK_SIZE) {
+      if (ctx->num_chunks >= ctx->allocated_chunks && !(ctx->chunks = realloc(ctx->chunks, sizeof(*ctx->chunks) * (ctx->allocated_chunks += step))))
+         err(EXIT_FAILURE, "realloc");
+
+      const size_t left = region.end - start + 1;
+      ctx->chunks[ctx->num_chunks++] = (struct chunk){ .start = start, .len = (left > CHUNK_SIZE ? CHUNK_SIZE : left) };
+   }
+}
+
+static int
+region_cmp(const void *a, const void *b)
+{
+   const struct named_region *x = a, *y = b;
+   return (x->region.start > y->region.start) - (x->region.start < y->region.start);
+}
+
+static void
+resolve_modules(struct context *ctx)
+{
+   qsort(ctx->regions, ctx->num_regions, sizeof(*ctx->regions), region_cmp);
+
+   if (ctx->num_regions > 0) {
+      ctx->min = ctx->regions[0].region.start;
+      ctx->max = ctx->regions[ctx->num_regions - 1].region.end;
+   }
+
+   // module offsets are relative to the lowest mapping of the same file
+   for (size_t i = 0; i < ctx->num_regions; ++i) {
+      struct named_region *named = &ctx->regions[i];
+      for (size_t j = 0; named->module && j < i; ++j) {
+         if (ctx->regions[j].module && !strcmp(ctx->regions[j].module, named->module)) {
+            named->base = ctx->regions[j].base;
+            break;
+         }
+      }
+   }
+
+   for (size_t i = 0; i < ctx->num_regions; ++i) {
+      const char *slash;
+      if (ctx->regions[i].module && (slash = strrchr(ctx->regions[i].module, '/')))
+         memmove((char*)ctx->regions[i].module, slash + 1, strlen(slash + 1) + 1);
+   }
+}
+
+int
+proc_pointer_scan(int argc, const char *argv[], bool (*mem_io_init)(struct mem_io*, const pid_t))
+{
+   const char *argv0 = argv[0];
+   const bool is_snapshot = (argc > 1 && !strcmp(argv[1], "-s"));
+   argv += is_snapshot; argc -= is_snapshot;
+
+   if (argc < 4)
+      usage(argv0);
+
+   char *invalid;
+   const pid_t pid = (is_snapshot ? 0 : strtoull(argv[1], &invalid, 10));
+   if (!is_snapshot && *invalid != 0)
+      usage(argv0);
+
+   const uint64_t target = hexdecstrtoull(argv[2], NULL);
+   const size_t depth = (argc > 4 ? hexdecstrtoull(argv[4], NULL) : 5);
+   const size_t max_results = (argc > 6 ? hexdecstrtoull(argv[6], NULL) : (size_t)~0);
+
+   struct context ctx = {0};
+   ctx.max_offset = (argc > 5 ? hexdecstrtoull(argv[5], NULL) : 0x1000);
+
+   // ptrace stops the target while the index is built and uio doesn't, a snapshot is a single moment for either
+   if (is_snapshot) {
+      if (!mem_io_snapshot_init(&ctx.io, argv[1]))
+         return EXIT_FAILURE;
+
+      for_each_token_in_str(mem_io_snapshot_maps(&ctx.io), '\n', region_cb, &ctx);
+      resolve_modules(&ctx);
+   } else {
+      for_each_token_in_file(stdin, '\n', region_cb, &ctx);
+      resolve_modules(&ctx);
+
+      if (!mem_io_init(&ctx.io, pid))
+         return EXIT_FAILURE;
+   }
+
+   build_index(&ctx);
+   mem_io_release(&ctx.io);
+   warnx("%zu pointers in %zu regions", ctx.index.len, ctx.num_regions);
+
+   FILE *out;
+   if (!(out = fopen(argv[3], "wb")))
+      err(EXIT_FAILURE, "fopen(%s)", argv[3]);
+
+   push_node(&ctx.graph, &(struct node){ .address = target, .parent = (size_t)~0 });
+   ctx.level_end = ctx.graph.len;
+   const size_t results = search(&ctx, out, depth, max_results);
+
+   if (fclose(out) != 0)
+      err(EXIT_FAILURE, "fclose(%s)", argv[3]);
+
+   for (size_t i = 0; i < ctx.num_regions; ++i)
+      free((char*)ctx.regions[i].module);
+
+   free(ctx.graph.data);
+   free(ctx.index.data);
+   free(ctx.chunks);
+   free(ctx.regions);
+   return (results ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -3,7 +3,10 @@
 #include <string.h>
 #include "mem/io.h"
 #include "mem/io-stream.h"
+#include "mem/io-snapshot.h"
 #include "util.h"
+#include "manifest.h"
+#include "hex.h"
 
 static void
 usage(const char *argv0)
@@ -11,7 +14,13 @@ usage(const char *argv0)
    fprintf(stderr, "usage: %s pid map regions data [offset] [len]\n"
                    "       %s pid write regions data [offset] [len]\n"
                    "       %s pid read regions [offset] [len]\n"
-                   "       regions must be in /proc/<pid>/maps format", argv0, argv0, argv0);
+                   "       %s pid hexdump regions [offset] [len]\n"
+                   "       %s pid snapshot regions output [offset] [len]\n"
+                   "       %s pid manifest regions output [offset] [len]\n"
+                   "       regions must be in /proc/<pid>/maps format\n"
+                   "       snapshot writes a compressed random-access snapshot, that memview can open\n"
+                   "       manifest writes a hash of every page, that memdiff can compare\n"
+                   "       hexdump reads like read, but as xxd compatible hex with the region addresses", argv0, argv0, argv0, argv0, argv0, argv0);
    exit(EXIT_FAILURE);
 }
 
@@ -23,13 +32,17 @@ struct context {
       enum {
          MODE_MAP,
          MODE_WRITE,
-         MODE_READ
+         MODE_READ,
+         MODE_SNAPSHOT,
+         MODE_MANIFEST,
+         MODE_HEXDUMP
       } mode;
    } op;
 
    struct mem_io io;
-   FILE *regions, *data;
-   size_t data_len, trw;
+   struct mem_snapshot_writer snapshot;
+   FILE *regions, *data, *manifest;
+   size_t data_len, trw, manifest_regions;
 };
 
 static inline void
@@ -39,18 +52,24 @@ context_init(struct context *ctx, size_t argc, const char *argv[])
    *ctx = (struct context){0};
 
    {
-      bool m = false, w = false, r = false;
+      bool m = false, w = false, r = false, s = false, h = false, x = false;
       const char *mode = argv[arg++];
-      if (!(m = !strcmp(mode, "map")) && !(w = !strcmp(mode, "write")) && !(r = !strcmp(mode, "read")))
-         errx(EXIT_FAILURE, "mode must be map, write or read");
+      if (!(m = !strcmp(mode, "map")) && !(w = !strcmp(mode, "write")) && !(r = !strcmp(mode, "read")) && !(s = !strcmp(mode, "snapshot")) && !(h = !strcmp(mode, "manifest")) && !(x = !strcmp(mode, "hexdump")))
+         errx(EXIT_FAILURE, "mode must be map, write, read, snapshot, manifest or hexdump");
 
-      ctx->op.mode = (m ? MODE_MAP : (w ? MODE_WRITE : MODE_READ));
+      ctx->op.mode = (m ? MODE_MAP : (w ? MODE_WRITE : (r ? MODE_READ : (s ? MODE_SNAPSHOT : (h ? MODE_MANIFEST : MODE_HEXDUMP)))));
    }
 
-   const char *regions_fname = argv[arg++], *data_fname = NULL;
+   const char *regions_fname = argv[arg++], *data_fname = NULL, *snapshot_fname = NULL;
 
-   if (ctx->op.mode != MODE_READ && argc >= arg + 1)
+   if (ctx->op.mode == MODE_SNAPSHOT || ctx->op.mode == MODE_MANIFEST) {
+      if (argc < arg + 1)
+         errx(EXIT_FAILURE, "%s needs an output file", (ctx->op.mode == MODE_SNAPSHOT ? "snapshot" : "manifest"));
+
+      snapshot_fname = argv[arg++];
+   } else if (ctx->op.mode != MODE_READ && ctx->op.mode != MODE_HEXDUMP && argc >= arg + 1) {
       data_fname = argv[arg++];
+   }
 
    if (argc >= arg + 1) {
       ctx->op.offset = hexdecstrtoull(argv[arg++], NULL);
@@ -74,6 +93,13 @@ context_init(struct context *ctx, size_t argc, const char *argv[])
 
       ctx->data_len = ftell(ctx->data);
    }
+
+   if (ctx->op.mode == MODE_SNAPSHOT && !mem_snapshot_writer_init(&ctx->snapshot, snapshot_fname))
+      exit(EXIT_FAILURE);
+
+   // header is written again once the number of regions is known
+   if (ctx->op.mode == MODE_MANIFEST && (!(ctx->manifest = fopen(snapshot_fname, "wb")) || !manifest_write_header(ctx->manifest, 0)))
+      err(EXIT_FAILURE, "fopen(%s)", snapshot_fname);
 }
 
 static void
@@ -83,9 +109,17 @@ context_release(struct context *ctx)
       fclose(ctx->regions);
    if (ctx->data)
       fclose(ctx->data);
+   if (ctx->manifest)
+      fclose(ctx->manifest);
    *ctx = (struct context){0};
 }
 
+static size_t
+hexdump_stream_write(const struct mem_io_ostream *stream, const void *ptr, const size_t size)
+{
+   return hexdump_write(stream->backing, ptr, size);
+}
+
 static void
 region_cb(const char *line, void *data)
 {
@@ -104,10 +138,13 @@ region_cb(const char *line, void *data)
       return;
    }
 
+   // snapshots and manifests keep the whole region, so the address space can be rebuilt exactly
+   const bool whole = (ctx->op.mode == MODE_SNAPSHOT || ctx->op.mode == MODE_MANIFEST);
+   const size_t region_len = region.end - region.start + whole;
    // requested write/read
-   const size_t rlen = (ctx->op.has_len ? ctx->op.len : (ctx->op.mode == MODE_READ ? region.end - region.start : ctx->data_len));
+   const size_t rlen = (ctx->op.has_len ? ctx->op.len : (ctx->op.mode == MODE_READ || ctx->op.mode == MODE_HEXDUMP || whole ? region_len : ctx->data_len));
    // actual write/read
-   const size_t len = (rlen > region.end - region.start ? region.end - region.start : rlen);
+   const size_t len = (rlen > region_len ? region_len : rlen);
 
    if (!len)
       return;
@@ -133,6 +170,21 @@ region_cb(const char *line, void *data)
             warnx("mapped %zu bytes from offset 0x%zx to offset 0x%zx", wd, region.offset, region.start);
          }
       }
+   } else if (ctx->op.mode == MODE_SNAPSHOT) {
+      ctx->trw += mem_snapshot_writer_add_region(&ctx->snapshot, &ctx->io, line, region.start, len);
+   } else if (ctx->op.mode == MODE_MANIFEST) {
+      if (!manifest_write_region(ctx->manifest, &ctx->io, region.start, len))
+         err(EXIT_FAILURE, "fwrite");
+
+      ctx->manifest_regions++;
+      ctx->trw += len;
+   } else if (ctx->op.mode == MODE_HEXDUMP) {
+      struct hexdump dump = hexdump_init(stdout, region.start);
+      const struct mem_io_ostream stream = { .write = hexdump_stream_write, .backing = &dump };
+      ctx->trw += mem_io_read_to_stream(&ctx->io, &stream, region.start, len);
+
+      if (!hexdump_finish(&dump))
+         err(EXIT_FAILURE, "fwrite");
    } else {
       struct mem_io_ostream stream = mem_io_ostream_from_file(stdout);
       ctx->trw += mem_io_read_to_stream(&ctx->io, &stream, region.start, len);
@@ -154,6 +206,15 @@ proc_region_rw(int argc, const char *argv[], bool (*mem_io_init)(struct mem_io*,
        return EXIT_FAILURE;
 
    for_each_token_in_file(ctx.regions, '\n', region_cb, &ctx);
+
+   if (ctx.op.mode == MODE_SNAPSHOT && !mem_snapshot_writer_finish(&ctx.snapshot))
+      ctx.trw = 0;
+
+   if (ctx.op.mode == MODE_MANIFEST && (!manifest_write_header(ctx.manifest, ctx.manifest_regions) || fflush(ctx.manifest) != 0)) {
+      warn("fwrite");
+      ctx.trw = 0;
+   }
+
    const size_t trw = ctx.trw;
 
    mem_io_release(&ctx.io);
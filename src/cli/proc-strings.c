@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "mem/io.h"
+#include "util.h"
+#include "parallel.h"
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr, "usage: %s pid [min-len] [unique] < regions\n"
+                   "       regions must be in /proc/<pid>/maps format\n"
+                   "       finds runs of at least min-len (default 4) printable ascii characters, in ascii and utf-16le\n"
+                   "       every string is written as: address ascii|utf16 string\n"
+                   "       unique writes only the first occurrence of every string\n", argv0);
+   exit(EXIT_FAILURE);
+}
+
+// Chunks are classified in parallel into bitmaps of printable and zero bytes, strings are runs in the bitmaps.
+// Strings that touch a chunk edge are kept whatever their length, and joined with the next chunk when written.
+
+#define CHUNK_SIZE (1024 * 1024)
+#define BATCH_CHUNKS 256
+
+enum encoding {
+   ENCODING_ASCII,
+   ENCODING_UTF16,
+   ENCODING_LAST,
+};
+
+static const char *encoding_names[ENCODING_LAST] = {
+   "ascii",
+   "utf16",
+};
+
+struct string {
+   size_t address, end; // end is the address after the last byte
+   size_t text, len; // text is an offset to text of the chunk
+   enum encoding encoding;
+   bool open; // continues in the next chunk
+};
+
+struct chunk {
+   size_t start, len, region;
+   bool first, last; // in region
+   struct string *strings;
+   size_t num_strings, allocated_strings;
+   char *text;
+   size_t text_len, allocated_text;
+};
+
+struct pending {
+   struct string string;
+   char *text;
+   size_t allocated;
+   bool active;
+};
+
+struct context {
+   struct mem_io io;
+   struct region *regions;
+   size_t num_regions, allocated_regions;
+
+   struct chunk *chunks;
+   size_t num_chunks, allocated_chunks, batch;
+
+   struct pending pending[ENCODING_LAST];
+   size_t min_len, found;
+
+   // hashes of written strings when unique, 0 is an empty slot
+   struct {
+      uint64_t *hashes;
+      size_t size, count;
+      bool enabled;
+   } unique;
+};
+
+static void
+classify(const unsigned char *data, const size_t len, uint64_t *printable, uint64_t *zero)
+{
+   // bit i is set for byte i, len is a multiple of 64
+   // printable is the same as for strings(1), 0x20-0x7e and tab
+#ifdef __SSE2__
+   for (size_t i = 0; i < len; i += 64) {
+      uint64_t p = 0, z = 0;
+      for (size_t o = 0; o < 64; o += 16) {
+         const __m128i v = _mm_loadu_si128((const __m128i*)(data + i + o));
+         const __m128i ascii = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+         p |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(ascii, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')))) << o;
+         z |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) << o;
+      }
+      printable[i / 64] = p;
+      zero[i / 64] = z;
+   }
+#else
+   for (size_t i = 0; i < len; i += 64) {
+      uint64_t p = 0, z = 0;
+      for (size_t o = 0; o < 64; ++o) {
+         p |= (uint64_t)((data[i + o] >= 0x20 && data[i + o] < 0x7f) || data[i + o] == '\t') << o;
+         z |= (uint64_t)(data[i + o] == 0) << o;
+      }
+      printable[i / 64] = p;
+      zero[i / 64] = z;
+   }
+#endif
+}
+
+static size_t
+next_bit(const uint64_t *bits, const size_t n, size_t i, const bool set)
+{
+   // index of the first bit from i that is set (or clear), n if there is none
+   while (i < n) {
+      const uint64_t w = (bits[i / 64] ^ (set ? 0 : ~(uint64_t)0)) & (~(uint64_t)0 << (i % 64));
+      if (w) {
+         const size_t r = (i & ~(size_t)63) + __builtin_ctzll(w);
+         return (r < n ? r : n);
+      }
+      i = (i & ~(size_t)63) + 64;
+   }
+   return n;
+}
+
+static size_t
+run_start(const uint64_t *bits, size_t i)
+{
+   // start of the run of set bits that i is in
+   for (;;) {
+      const uint64_t w = ~bits[i / 64] & (~(uint64_t)0 >> (63 - i % 64));
+      if (w)
+         return (i & ~(size_t)63) + 64 - __builtin_clzll(w);
+      if (i < 64)
+         return 0;
+      i = (i & ~(size_t)63) - 1;
+   }
+}
+
+static void
+and_shifted(uint64_t *bits, const size_t words, const size_t k)
+{
+   // bit i keeps set only if bit i + k is set too
+   const size_t q = k / 64, r = k % 64;
+   for (size_t w = 0; w < words; ++w) {
+      if (!bits[w])
+         continue;
+
+      const uint64_t lo = (w + q < words ? bits[w + q] : 0), hi = (w + q + 1 < words ? bits[w + q + 1] : 0);
+      bits[w] &= (lo >> r) | (r ? hi << (64 - r) : 0);
+   }
+}
+
+static void
+push_string(struct chunk *chunk, const unsigned char *data, const size_t start, const size_t end, const enum encoding encoding)
+{
+   // [start, end) in bytes of the chunk, utf-16 strings have their characters every other byte
+   const size_t stride = (encoding == ENCODING_UTF16 ? 2 : 1), len = (end - start) / stride;
+
+   const size_t step = 1024;
+   if (chunk->num_strings >= chunk->allocated_strings &&
+       !(chunk->strings = realloc(chunk->strings, sizeof(*chunk->strings) * (chunk->allocated_strings += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   if (chunk->text_len + len > chunk->allocated_text &&
+       !(chunk->text = realloc(chunk->text, (chunk->allocated_text = (chunk->text_len + len) * 2))))
+      err(EXIT_FAILURE, "realloc");
+
+   for (size_t i = 0; i < len; ++i)
+      chunk->text[chunk->text_len + i] = data[start + i * stride];
+
+   chunk->strings[chunk->num_strings++] = (struct string){
+      .address = chunk->start + start, .end = chunk->start + end,
+      .text = chunk->text_len, .len = len, .encoding = encoding, .open = (end >= chunk->len && !chunk->last)
+   };
+   chunk->text_len += len;
+}
+
+static void
+push_runs(struct chunk *chunk, const unsigned char *data, const uint64_t *bits, uint64_t *scratch, const size_t words, const size_t n, const size_t min_bits, const enum encoding encoding)
+{
+   // runs of at least min_bits in the first n bits, found from the bits where such a run starts
+   // the starts are the bits followed by min_bits - 1 set bits, doubling the length every step
+   // up to 64 bits a word and the next one are enough, so it's done a word at a time in one pass
+   if (min_bits <= 64) {
+      for (size_t w = 0; w < words; ++w) {
+         uint64_t lo = bits[w], hi = (w + 1 < words ? bits[w + 1] : 0);
+         for (size_t have = 1; lo && have < min_bits;) {
+            const size_t k = (min_bits - have > have ? have : min_bits - have);
+            lo &= (lo >> k) | (hi << (64 - k));
+            hi &= hi >> k;
+            have += k;
+         }
+         scratch[w] = lo;
+      }
+   } else {
+      memcpy(scratch, bits, sizeof(*bits) * words);
+      for (size_t have = 1; have < min_bits;) {
+         const size_t k = (min_bits - have > have ? have : min_bits - have);
+         and_shifted(scratch, words, k);
+         have += k;
+      }
+   }
+
+   for (size_t s = next_bit(scratch, n, 0, true), e; s < n; s = next_bit(scratch, n, e, true))
+      push_string(chunk, data, s, (e = next_bit(bits, n, s, false)), encoding);
+
+   // shorter runs at the edges are kept too, they may continue in the neighbouring chunks
+   const size_t stride = (encoding == ENCODING_UTF16 ? 2 : 1);
+   size_t s = next_bit(bits, n, 0, true), e = (s < n ? next_bit(bits, n, s, false) : n);
+   const bool at_start = (!chunk->first && s < stride && e - s < min_bits);
+   if (at_start)
+      push_string(chunk, data, s, e, encoding);
+
+   if (chunk->last || n < chunk->len || !(bits[(chunk->len - 1) / 64] >> ((chunk->len - 1) % 64) & 1))
+      return;
+
+   s = run_start(bits, chunk->len - 1);
+   e = next_bit(bits, n, chunk->len - 1, false);
+   if (e - s < min_bits && !(at_start && s < stride))
+      push_string(chunk, data, s, e, encoding);
+}
+
+static int
+string_cmp(const void *a, const void *b)
+{
+   const struct string *x = a, *y = b;
+   return (x->address > y->address) - (x->address < y->address);
+}
+
+static void
+scan_cb(const size_t i, void *data)
+{
+   struct context *ctx = data;
+   struct chunk *chunk = &ctx->chunks[ctx->batch + i];
+
+   // one byte past the chunk is read for the last utf-16 character, the rest is padding that is neither printable nor zero
+   const size_t words = chunk->len / 64 + 2;
+   unsigned char *buf;
+   uint64_t *bits;
+   if (!(buf = malloc(words * 64)) || !(bits = malloc(sizeof(*bits) * words * 5)))
+      err(EXIT_FAILURE, "malloc");
+
+   const size_t rd = ctx->io.read(&ctx->io, buf, chunk->start, chunk->len + !chunk->last);
+   memset(buf + rd, 1, words * 64 - rd);
+
+   uint64_t *printable = bits, *zero = bits + words, *even = bits + words * 2, *odd = bits + words * 3, *scratch = bits + words * 4;
+   classify(buf, words * 64, printable, zero);
+
+   // a short read ends the strings where readable memory ends
+   const size_t n = (rd < chunk->len ? rd : chunk->len);
+   push_runs(chunk, buf, printable, scratch, words, n, ctx->min_len, ENCODING_ASCII);
+
+   // printable byte followed by zero is a utf-16 character, characters of a string are on the same parity
+   // every character is widened to both of its bits, so strings become contiguous runs
+   uint64_t carry = 0;
+   for (size_t w = 0; w + 1 < words; ++w) {
+      uint64_t u = printable[w] & ((zero[w] >> 1) | (zero[w + 1] << 63));
+      if (w * 64 + 64 > n)
+         u &= (w * 64 >= n ? 0 : ~(uint64_t)0 >> (64 - (n - w * 64)));
+
+      const uint64_t ue = u & 0x5555555555555555ull, uo = u & 0xaaaaaaaaaaaaaaaaull;
+      even[w] = ue | (ue << 1);
+      odd[w] = uo | (uo << 1) | carry;
+      carry = uo >> 63;
+   }
+   even[words - 1] = 0;
+   odd[words - 1] = carry;
+
+   push_runs(chunk, buf, even, scratch, words, n + 1, ctx->min_len * 2, ENCODING_UTF16);
+   push_runs(chunk, buf, odd, scratch, words, n + 1, ctx->min_len * 2, ENCODING_UTF16);
+
+   qsort(chunk->strings, chunk->num_strings, sizeof(*chunk->strings), string_cmp);
+   free(bits);
+   free(buf);
+}
+
+static uint64_t
+hash_string(const char *text, const size_t len)
+{
+   // fnv-1a
+   uint64_t h = 0xcbf29ce484222325ull;
+   for (size_t i = 0; i < len; ++i)
+      h = (h ^ (unsigned char)text[i]) * 0x100000001b3ull;
+   return (h ? h : 1);
+}
+
+static bool
+unique_insert(struct context *ctx, const uint64_t hash)
+{
+   // open addressing, grown at half full, false if the hash was there already
+   if (ctx->unique.count * 2 >= ctx->unique.size) {
+      const size_t size = (ctx->unique.size ? ctx->unique.size * 2 : 4096);
+      uint64_t *hashes;
+      if (!(hashes = calloc(size, sizeof(*hashes))))
+         err(EXIT_FAILURE, "calloc");
+
+      for (size_t i = 0; i < ctx->unique.size; ++i) {
+         if (!ctx->unique.hashes[i])
+            continue;
+
+         size_t slot = ctx->unique.hashes[i] & (size - 1);
+         for (; hashes[slot]; slot = (slot + 1) & (size - 1));
+         hashes[slot] = ctx->unique.hashes[i];
+      }
+
+      free(ctx->unique.hashes);
+      ctx->unique.hashes = hashes;
+      ctx->unique.size = size;
+   }
+
+   size_t slot = hash & (ctx->unique.size - 1);
+   for (; ctx->unique.hashes[slot]; slot = (slot + 1) & (ctx->unique.size - 1)) {
+      if (ctx->unique.hashes[slot] == hash)
+         return false;
+   }
+
+   ctx->unique.hashes[slot] = hash;
+   ctx->unique.count++;
+   return true;
+}
+
+static void
+write_string(struct context *ctx, const struct string *string, const char *text)
+{
+   if (string->len < ctx->min_len || (ctx->unique.enabled && !unique_insert(ctx, hash_string(text, string->len))))
+      return;
+
+   printf("%zx %s %.*s\n", string->address, encoding_names[string->encoding], (int)string->len, text);
+   ctx->found++;
+}
+
+static void
+flush_pending(struct context *ctx, struct pending *pending)
+{
+   if (!pending->active)
+      return;
+
+   write_string(ctx, &pending->string, pending->text);
+   pending->active = false;
+}
+
+static void
+append_pending(struct pending *pending, const struct string *string, const char *text, const bool join)
+{
+   const size_t at = (join ? pending->string.len : 0);
+   if (at + string->len > pending->allocated && !(pending->text = realloc(pending->text, (pending->allocated = (at + string->len) * 2))))
+      err(EXIT_FAILURE, "realloc");
+
+   memcpy(pending->text + at, text, string->len);
+
+   if (join) {
+      pending->string.end = string->end;
+      pending->string.len += string->len;
+   } else {
+      pending->string = *string;
+      pending->active = true;
+   }
+}
+
+static void
+write_chunk(struct context *ctx, struct chunk *chunk)
+{
+   for (size_t i = 0; i < chunk->num_strings; ++i) {
+      const struct string *string = &chunk->strings[i];
+      const char *text = chunk->text + string->text;
+      struct pending *pending = &ctx->pending[string->encoding];
+      const bool join = (pending->active && pending->string.end == string->address);
+
+      if (!join)
+         flush_pending(ctx, pending);
+
+      if (join || string->open) {
+         append_pending(pending, string, text, join);
+      } else {
+         write_string(ctx, string, text);
+      }
+
+      if (!string->open)
+         flush_pending(ctx, pending);
+   }
+
+   // nothing continues past the end of a region
+   for (size_t e = 0; chunk->last && e < ENCODING_LAST; ++e)
+      flush_pending(ctx, &ctx->pending[e]);
+
+   free(chunk->strings);
+   free(chunk->text);
+   chunk->strings = NULL;
+   chunk->text = NULL;
+}
+
+static void
+region_cb(const char *line, void *data)
+{
+   struct context *ctx = data;
+
+   struct region region;
+   char perms[5] = {0};
+   if (!region_parse(&region, line) || sscanf(line, "%*s %4s", perms) != 1 || perms[0] != 'r')
+      return;
+
+   const size_t step = 1024;
+   if (ctx->num_regions >= ctx->allocated_regions && !(ctx->regions = realloc(ctx->regions, sizeof(*ctx->regions) * (ctx->allocated_regions += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   ctx->regions[ctx->num_regions++] = region;
+
+   for (size_t start = region.start; start <= region.end; start += CHUNK_SIZE) {
+      if (ctx->num_chunks >= ctx->allocated_chunks && !(ctx->chunks = realloc(ctx->chunks, sizeof(*ctx->chunks) * (ctx->allocated_chunks += step))))
+         err(EXIT_FAILURE, "realloc");
+
+      const size_t left = region.end - start + 1;
+      ctx->chunks[ctx->num_chunks++] = (struct chunk){
+         .start = start, .len = (left > CHUNK_SIZE ? CHUNK_SIZE : left), .region = ctx->num_regions - 1,
+         .first = (start == region.start), .last = (left <= CHUNK_SIZE)
+      };
+   }
+}
+
+int
+proc_strings(int argc, const char *argv[], bool (*mem_io_init)(struct mem_io*, const pid_t))
+{
+   if (argc < 2)
+      usage(argv[0]);
+
+   const pid_t pid = strtoull(argv[1], NULL, 10);
+
+   struct context ctx = {0};
+   ctx.min_len = (argc > 2 ? hexdecstrtoull(argv[2], NULL) : 4);
+   ctx.min_len = (ctx.min_len ? ctx.min_len : 1);
+
+   if (argc > 3 && !(ctx.unique.enabled = !strcmp(argv[3], "unique")))
+      usage(argv[0]);
+
+   for_each_token_in_file(stdin, '\n', region_cb, &ctx);
+
+   if (!mem_io_init(&ctx.io, pid))
+      return EXIT_FAILURE;
+
+   // batches keep the strings held in memory small, and are written in address order
+   for (ctx.batch = 0; ctx.batch < ctx.num_chunks; ctx.batch += BATCH_CHUNKS) {
+      const size_t n = (ctx.num_chunks - ctx.batch > BATCH_CHUNKS ? BATCH_CHUNKS : ctx.num_chunks - ctx.batch);
+      parallel_for(n, scan_cb, &ctx);
+
+      for (size_t i = 0; i < n; ++i)
+         write_chunk(&ctx, &ctx.chunks[ctx.batch + i]);
+   }
+
+   mem_io_release(&ctx.io);
+
+   if (fflush(stdout) != 0)
+      err(EXIT_FAILURE, "fflush");
+
+   warnx("%zu strings in %zu regions", ctx.found, ctx.num_regions);
+
+   for (size_t e = 0; e < ENCODING_LAST; ++e)
+      free(ctx.pending[e].text);
+
+   free(ctx.unique.hashes);
+   free(ctx.chunks);
+   free(ctx.regions);
+   return (ctx.found ? EXIT_SUCCESS : EXIT_FAILURE);
+}
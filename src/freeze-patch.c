@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "mem/io.h"
+#include "mem/freeze.h"
+#include "util.h"
+
+// Atomic patch set
+// Every thread of the process is stopped once, all patch sites are verified before anything is written,
+// written, and verified again. Any failure after the first write restores every site to its old bytes,
+// so the process never runs with a half-applied patch set.
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr, "usage: %s [-r] pid < patchset\n"
+                   "       patchset has a patch per line: address old-bytes new-bytes\n"
+                   "       bytes are hex, old and new must be the same length, # starts a comment\n"
+                   "       -r reverts the patch set, new bytes are verified and old bytes written\n", argv0);
+   exit(EXIT_FAILURE);
+}
+
+struct patch {
+   size_t address, size;
+   unsigned char *old, *new, *current;
+   size_t line;
+};
+
+static struct {
+   struct patch *patches;
+   size_t num_patches, allocated_patches, line;
+   bool failed;
+} ctx;
+
+static size_t
+parse_hex(const char *str, unsigned char **out)
+{
+   const size_t len = strlen(str);
+   if (!len || len % 2)
+      return 0;
+
+   if (!(*out = malloc(len / 2)))
+      err(EXIT_FAILURE, "malloc");
+
+   for (size_t i = 0; i < len / 2; ++i) {
+      if (!isxdigit((unsigned char)str[i * 2]) || !isxdigit((unsigned char)str[i * 2 + 1]) || sscanf(str + i * 2, "%2hhx", &(*out)[i]) != 1)
+         return 0;
+   }
+
+   return len / 2;
+}
+
+static void
+patch_cb(const char *line, void *data)
+{
+   (void)data;
+   ++ctx.line;
+
+   char address[32], old[4096], new[4096];
+   const int n = sscanf(line, " %31s %4095s %4095s", address, old, new);
+   if (n <= 0 || address[0] == '#')
+      return;
+
+   const size_t step = 64;
+   if (ctx.num_patches >= ctx.allocated_patches &&
+       !(ctx.patches = realloc(ctx.patches, sizeof(*ctx.patches) * (ctx.allocated_patches += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   struct patch *patch = &ctx.patches[ctx.num_patches++];
+   *patch = (struct patch){ .address = hexdecstrtoull(address, NULL), .line = ctx.line };
+
+   size_t old_len, new_len;
+   if (n < 3 || !(old_len = parse_hex(old, &patch->old)) || !(new_len = parse_hex(new, &patch->new)) || old_len != new_len) {
+      warnx("line %zu: expected address and old and new bytes of the same length", ctx.line);
+      ctx.failed = true;
+      return;
+   }
+
+   patch->size = old_len;
+   if (!(patch->current = malloc(patch->size)))
+      err(EXIT_FAILURE, "malloc");
+}
+
+static int
+patch_cmp(const void *a, const void *b)
+{
+   const struct patch *x = a, *y = b;
+   return (x->address > y->address) - (x->address < y->address);
+}
+
+static size_t
+read_sites(const struct mem_io *io, struct mem_io_batch *batch)
+{
+   for (size_t i = 0; i < ctx.num_patches; ++i)
+      batch[i] = (struct mem_io_batch){ .ptr = ctx.patches[i].current, .offset = ctx.patches[i].address, .size = ctx.patches[i].size };
+   return mem_io_read_batch(io, batch, ctx.num_patches);
+}
+
+static size_t
+write_sites(const struct mem_io *io, struct mem_io_batch *batch, const bool new)
+{
+   for (size_t i = 0; i < ctx.num_patches; ++i)
+      batch[i] = (struct mem_io_batch){ .ptr = (new ? ctx.patches[i].new : ctx.patches[i].old), .offset = ctx.patches[i].address, .size = ctx.patches[i].size };
+   return mem_io_write_batch(io, batch, ctx.num_patches);
+}
+
+static size_t
+count_mismatches(struct mem_io_batch *batch, const bool new, const bool report)
+{
+   size_t mismatches = 0;
+   for (size_t i = 0; i < ctx.num_patches; ++i) {
+      const struct patch *patch = &ctx.patches[i];
+      if (batch[i].done == patch->size && !memcmp(patch->current, (new ? patch->new : patch->old), patch->size))
+         continue;
+
+      if (report)
+         warnx("line %zu: 0x%zx doesn't have the %s bytes", patch->line, patch->address, (new ? "new" : "old"));
+
+      ++mismatches;
+   }
+   return mismatches;
+}
+
+static bool
+apply(const struct mem_io *io, struct mem_io_batch *batch)
+{
+   read_sites(io, batch);
+   if (!count_mismatches(batch, true, false)) {
+      warnx("patch set is already applied");
+      return true;
+   }
+
+   if (count_mismatches(batch, false, true)) {
+      warnx("verify failed, nothing was written");
+      return false;
+   }
+
+   write_sites(io, batch, true);
+   read_sites(io, batch);
+   if (!count_mismatches(batch, true, true)) {
+      warnx("applied %zu patches", ctx.num_patches);
+      return true;
+   }
+
+   // sites that were never written still have the old bytes, so writing old everywhere is safe
+   write_sites(io, batch, false);
+   read_sites(io, batch);
+   if (count_mismatches(batch, false, true)) {
+      warnx("rollback failed, the process is left with a partially applied patch set");
+   } else {
+      warnx("verify after write failed, rolled back");
+   }
+
+   return false;
+}
+
+static void
+quit(void)
+{
+   for (size_t i = 0; i < ctx.num_patches; ++i) {
+      free(ctx.patches[i].old);
+      free(ctx.patches[i].new);
+      free(ctx.patches[i].current);
+   }
+   free(ctx.patches);
+}
+
+int
+main(int argc, const char *argv[])
+{
+   bool revert = false;
+   int arg = 1;
+   if (argc > arg && !strcmp(argv[arg], "-r")) {
+      revert = true;
+      ++arg;
+   }
+
+   if (argc <= arg)
+      usage(argv[0]);
+
+   const pid_t pid = strtoull(argv[arg], NULL, 10);
+   atexit(quit);
+
+   for_each_token_in_file(stdin, '\n', patch_cb, NULL);
+
+   if (ctx.failed)
+      return EXIT_FAILURE;
+
+   if (!ctx.num_patches)
+      errx(EXIT_FAILURE, "patch set is empty");
+
+   // overlapping sites would make verification meaningless, as the later write wins
+   qsort(ctx.patches, ctx.num_patches, sizeof(*ctx.patches), patch_cmp);
+   for (size_t i = 1; i < ctx.num_patches; ++i) {
+      if (ctx.patches[i - 1].address + ctx.patches[i - 1].size > ctx.patches[i].address)
+         errx(EXIT_FAILURE, "line %zu: overlaps with line %zu", ctx.patches[i].line, ctx.patches[i - 1].line);
+   }
+
+   if (revert) {
+      for (size_t i = 0; i < ctx.num_patches; ++i) {
+         unsigned char *tmp = ctx.patches[i].old;
+         ctx.patches[i].old = ctx.patches[i].new;
+         ctx.patches[i].new = tmp;
+      }
+   }
+
+   struct mem_io_batch *batch;
+   if (!(batch = calloc(ctx.num_patches, sizeof(*batch))))
+      err(EXIT_FAILURE, "calloc");
+
+   // /proc/<pid>/mem, as unlike uio it can write to read-only mappings such as code
+   struct mem_io io;
+   if (!mem_io_proc_mem_init(&io, pid))
+      return EXIT_FAILURE;
+
+   struct mem_freeze freeze;
+   if (!mem_freeze(&freeze, pid))
+      return EXIT_FAILURE;
+
+   const size_t tasks = freeze.num_tasks;
+   const bool ok = apply(&io, batch);
+   const uint64_t paused = mem_thaw(&freeze);
+   warnx("paused %zu tasks for %.3f ms", tasks, paused / 1e6);
+
+   mem_io_release(&io);
+   free(batch);
+   return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "mem/io.h"
+#include "mem/io-snapshot.h"
+#include "mem/freeze.h"
+#include "mem/maps.h"
+#include "util.h"
+#include "parallel.h"
+
+// Consistent snapshot of a multi-threaded process
+// Every task of the thread group is stopped only for as long as it takes to copy the regions,
+// the copy is done with uio from all cores, and compression happens after the process already runs again.
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr, "usage: %s pid output < regions\n"
+                   "       regions must be in /proc/<pid>/maps format\n"
+                   "       stops every thread of pid, copies the regions to memory, resumes and writes a snapshot memview can open\n"
+                   "       needs as much free memory as the regions take\n", argv0);
+   exit(EXIT_FAILURE);
+}
+
+#define CHUNK_SIZE (1024 * 1024)
+
+struct copy {
+   struct mem_region region;
+   unsigned char *data; // NULL for regions that aren't readable
+   char *line;
+   size_t first_chunk;
+};
+
+struct chunk {
+   size_t copy, offset, len, done;
+};
+
+static struct {
+   struct mem_io io, copied;
+   struct copy *copies;
+   size_t num_copies, allocated_copies;
+   struct chunk *chunks;
+   size_t num_chunks, allocated_chunks;
+} ctx;
+
+static void
+region_cb(const char *line, void *data)
+{
+   (void)data;
+
+   struct mem_region region;
+   if (!mem_region_parse(&region, line)) {
+      warnx("failed to parse mapping:\n%s", line);
+      return;
+   }
+
+   const size_t step = 1024;
+   if (ctx.num_copies >= ctx.allocated_copies &&
+       !(ctx.copies = realloc(ctx.copies, sizeof(*ctx.copies) * (ctx.allocated_copies += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   char *dup;
+   if (!(dup = strdup(line)))
+      err(EXIT_FAILURE, "strdup");
+
+   ctx.copies[ctx.num_copies] = (struct copy){ .region = region, .line = dup };
+   ctx.copies[ctx.num_copies++].region.path = NULL;
+}
+
+static int
+copy_cmp(const void *a, const void *b)
+{
+   const struct copy *x = a, *y = b;
+   return (x->region.start > y->region.start) - (x->region.start < y->region.start);
+}
+
+static void
+prepare_copies(void)
+{
+   // copied_read looks regions up with a binary search, and the snapshot is written in the same order
+   qsort(ctx.copies, ctx.num_copies, sizeof(*ctx.copies), copy_cmp);
+
+   for (size_t i = 0; i < ctx.num_copies; ++i) {
+      struct copy *copy = &ctx.copies[i];
+      copy->first_chunk = ctx.num_chunks;
+
+      // unreadable regions are still stored as holes, but failing reads aren't worth spending the pause on
+      if (copy->region.perms[0] != 'r')
+         continue;
+
+      // populated up front, so the pause isn't spent on page faults
+      const size_t size = copy->region.end - copy->region.start + 1;
+      void *data;
+      if ((data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0)) == MAP_FAILED)
+         err(EXIT_FAILURE, "mmap(%zu)", size);
+
+      copy->data = data;
+
+      const size_t step = 1024;
+      for (size_t off = 0; off < size; off += CHUNK_SIZE) {
+         if (ctx.num_chunks >= ctx.allocated_chunks &&
+             !(ctx.chunks = realloc(ctx.chunks, sizeof(*ctx.chunks) * (ctx.allocated_chunks += step))))
+            err(EXIT_FAILURE, "realloc");
+
+         ctx.chunks[ctx.num_chunks++] = (struct chunk){ .copy = i, .offset = off, .len = (size - off > CHUNK_SIZE ? CHUNK_SIZE : size - off) };
+      }
+   }
+}
+
+static void
+copy_chunk(const size_t i, void *data)
+{
+   (void)data;
+   struct chunk *chunk = &ctx.chunks[i];
+   const struct copy *copy = &ctx.copies[chunk->copy];
+   chunk->done = ctx.io.read(&ctx.io, copy->data + chunk->offset, copy->region.start + chunk->offset, chunk->len);
+}
+
+static size_t
+copied_read(const struct mem_io *io, void *ptr, const size_t offset, const size_t size)
+{
+   (void)io;
+
+   // copies are sorted by prepare_copies
+   size_t lo = 0, hi = ctx.num_copies;
+   while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (ctx.copies[mid].region.end < offset) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   if (lo >= ctx.num_copies || ctx.copies[lo].region.start > offset || !ctx.copies[lo].data)
+      return 0;
+
+   // copy up to the first hole, that is where a chunk came up short
+   const struct copy *copy = &ctx.copies[lo];
+   size_t done = 0;
+   while (done < size && offset + done <= copy->region.end) {
+      const size_t off = offset + done - copy->region.start;
+      const struct chunk *chunk = &ctx.chunks[copy->first_chunk + off / CHUNK_SIZE];
+      if (off >= chunk->offset + chunk->done)
+         break;
+
+      const size_t avail = chunk->offset + chunk->done - off, len = (avail > size - done ? size - done : avail);
+      memcpy((unsigned char*)ptr + done, copy->data + off, len);
+      done += len;
+   }
+
+   return done;
+}
+
+static void
+quit(void)
+{
+   for (size_t i = 0; i < ctx.num_copies; ++i) {
+      if (ctx.copies[i].data)
+         munmap(ctx.copies[i].data, ctx.copies[i].region.end - ctx.copies[i].region.start + 1);
+      free(ctx.copies[i].line);
+   }
+
+   mem_io_release(&ctx.io);
+   free(ctx.copies);
+   free(ctx.chunks);
+}
+
+int
+main(int argc, const char *argv[])
+{
+   if (argc < 3)
+      usage(argv[0]);
+
+   const pid_t pid = strtoull(argv[1], NULL, 10);
+   atexit(quit);
+
+   for_each_token_in_file(stdin, '\n', region_cb, NULL);
+   prepare_copies();
+
+   if (!mem_io_uio_init(&ctx.io, pid))
+      return EXIT_FAILURE;
+
+   struct mem_freeze freeze;
+   if (!mem_freeze(&freeze, pid))
+      return EXIT_FAILURE;
+
+   const size_t tasks = freeze.num_tasks;
+   parallel_for(ctx.num_chunks, copy_chunk, NULL);
+   const uint64_t paused = mem_thaw(&freeze);
+
+   size_t copied = 0;
+   for (size_t i = 0; i < ctx.num_chunks; ++i)
+      copied += ctx.chunks[i].done;
+
+   warnx("paused %zu tasks for %.3f ms, copied %zu bytes", tasks, paused / 1e6, copied);
+
+   struct mem_snapshot_writer writer;
+   if (!mem_snapshot_writer_init(&writer, argv[2]))
+      return EXIT_FAILURE;
+
+   ctx.copied = (struct mem_io){ .read = copied_read, .pid = pid };
+   for (size_t i = 0; i < ctx.num_copies; ++i) {
+      const struct mem_region *region = &ctx.copies[i].region;
+      mem_snapshot_writer_add_region(&writer, &ctx.copied, ctx.copies[i].line, region->start, region->end - region->start + 1);
+   }
+
+   return (mem_snapshot_writer_finish(&writer) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+// Hex and printable ascii encoding of whole rows, shared by memview and the hexdump modes
+// Both the vector and the scalar path produce lowercase hex, and '.' for anything outside 0x20-0x7e.
+
+#ifdef __SSE2__
+static inline __m128i
+hex_digits(const __m128i nibbles)
+{
+   const __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+   return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+static inline void
+hex_encode16(char *dst, const __m128i v)
+{
+   const __m128i mask = _mm_set1_epi8(0x0f);
+   const __m128i hi = hex_digits(_mm_and_si128(_mm_srli_epi16(v, 4), mask)), lo = hex_digits(_mm_and_si128(v, mask));
+   _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi8(hi, lo));
+   _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+}
+#endif
+
+static inline void
+hex_encode(char *dst, const unsigned char *src, const size_t len)
+{
+   // dst gets 2 * len chars, not nul terminated
+   static const char digits[] = "0123456789abcdef";
+   size_t i = 0;
+#ifdef __SSE2__
+   for (; i + 16 <= len; i += 16)
+      hex_encode16(dst + i * 2, _mm_loadu_si128((const __m128i*)(src + i)));
+#endif
+   for (; i < len; ++i) {
+      dst[i * 2] = digits[src[i] >> 4];
+      dst[i * 2 + 1] = digits[src[i] & 0x0f];
+   }
+}
+
+static inline void
+hex_ascii(char *dst, const unsigned char *src, const size_t len)
+{
+   // dst gets len chars, not nul terminated
+   size_t i = 0;
+#ifdef __SSE2__
+   // bytes from 0x80 are negative as signed, so they fail the lower bound
+   for (; i + 16 <= len; i += 16) {
+      const __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+      const __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(printable, v), _mm_andnot_si128(printable, _mm_set1_epi8('.'))));
+   }
+#endif
+   for (; i < len; ++i)
+      dst[i] = (src[i] >= 0x20 && src[i] < 0x7f ? src[i] : '.');
+}
+
+// xxd compatible rows, so dumps can be turned back into bytes with xxd -r
+// 0000000000000000: 0001 0203 0405 0607 0809 0a0b 0c0d 0e0f  ................
+
+#define HEXDUMP_ROW 16
+#define HEXDUMP_LINE (16 + 2 + HEXDUMP_ROW / 2 * 5 - 1 + 2 + HEXDUMP_ROW + 1)
+
+static inline size_t
+hexdump_row(char *dst, const uint64_t address, const unsigned char *src, const size_t len)
+{
+   // len is at most HEXDUMP_ROW, returns the length of the line written to dst
+   char hex[HEXDUMP_ROW * 2];
+#ifdef __SSE2__
+   // byte swap of the address in the low half, words reversed then the bytes within the words swapped
+   char addr[32];
+   const __m128i words = _mm_shufflelo_epi16(_mm_set_epi32(0, 0, address >> 32, (uint32_t)address), _MM_SHUFFLE(0, 1, 2, 3));
+   hex_encode16(addr, _mm_or_si128(_mm_slli_epi16(words, 8), _mm_srli_epi16(words, 8)));
+   memcpy(dst, addr, 16);
+   if (len == HEXDUMP_ROW) {
+      hex_encode16(hex, _mm_loadu_si128((const __m128i*)src));
+   } else {
+      hex_encode(hex, src, len);
+   }
+#else
+   unsigned char be[8];
+   for (size_t i = 0; i < sizeof(be); ++i)
+      be[i] = address >> (56 - i * 8);
+   hex_encode(dst, be, sizeof(be));
+   hex_encode(hex, src, len);
+#endif
+
+   char *p = dst + 16;
+   *p++ = ':';
+   if (len == HEXDUMP_ROW) {
+      // constant sized copies written out, so full rows are plain stores
+      for (size_t g = 0; g < HEXDUMP_ROW * 2; g += 16, p += 20) {
+         memcpy(p + 0, " ", 1); memcpy(p + 1, hex + g + 0, 4);
+         memcpy(p + 5, " ", 1); memcpy(p + 6, hex + g + 4, 4);
+         memcpy(p + 10, " ", 1); memcpy(p + 11, hex + g + 8, 4);
+         memcpy(p + 15, " ", 1); memcpy(p + 16, hex + g + 12, 4);
+      }
+      memcpy(p, "  ", 2);
+      hex_ascii(p + 2, src, HEXDUMP_ROW);
+      p[2 + HEXDUMP_ROW] = '\n';
+      return (p + 3 + HEXDUMP_ROW) - dst;
+   }
+
+   for (size_t g = 0; g < HEXDUMP_ROW * 2; g += 4) {
+      const size_t have = (len * 2 > g ? (len * 2 - g > 4 ? 4 : len * 2 - g) : 0);
+      *p++ = ' ';
+      memcpy(p, hex + g, have);
+      memset(p + have, ' ', 4 - have);
+      p += 4;
+   }
+
+   *p++ = ' ';
+   *p++ = ' ';
+   hex_ascii(p, src, len);
+   p += len;
+   *p++ = '\n';
+   return p - dst;
+}
+
+// Rows are formatted into a buffer of whole lines that is written once full, so output is written in large blocks.
+// A partial row waits for the next write, or hexdump_finish.
+
+#define HEXDUMP_LINES 1024
+
+struct hexdump {
+   FILE *out;
+   uint64_t address;
+   char *lines;
+   size_t used;
+   unsigned char row[HEXDUMP_ROW];
+   size_t row_len;
+};
+
+static inline struct hexdump
+hexdump_init(FILE *out, const uint64_t address)
+{
+   char *lines;
+   if (!(lines = malloc(HEXDUMP_LINES * HEXDUMP_LINE)))
+      err(EXIT_FAILURE, "malloc");
+
+   return (struct hexdump){ .out = out, .address = address, .lines = lines };
+}
+
+static inline bool
+hexdump_flush(struct hexdump *dump)
+{
+   const size_t used = dump->used;
+   dump->used = 0;
+   return (fwrite(dump->lines, 1, used, dump->out) == used);
+}
+
+static inline bool
+hexdump_line(struct hexdump *dump, const unsigned char *src, const size_t len)
+{
+   if (dump->used + HEXDUMP_LINE > HEXDUMP_LINES * HEXDUMP_LINE && !hexdump_flush(dump))
+      return false;
+
+   dump->used += hexdump_row(dump->lines + dump->used, dump->address, src, len);
+   dump->address += len;
+   return true;
+}
+
+// Returns size, or 0 if writing to out failed
+static inline size_t
+hexdump_write(struct hexdump *dump, const void *ptr, const size_t size)
+{
+   const unsigned char *src = ptr;
+   size_t i = 0;
+
+   if (dump->row_len > 0) {
+      i = (size < HEXDUMP_ROW - dump->row_len ? size : HEXDUMP_ROW - dump->row_len);
+      memcpy(dump->row + dump->row_len, src, i);
+
+      if ((dump->row_len += i) < HEXDUMP_ROW)
+         return size;
+
+      dump->row_len = 0;
+      if (!hexdump_line(dump, dump->row, HEXDUMP_ROW))
+         return 0;
+   }
+
+   for (; i + HEXDUMP_ROW <= size; i += HEXDUMP_ROW) {
+      if (!hexdump_line(dump, src + i, HEXDUMP_ROW))
+         return 0;
+   }
+
+   memcpy(dump->row, src + i, size - i);
+   dump->row_len = size - i;
+   return size;
+}
+
+// Writes out the partial row and the buffered lines, and releases the dump
+static inline bool
+hexdump_finish(struct hexdump *dump)
+{
+   const bool ok = (!dump->row_len || hexdump_line(dump, dump->row, dump->row_len)) && hexdump_flush(dump);
+   free(dump->lines);
+   *dump = (struct hexdump){0};
+   return ok;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+#include "mem/io.h"
+#include "parallel.h"
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+// Page hash manifest, shared by region-rw and memdiff
+// Comparing manifests tells which pages changed without touching their contents.
+//
+// header | { region header | hash[pages] } * num_regions
+//
+// Pages that couldn't be read at all hash to 0, partially readable pages hash their readable prefix.
+
+#define MANIFEST_MAGIC "MEMHASH1"
+#define MANIFEST_PAGE_SIZE 4096
+
+struct manifest_header {
+   char magic[8];
+   uint64_t page_size, num_regions;
+};
+
+struct manifest_region {
+   uint64_t start, size;
+};
+
+static inline uint64_t
+manifest_mix(uint64_t h)
+{
+   h ^= h >> 33;
+   h *= 0xff51afd7ed558ccdull;
+   h ^= h >> 33;
+   h *= 0xc4ceb9fe1a85ec53ull;
+   return h ^ (h >> 33);
+}
+
+static inline uint64_t
+manifest_hash(const unsigned char *data, const size_t len)
+{
+   // eight 64-bit lanes over 64 byte stripes, each adds the low times high half of data ^ key and the neighbouring data word
+   // the scalar path computes the same, so manifests compare across builds
+   static const uint64_t key[8] = { 0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+                                    0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull };
+   uint64_t lanes[8] = { 0x9e3779b185ebca87ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull, 0x85ebca77c2b2ae63ull,
+                         0x27d4eb2f165667c5ull, 0x9e3779b97f4a7c15ull, 0xbf58476d1ce4e5b9ull, 0x94d049bb133111ebull };
+   size_t i = 0;
+#ifdef __SSE2__
+   __m128i acc[4], keys[4];
+   for (size_t l = 0; l < 4; ++l) {
+      acc[l] = _mm_loadu_si128((const __m128i*)(lanes + l * 2));
+      keys[l] = _mm_loadu_si128((const __m128i*)(key + l * 2));
+   }
+
+   for (; i + 64 <= len; i += 64) {
+      for (size_t l = 0; l < 4; ++l) {
+         const __m128i d = _mm_loadu_si128((const __m128i*)(data + i + l * 16));
+         const __m128i k = _mm_xor_si128(d, keys[l]);
+         const __m128i p = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(2, 3, 0, 1)));
+         acc[l] = _mm_add_epi64(acc[l], _mm_add_epi64(p, _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2))));
+      }
+   }
+
+   for (size_t l = 0; l < 4; ++l)
+      _mm_storeu_si128((__m128i*)(lanes + l * 2), acc[l]);
+#else
+   for (; i + 64 <= len; i += 64) {
+      uint64_t d[8];
+      memcpy(d, data + i, sizeof(d));
+      for (size_t l = 0; l < 8; ++l) {
+         const uint64_t k = d[l] ^ key[l];
+         lanes[l] += (k & 0xffffffff) * (k >> 32) + d[l ^ 1];
+      }
+   }
+#endif
+
+   uint64_t h = len * 0x9e3779b185ebca87ull;
+   for (size_t l = 0; l < 8; ++l)
+      h = manifest_mix(h ^ lanes[l]) + l;
+
+   for (uint64_t w; i + sizeof(w) <= len; i += sizeof(w)) {
+      memcpy(&w, data + i, sizeof(w));
+      h = manifest_mix(h ^ w);
+   }
+
+   for (; i < len; ++i)
+      h = manifest_mix(h ^ data[i]);
+
+   // 0 is reserved for unreadable pages
+   return (len && h ? h : !!len);
+}
+
+struct manifest_job {
+   const struct mem_io *io;
+   uint64_t start, size, *hashes;
+};
+
+static inline void
+manifest_hash_chunk(const size_t i, void *data)
+{
+   const struct manifest_job *job = data;
+   const size_t pages_per_chunk = 256, chunk = pages_per_chunk * MANIFEST_PAGE_SIZE;
+   const uint64_t off = i * chunk, len = (job->size - off > chunk ? chunk : job->size - off);
+
+   unsigned char *buf;
+   if (!(buf = malloc(chunk)))
+      err(EXIT_FAILURE, "malloc");
+
+   // a short read leaves the rest of the chunk unreadable
+   const size_t rd = job->io->read(job->io, buf, job->start + off, len);
+   for (size_t p = 0; p * MANIFEST_PAGE_SIZE < len; ++p) {
+      const size_t at = p * MANIFEST_PAGE_SIZE, avail = (rd > at ? rd - at : 0);
+      job->hashes[i * pages_per_chunk + p] = manifest_hash(buf + at, (avail > MANIFEST_PAGE_SIZE ? MANIFEST_PAGE_SIZE : avail));
+   }
+
+   free(buf);
+}
+
+static inline uint64_t
+manifest_pages(const uint64_t size)
+{
+   return (size + MANIFEST_PAGE_SIZE - 1) / MANIFEST_PAGE_SIZE;
+}
+
+// Hashes every page of [start, start + size) with reads spread over all cores, hashes must fit manifest_pages(size)
+static inline void
+manifest_hash_region(const struct mem_io *io, const uint64_t start, const uint64_t size, uint64_t *hashes)
+{
+   struct manifest_job job = { .io = io, .start = start, .size = size, .hashes = hashes };
+   const uint64_t chunk = 256 * MANIFEST_PAGE_SIZE;
+   parallel_for((size + chunk - 1) / chunk, manifest_hash_chunk, &job);
+}
+
+static inline bool
+manifest_write_header(FILE *f, const uint64_t num_regions)
+{
+   struct manifest_header header = { .page_size = MANIFEST_PAGE_SIZE, .num_regions = num_regions };
+   memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+   return (fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1);
+}
+
+static inline bool
+manifest_write_region(FILE *f, const struct mem_io *io, const uint64_t start, const uint64_t size)
+{
+   uint64_t *hashes;
+   if (!(hashes = malloc(sizeof(*hashes) * (manifest_pages(size) + 1))))
+      err(EXIT_FAILURE, "malloc");
+
+   manifest_hash_region(io, start, size, hashes);
+
+   const struct manifest_region region = { .start = start, .size = size };
+   const bool ok = (fwrite(&region, sizeof(region), 1, f) == 1 && fwrite(hashes, sizeof(*hashes), manifest_pages(size), f) == manifest_pages(size));
+   free(hashes);
+   return ok;
+}
@@ -0,0 +1,140 @@
+#include "freeze.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <err.h>
+#include <dirent.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+static uint64_t
+now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool
+has_task(const struct mem_freeze *freeze, const pid_t tid)
+{
+   for (size_t i = 0; i < freeze->num_tasks; ++i) {
+      if (freeze->tasks[i].tid == tid)
+         return true;
+   }
+   return false;
+}
+
+static bool
+seize_task(struct mem_freeze *freeze, const pid_t tid)
+{
+   if (ptrace(PTRACE_SEIZE, tid, NULL, NULL) == -1L) {
+      // exited between listing and seizing
+      if (errno == ESRCH)
+         return true;
+
+      warn("ptrace(PTRACE_SEIZE, %u, NULL, NULL)", tid);
+      return false;
+   }
+
+   const size_t step = 64;
+   if (freeze->num_tasks >= freeze->allocated_tasks &&
+       !(freeze->tasks = realloc(freeze->tasks, sizeof(*freeze->tasks) * (freeze->allocated_tasks += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   freeze->tasks[freeze->num_tasks++] = (struct mem_freeze_task){ .tid = tid };
+
+   if (ptrace(PTRACE_INTERRUPT, tid, NULL, NULL) == -1L && errno != ESRCH) {
+      warn("ptrace(PTRACE_INTERRUPT, %u, NULL, NULL)", tid);
+      return false;
+   }
+
+   return true;
+}
+
+static bool
+wait_task(struct mem_freeze_task *task)
+{
+   int status;
+   while (waitpid(task->tid, &status, __WALL) == -1) {
+      if (errno == EINTR)
+         continue;
+
+      warn("waitpid(%u)", task->tid);
+      return false;
+   }
+
+   if (!WIFSTOPPED(status)) {
+      // exited before it could stop, nothing to thaw
+      task->tid = 0;
+      return true;
+   }
+
+   // signal-delivery-stop instead of the interrupt, the signal has to be passed on when detaching
+   if (status >> 16 != PTRACE_EVENT_STOP && WSTOPSIG(status) != SIGTRAP)
+      task->signal = WSTOPSIG(status);
+
+   return true;
+}
+
+static size_t
+seize_new_tasks(struct mem_freeze *freeze, bool *ok)
+{
+   char path[128];
+   snprintf(path, sizeof(path), "/proc/%u/task", freeze->pid);
+
+   DIR *dir;
+   if (!(dir = opendir(path))) {
+      warn("opendir(%s)", path);
+      *ok = false;
+      return 0;
+   }
+
+   const size_t first = freeze->num_tasks;
+   for (struct dirent *ent; *ok && (ent = readdir(dir));) {
+      const pid_t tid = strtoul(ent->d_name, NULL, 10);
+      if (tid > 0 && !has_task(freeze, tid))
+         *ok = seize_task(freeze, tid);
+   }
+
+   closedir(dir);
+
+   // all interrupts are in flight before waiting for any, so the tasks stop concurrently
+   for (size_t i = first; *ok && i < freeze->num_tasks; ++i)
+      *ok = wait_task(&freeze->tasks[i]);
+
+   return freeze->num_tasks - first;
+}
+
+bool
+mem_freeze(struct mem_freeze *freeze, const pid_t pid)
+{
+   *freeze = (struct mem_freeze){ .pid = pid, .stopped = now_ns() };
+
+   // tasks may spawn threads until they are stopped, so list again until nothing new shows up
+   bool ok = true;
+   while (seize_new_tasks(freeze, &ok) > 0 && ok);
+
+   if (!ok || !freeze->num_tasks) {
+      mem_thaw(freeze);
+      return false;
+   }
+
+   return true;
+}
+
+uint64_t
+mem_thaw(struct mem_freeze *freeze)
+{
+   for (size_t i = 0; i < freeze->num_tasks; ++i) {
+      if (freeze->tasks[i].tid > 0)
+         ptrace(PTRACE_DETACH, freeze->tasks[i].tid, NULL, (void*)(intptr_t)freeze->tasks[i].signal);
+   }
+
+   const uint64_t paused = (freeze->stopped ? now_ns() - freeze->stopped : 0);
+   free(freeze->tasks);
+   *freeze = (struct mem_freeze){0};
+   return paused;
+}
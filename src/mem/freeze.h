@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h> // pid_t
+
+// Stops every task of a thread group, so memory can be read in a consistent state.
+// Tasks are seized and interrupted rather than attached, which doesn't involve SIGSTOP,
+// and anything that was already pending for a task is delivered again when it is thawed.
+// Only stopping is done here, reading is left for any mem_io backend that doesn't attach by itself (uio).
+
+struct mem_freeze {
+   struct mem_freeze_task {
+      pid_t tid;
+      int signal; // signal to redeliver on thaw
+   } *tasks;
+   size_t num_tasks, allocated_tasks;
+   uint64_t stopped; // monotonic ns of the first interrupt
+   pid_t pid;
+};
+
+bool
+mem_freeze(struct mem_freeze *freeze, const pid_t pid);
+
+// Resumes every task and releases the freeze, returns how long the thread group was stopped in ns
+uint64_t
+mem_thaw(struct mem_freeze *freeze);
@@ -1,28 +1,29 @@
 #include "io.h"
 #include <stdio.h>
+#include <unistd.h>
 #include <err.h>
 #include <sys/ptrace.h>
 #include <sys/wait.h>
 
 static size_t
-mem_io_ptrace_do(const struct mem_io *io, void *ptr, const size_t offset, const size_t size, size_t (*iofun)(void*, size_t, size_t, FILE*))
+mem_io_ptrace_do(const struct mem_io *io, void *ptr, const size_t offset, const size_t size, ssize_t (*iofun)(int, void*, size_t, off_t))
 {
-   if (fseek(io->backing, offset, SEEK_SET) != 0) {
-      warn("fseek(/proc/%u/mem, %zu)", io->pid, offset);
-      return 0;
+   // positioned io on the descriptor, so the same io can be used from multiple threads
+   size_t done = 0;
+   for (ssize_t ret; done < size; done += ret) {
+      if ((ret = iofun(fileno(io->backing), (unsigned char*)ptr + done, size - done, offset + done)) <= 0)
+         break;
    }
-
-   return iofun(ptr, 1, size, io->backing);
+   return done;
 }
 
 static size_t
 mem_io_ptrace_write(const struct mem_io *io, const void *ptr, const size_t offset, const size_t size)
 {
-   clearerr(io->backing);
-   const size_t ret = mem_io_ptrace_do(io, (void*)ptr, offset, size, (size_t(*)())fwrite);
+   const size_t ret = mem_io_ptrace_do(io, (void*)ptr, offset, size, (ssize_t(*)())pwrite);
 
-   if (ferror(io->backing))
-      warn("fwrite(/proc/%u/mem)", io->pid);
+   if (ret != size)
+      warn("pwrite(/proc/%u/mem, %zu)", io->pid, offset + ret);
 
    return ret;
 }
@@ -30,11 +31,10 @@ mem_io_ptrace_write(const struct mem_io *io, const void *ptr, const size_t offse
 static size_t
 mem_io_ptrace_read(const struct mem_io *io, void *ptr, const size_t offset, const size_t size)
 {
-   clearerr(io->backing);
-   const size_t ret = mem_io_ptrace_do(io, ptr, offset, size, fread);
+   const size_t ret = mem_io_ptrace_do(io, ptr, offset, size, pread);
 
-   if (ferror(io->backing))
-      warn("fread(/proc/%u/mem)", io->pid);
+   if (ret != size)
+      warn("pread(/proc/%u/mem, %zu)", io->pid, offset + ret);
 
    return ret;
 }
@@ -49,6 +49,44 @@ mem_io_ptrace_cleanup(struct mem_io *io)
       ptrace(PTRACE_DETACH, io->pid, 1, 0);
 }
 
+static void
+mem_io_proc_mem_cleanup(struct mem_io *io)
+{
+   if (io->backing)
+      fclose(io->backing);
+}
+
+static bool
+open_proc_mem(struct mem_io *io, const pid_t pid)
+{
+   char path[128];
+   snprintf(path, sizeof(path), "/proc/%u/mem", pid);
+   if (!(io->backing = fopen(path, "w+b"))) {
+      warn("fopen(%s)", path);
+      return false;
+   }
+
+   return true;
+}
+
+bool
+mem_io_proc_mem_init(struct mem_io *io, const pid_t pid)
+{
+   *io = (struct mem_io){
+      .pid = pid,
+      .read = mem_io_ptrace_read,
+      .write = mem_io_ptrace_write,
+      .cleanup = mem_io_proc_mem_cleanup
+   };
+
+   if (!open_proc_mem(io, pid)) {
+      io->cleanup(io);
+      return false;
+   }
+
+   return true;
+}
+
 bool
 mem_io_ptrace_init(struct mem_io *io, const pid_t pid)
 {
@@ -72,12 +110,8 @@ mem_io_ptrace_init(struct mem_io *io, const pid_t pid)
       }
    }
 
-   char path[128];
-   snprintf(path, sizeof(path), "/proc/%u/mem", pid);
-   if (!(io->backing = fopen(path, "w+b"))) {
-      warn("fopen(%s)", path);
+   if (!open_proc_mem(io, pid))
       goto fail;
-   }
 
    return true;
 
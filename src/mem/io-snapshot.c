@@ -0,0 +1,554 @@
+#include "io.h"
+#include "io-snapshot.h"
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// LZ77 with LZ4 style sequences: token (literal len << 4 | match len - 4), literals, 16bit offset
+// Blocks are at most 64KiB, so positions and offsets always fit in 16 bits.
+
+static inline uint32_t
+read32(const unsigned char *p)
+{
+   uint32_t v;
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static inline bool
+put_len(unsigned char **op, const unsigned char *oend, size_t len)
+{
+   for (; len >= 255; len -= 255) {
+      if (*op >= oend) return false;
+      *(*op)++ = 255;
+   }
+   if (*op >= oend) return false;
+   *(*op)++ = len;
+   return true;
+}
+
+static bool
+put_sequence(unsigned char **op, const unsigned char *oend, const unsigned char *lit, const size_t lit_len, const size_t offset, const size_t match_len)
+{
+   if (*op >= oend)
+      return false;
+
+   unsigned char *token = (*op)++;
+   *token = (lit_len >= 15 ? 15 : lit_len) << 4;
+
+   if (lit_len >= 15 && !put_len(op, oend, lit_len - 15))
+      return false;
+
+   if ((size_t)(oend - *op) < lit_len)
+      return false;
+
+   memcpy(*op, lit, lit_len);
+   *op += lit_len;
+
+   if (!match_len)
+      return true;
+
+   if (oend - *op < 2)
+      return false;
+
+   *(*op)++ = offset & 0xff;
+   *(*op)++ = offset >> 8;
+   *token |= (match_len - 4 >= 15 ? 15 : match_len - 4);
+   return (match_len - 4 < 15 || put_len(op, oend, match_len - 4 - 15));
+}
+
+size_t
+mem_snapshot_lz_compress(const unsigned char *src, const size_t len, unsigned char *dst, const size_t cap)
+{
+   if (len > MEM_SNAPSHOT_BLOCK_SIZE)
+      return 0;
+
+   uint16_t table[4096] = {0};
+   unsigned char *op = dst;
+   const unsigned char *oend = dst + cap;
+   size_t ip = 0, anchor = 0;
+
+   while (len >= 8 && ip + 8 <= len) {
+      const uint32_t seq = read32(src + ip);
+      const uint32_t h = (seq * 2654435761u) >> 20;
+      const size_t ref = table[h];
+      table[h] = ip;
+
+      if (ref >= ip || ip - ref > 0xffff || read32(src + ref) != seq) {
+         // skip faster through incompressible data
+         ip += 1 + ((ip - anchor) >> 6);
+         continue;
+      }
+
+      size_t match_len = 4;
+      for (; ip + match_len < len && src[ref + match_len] == src[ip + match_len]; ++match_len);
+
+      if (!put_sequence(&op, oend, src + anchor, ip - anchor, ip - ref, match_len))
+         return 0;
+
+      ip += match_len;
+      anchor = ip;
+   }
+
+   if (anchor < len && !put_sequence(&op, oend, src + anchor, len - anchor, 0, 0))
+      return 0;
+
+   return op - dst;
+}
+
+static inline bool
+get_len(const unsigned char **ip, const unsigned char *iend, size_t *len)
+{
+   for (unsigned char b = 255; b == 255; *len += b) {
+      if (*ip >= iend) return false;
+      b = *(*ip)++;
+   }
+   return true;
+}
+
+size_t
+mem_snapshot_lz_decompress(const unsigned char *src, const size_t len, unsigned char *dst, const size_t cap)
+{
+   const unsigned char *ip = src, *iend = src + len;
+   unsigned char *op = dst;
+   const unsigned char *oend = dst + cap;
+
+   while (ip < iend) {
+      const unsigned char token = *ip++;
+
+      size_t lit_len = token >> 4;
+      if (lit_len == 15 && !get_len(&ip, iend, &lit_len))
+         return 0;
+
+      if ((size_t)(iend - ip) < lit_len || (size_t)(oend - op) < lit_len)
+         return 0;
+
+      memcpy(op, ip, lit_len);
+      ip += lit_len; op += lit_len;
+
+      if (ip >= iend)
+         break;
+
+      if (iend - ip < 2)
+         return 0;
+
+      const size_t offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+
+      size_t match_len = (token & 15);
+      if (match_len == 15 && !get_len(&ip, iend, &match_len))
+         return 0;
+      match_len += 4;
+
+      if (!offset || offset > (size_t)(op - dst) || (size_t)(oend - op) < match_len)
+         return 0;
+
+      const unsigned char *ref = op - offset;
+      if (offset >= match_len) {
+         memcpy(op, ref, match_len);
+         op += match_len;
+      } else {
+         for (size_t i = 0; i < match_len; ++i)
+            *op++ = ref[i];
+      }
+   }
+
+   return op - dst;
+}
+
+#define GROW(ptr, num, allocated, step) \
+   ((num) < (allocated) || ((ptr) = realloc((ptr), sizeof(*(ptr)) * ((allocated) += (step)))))
+
+bool
+mem_snapshot_writer_init(struct mem_snapshot_writer *writer, const char *path)
+{
+   *writer = (struct mem_snapshot_writer){
+      .header = {
+         .magic = MEM_SNAPSHOT_MAGIC,
+         .block_size = MEM_SNAPSHOT_BLOCK_SIZE,
+      },
+      .data_offset = sizeof(writer->header),
+   };
+
+   if (!(writer->buf = malloc(MEM_SNAPSHOT_BLOCK_SIZE)) || !(writer->compressed = malloc(MEM_SNAPSHOT_BLOCK_SIZE))) {
+      warn("malloc");
+      goto fail;
+   }
+
+   if (!(writer->file = fopen(path, "wb"))) {
+      warn("fopen(%s)", path);
+      goto fail;
+   }
+
+   // header gets rewritten once the tables are known
+   if (fwrite(&writer->header, sizeof(writer->header), 1, writer->file) != 1) {
+      warn("fwrite(%s)", path);
+      goto fail;
+   }
+
+   return true;
+
+fail:
+   if (writer->file)
+      fclose(writer->file);
+   free(writer->buf);
+   free(writer->compressed);
+   *writer = (struct mem_snapshot_writer){0};
+   return false;
+}
+
+static bool
+block_is_zero(const unsigned char *data, const size_t len)
+{
+   return (len > 0 && data[0] == 0 && !memcmp(data, data + 1, len - 1));
+}
+
+size_t
+mem_snapshot_writer_add_region(struct mem_snapshot_writer *writer, const struct mem_io *io, const char *line, const size_t start, const size_t size)
+{
+   const size_t line_len = strlen(line);
+   if (!GROW(writer->regions, writer->header.num_regions, writer->allocated_regions, 1024) ||
+       !GROW(writer->lines, writer->header.lines_size + line_len + 1, writer->allocated_lines, line_len + 1 + 64 * 1024))
+      err(EXIT_FAILURE, "realloc");
+
+   writer->regions[writer->header.num_regions++] = (struct mem_snapshot_region){
+      .start = start,
+      .size = size,
+      .first_block = writer->header.num_blocks,
+      .line_offset = writer->header.lines_size,
+      .line_len = line_len,
+   };
+
+   memcpy(writer->lines + writer->header.lines_size, line, line_len);
+   writer->lines[(writer->header.lines_size += line_len + 1) - 1] = '\n';
+
+   size_t trd = 0;
+   for (size_t off = 0; off < size; off += writer->header.block_size) {
+      if (!GROW(writer->blocks, writer->header.num_blocks, writer->allocated_blocks, 1024))
+         err(EXIT_FAILURE, "realloc");
+
+      const size_t len = (size - off > writer->header.block_size ? writer->header.block_size : size - off);
+      const size_t rd = io->read(io, writer->buf, start + off, len);
+      struct mem_snapshot_block *block = &writer->blocks[writer->header.num_blocks++];
+      *block = (struct mem_snapshot_block){ .offset = writer->data_offset, .size = rd };
+      trd += rd;
+
+      if (!rd || block_is_zero(writer->buf, rd))
+         continue;
+
+      const unsigned char *data = writer->buf;
+      const size_t compressed = mem_snapshot_lz_compress(writer->buf, rd, writer->compressed, rd - 1);
+      if (compressed > 0) {
+         data = writer->compressed;
+         block->stored = compressed;
+      } else {
+         block->stored = rd;
+      }
+
+      if (fwrite(data, 1, block->stored, writer->file) != block->stored)
+         err(EXIT_FAILURE, "fwrite");
+
+      writer->data_offset += block->stored;
+   }
+
+   return trd;
+}
+
+bool
+mem_snapshot_writer_finish(struct mem_snapshot_writer *writer)
+{
+   bool ret = false;
+   struct mem_snapshot_header *h = &writer->header;
+   h->regions_offset = writer->data_offset;
+   h->blocks_offset = h->regions_offset + h->num_regions * sizeof(*writer->regions);
+   h->lines_offset = h->blocks_offset + h->num_blocks * sizeof(*writer->blocks);
+
+   // keep tables 8 byte aligned, so the file can be used as is when mmapped
+   static const unsigned char pad[8];
+   const size_t padding = (8 - h->regions_offset % 8) % 8;
+   h->regions_offset += padding; h->blocks_offset += padding; h->lines_offset += padding;
+
+   if (fwrite(pad, 1, padding, writer->file) != padding ||
+       fwrite(writer->regions, sizeof(*writer->regions), h->num_regions, writer->file) != h->num_regions ||
+       fwrite(writer->blocks, sizeof(*writer->blocks), h->num_blocks, writer->file) != h->num_blocks ||
+       fwrite(writer->lines, 1, h->lines_size, writer->file) != h->lines_size) {
+      warn("fwrite");
+      goto out;
+   }
+
+   if (fseek(writer->file, 0, SEEK_SET) != 0 || fwrite(h, sizeof(*h), 1, writer->file) != 1) {
+      warn("fwrite");
+      goto out;
+   }
+
+   ret = true;
+
+out:
+   if (fclose(writer->file) != 0) {
+      warn("fclose");
+      ret = false;
+   }
+
+   free(writer->regions);
+   free(writer->blocks);
+   free(writer->lines);
+   free(writer->buf);
+   free(writer->compressed);
+   *writer = (struct mem_snapshot_writer){0};
+   return ret;
+}
+
+struct snapshot {
+   const unsigned char *mapped;
+   size_t mapped_size;
+   const struct mem_snapshot_header *header;
+   const struct mem_snapshot_region *regions;
+   const struct mem_snapshot_block *blocks;
+   char *maps;
+
+   // last decompressed block, shared between threads
+   struct {
+      pthread_mutex_t mutex;
+      unsigned char *data;
+      size_t block;
+   } cache;
+};
+
+static const struct mem_snapshot_region*
+region_for_offset(const struct snapshot *s, const size_t offset)
+{
+   size_t lo = 0, hi = s->header->num_regions;
+   while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (offset < s->regions[mid].start) {
+         hi = mid;
+      } else if (offset - s->regions[mid].start >= s->regions[mid].size) {
+         lo = mid + 1;
+      } else {
+         return &s->regions[mid];
+      }
+   }
+   return NULL;
+}
+
+static bool
+block_decompress(const struct snapshot *s, const struct mem_snapshot_block *block, unsigned char *dst)
+{
+   if (!block->stored) {
+      memset(dst, 0, block->size);
+      return true;
+   }
+
+   if (block->stored == block->size) {
+      memcpy(dst, s->mapped + block->offset, block->size);
+      return true;
+   }
+
+   if (mem_snapshot_lz_decompress(s->mapped + block->offset, block->stored, dst, block->size) != block->size) {
+      warnx("snapshot: corrupted block at 0x%zx", (size_t)block->offset);
+      return false;
+   }
+
+   return true;
+}
+
+static size_t
+mem_io_snapshot_read(const struct mem_io *io, void *ptr, const size_t offset, const size_t size)
+{
+   struct snapshot *s = io->backing;
+   const size_t bs = s->header->block_size;
+
+   size_t trd = 0;
+   for (const struct mem_snapshot_region *r; trd < size && (r = region_for_offset(s, offset + trd));) {
+      const size_t roff = offset + trd - r->start;
+      const size_t index = r->first_block + roff / bs, boff = roff % bs;
+      const struct mem_snapshot_block *block = &s->blocks[index];
+
+      if (boff >= block->size)
+         break;
+
+      const size_t len = (block->size - boff > size - trd ? size - trd : block->size - boff);
+      if (!block->stored || block->stored == block->size || (boff == 0 && len == block->size)) {
+         // no need for the cache, when the whole block is wanted or it isn't compressed
+         if (boff == 0 && len == block->size) {
+            if (!block_decompress(s, block, (unsigned char*)ptr + trd))
+               break;
+         } else if (!block->stored) {
+            memset((unsigned char*)ptr + trd, 0, len);
+         } else {
+            memcpy((unsigned char*)ptr + trd, s->mapped + block->offset + boff, len);
+         }
+      } else {
+         pthread_mutex_lock(&s->cache.mutex);
+         if (s->cache.block != index && block_decompress(s, block, s->cache.data))
+            s->cache.block = index;
+
+         const bool ok = (s->cache.block == index);
+         if (ok)
+            memcpy((unsigned char*)ptr + trd, s->cache.data + boff, len);
+         pthread_mutex_unlock(&s->cache.mutex);
+
+         if (!ok)
+            break;
+      }
+
+      trd += len;
+
+      // stop at holes, like a partial process_vm_readv would
+      if (boff + len < bs && trd < size && roff + len < r->size)
+         break;
+   }
+
+   return trd;
+}
+
+static size_t
+mem_io_snapshot_write(const struct mem_io *io, const void *ptr, const size_t offset, const size_t size)
+{
+   (void)io, (void)ptr, (void)size;
+   warnx("snapshot is read-only, can't write to 0x%zx", offset);
+   return 0;
+}
+
+static void
+mem_io_snapshot_cleanup(struct mem_io *io)
+{
+   struct snapshot *s = io->backing;
+   if (!s)
+      return;
+
+   if (s->mapped)
+      munmap((void*)s->mapped, s->mapped_size);
+
+   pthread_mutex_destroy(&s->cache.mutex);
+   free((void*)s->regions);
+   free(s->cache.data);
+   free(s->maps);
+   free(s);
+}
+
+static int
+region_cmp(const void *a, const void *b)
+{
+   const struct mem_snapshot_region *ra = a, *rb = b;
+   return (ra->start < rb->start ? -1 : ra->start > rb->start);
+}
+
+bool
+mem_io_snapshot_init(struct mem_io *io, const char *path)
+{
+   *io = (struct mem_io){
+      .read = mem_io_snapshot_read,
+      .write = mem_io_snapshot_write,
+      .cleanup = mem_io_snapshot_cleanup
+   };
+
+   int fd = -1;
+   struct snapshot *s;
+   if (!(io->backing = s = calloc(1, sizeof(*s)))) {
+      warn("calloc");
+      goto fail;
+   }
+
+   pthread_mutex_init(&s->cache.mutex, NULL);
+   s->cache.block = (size_t)~0;
+
+   if ((fd = open(path, O_RDONLY)) == -1) {
+      warn("open(%s)", path);
+      goto fail;
+   }
+
+   struct stat st;
+   if (fstat(fd, &st) != 0) {
+      warn("fstat(%s)", path);
+      goto fail;
+   }
+
+   if ((size_t)st.st_size < sizeof(*s->header)) {
+      warnx("%s: not a snapshot", path);
+      goto fail;
+   }
+
+   void *mapped;
+   if ((mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+      warn("mmap(%s)", path);
+      goto fail;
+   }
+
+   s->mapped = mapped;
+   s->mapped_size = st.st_size;
+   s->header = mapped;
+
+   const struct mem_snapshot_header *h = s->header;
+   if (memcmp(h->magic, MEM_SNAPSHOT_MAGIC, sizeof(h->magic)) || !h->block_size || h->block_size > MEM_SNAPSHOT_BLOCK_SIZE) {
+      warnx("%s: not a snapshot", path);
+      goto fail;
+   }
+
+   if (h->regions_offset % 8 || h->blocks_offset % 8 ||
+       h->regions_offset + h->num_regions * sizeof(*s->regions) > s->mapped_size ||
+       h->blocks_offset + h->num_blocks * sizeof(*s->blocks) > s->mapped_size ||
+       h->lines_offset + h->lines_size > s->mapped_size) {
+      warnx("%s: truncated snapshot", path);
+      goto fail;
+   }
+
+   s->blocks = (const struct mem_snapshot_block*)(s->mapped + h->blocks_offset);
+   for (size_t i = 0; i < h->num_blocks; ++i) {
+      if (s->blocks[i].offset + s->blocks[i].stored > s->mapped_size || s->blocks[i].size > h->block_size || s->blocks[i].stored > s->blocks[i].size) {
+         warnx("%s: corrupted block table", path);
+         goto fail;
+      }
+   }
+
+   // regions are sorted for lookups, the table in the file is kept in dump order
+   struct mem_snapshot_region *regions;
+   if (!(regions = malloc(h->num_regions * sizeof(*regions) + 1)) || !(s->maps = malloc(h->lines_size + 1))) {
+      free(regions);
+      warn("malloc");
+      goto fail;
+   }
+
+   memcpy(regions, s->mapped + h->regions_offset, h->num_regions * sizeof(*regions));
+   memcpy(s->maps, s->mapped + h->lines_offset, h->lines_size);
+   s->maps[h->lines_size] = 0;
+
+   for (size_t i = 0; i < h->num_regions; ++i) {
+      const size_t blocks = (regions[i].size + h->block_size - 1) / h->block_size;
+      if (regions[i].first_block + blocks > h->num_blocks) {
+         free(regions);
+         warnx("%s: corrupted region table", path);
+         goto fail;
+      }
+   }
+
+   qsort(regions, h->num_regions, sizeof(*regions), region_cmp);
+   s->regions = regions;
+
+   if (!(s->cache.data = malloc(h->block_size))) {
+      warn("malloc");
+      goto fail;
+   }
+
+   close(fd);
+   return true;
+
+fail:
+   if (fd != -1)
+      close(fd);
+   io->cleanup(io);
+   *io = (struct mem_io){0};
+   return false;
+}
+
+const char*
+mem_io_snapshot_maps(const struct mem_io *io)
+{
+   const struct snapshot *s = io->backing;
+   return s->maps;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct mem_io;
+
+// Snapshot container
+// Regions are split into fixed size blocks that are compressed independently,
+// so reading any address costs decompressing at most a single block.
+//
+// header | block data ... | regions[num_regions] | blocks[num_blocks] | maps lines
+//
+// Block has size bytes of readable data, anything after that is a hole (unreadable memory).
+// stored == 0 means the block is all zero, stored == size means it's stored raw, otherwise it's lz compressed.
+
+#define MEM_SNAPSHOT_MAGIC "MEMSNAP1"
+#define MEM_SNAPSHOT_BLOCK_SIZE (64 * 1024)
+
+struct mem_snapshot_header {
+   char magic[8];
+   uint64_t block_size, num_regions, num_blocks;
+   uint64_t regions_offset, blocks_offset, lines_offset, lines_size;
+};
+
+struct mem_snapshot_region {
+   uint64_t start, size, first_block, line_offset, line_len;
+};
+
+struct mem_snapshot_block {
+   uint64_t offset;
+   uint32_t stored, size;
+};
+
+struct mem_snapshot_writer {
+   FILE *file;
+   struct mem_snapshot_header header;
+   struct mem_snapshot_region *regions;
+   struct mem_snapshot_block *blocks;
+   char *lines;
+   unsigned char *buf, *compressed;
+   size_t allocated_regions, allocated_blocks, allocated_lines, data_offset;
+};
+
+bool
+mem_snapshot_writer_init(struct mem_snapshot_writer *writer, const char *path);
+
+size_t
+mem_snapshot_writer_add_region(struct mem_snapshot_writer *writer, const struct mem_io *io, const char *line, const size_t start, const size_t size);
+
+bool
+mem_snapshot_writer_finish(struct mem_snapshot_writer *writer);
+
+bool
+mem_io_snapshot_init(struct mem_io *io, const char *path);
+
+const char*
+mem_io_snapshot_maps(const struct mem_io *io);
+
+size_t
+mem_snapshot_lz_compress(const unsigned char *src, const size_t len, unsigned char *dst, const size_t cap);
+
+size_t
+mem_snapshot_lz_decompress(const unsigned char *src, const size_t len, unsigned char *dst, const size_t cap);
@@ -1,7 +1,210 @@
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "io-stream.h"
 #include "io.h"
 
+// Copies larger than the first buffer are pipelined, a worker thread does the mem_io side,
+// while the calling thread does the stream side, so streams never see another thread.
+// Buffers are handed over through a single producer single consumer ring, indices are futex words,
+// a slot with len 0 marks the end of the copy.
+
+#define COPY_BUFFERS 4
+#define COPY_MIN_BUFFER (64 * 1024)
+#define COPY_MAX_BUFFER (4 * 1024 * 1024)
+#define COPY_SPINS 256
+
+struct copy {
+   size_t (*produce)(const struct copy *copy, void *ptr, const size_t offset, const size_t size);
+   size_t (*consume)(const struct copy *copy, const void *ptr, const size_t offset, const size_t size);
+   const struct mem_io *io;
+   const void *stream;
+   size_t offset, size, buffer_size, trw;
+
+   struct {
+      unsigned char *data;
+      size_t offset, len;
+   } slots[COPY_BUFFERS];
+
+   uint32_t head, tail; // produced and consumed slots, wrapping
+   unsigned char *pool;
+   size_t pool_size;
+};
+
+static void
+futex_wait(uint32_t *word, const uint32_t value)
+{
+   for (size_t i = 0; i < COPY_SPINS; ++i) {
+      if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != value)
+         return;
+   }
+
+   while (__atomic_load_n(word, __ATOMIC_ACQUIRE) == value)
+      syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void
+futex_wake(uint32_t *word)
+{
+   syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void
+copy_produce(struct copy *copy)
+{
+   // buffers grow while the source fills them, sources that return less stay at the size they manage
+   size_t trd = 0, chunk = COPY_MIN_BUFFER;
+   for (uint32_t head = copy->head;; ++head) {
+      while (head - __atomic_load_n(&copy->tail, __ATOMIC_ACQUIRE) == COPY_BUFFERS)
+         futex_wait(&copy->tail, head - COPY_BUFFERS);
+
+      const size_t want = (chunk > copy->size - trd ? copy->size - trd : chunk);
+      const uint32_t slot = head % COPY_BUFFERS;
+      const size_t rd = (want ? copy->produce(copy, copy->slots[slot].data, copy->offset + trd, want) : 0);
+      copy->slots[slot].offset = trd;
+      copy->slots[slot].len = rd;
+
+      __atomic_store_n(&copy->head, head + 1, __ATOMIC_RELEASE);
+      futex_wake(&copy->head);
+
+      if (!rd)
+         break;
+
+      trd += rd;
+      if (rd == want && chunk < copy->buffer_size)
+         chunk *= 2;
+   }
+}
+
+static void
+copy_consume(struct copy *copy)
+{
+   for (uint32_t tail = copy->tail;; ++tail) {
+      futex_wait(&copy->head, tail);
+
+      const uint32_t slot = tail % COPY_BUFFERS;
+      const size_t len = copy->slots[slot].len;
+      if (len)
+         copy->trw += copy->consume(copy, copy->slots[slot].data, copy->offset + copy->slots[slot].offset, len);
+
+      __atomic_store_n(&copy->tail, tail + 1, __ATOMIC_RELEASE);
+      futex_wake(&copy->tail);
+
+      if (!len)
+         break;
+   }
+}
+
+static void*
+copy_produce_worker(void *arg)
+{
+   copy_produce(arg);
+   return NULL;
+}
+
+static void*
+copy_consume_worker(void *arg)
+{
+   copy_consume(arg);
+   return NULL;
+}
+
+static bool
+copy_alloc(struct copy *copy)
+{
+   // hugepages when the system has them reserved, transparent ones otherwise
+   copy->pool_size = copy->buffer_size * COPY_BUFFERS;
+#ifdef MAP_HUGETLB
+   if (copy->buffer_size % (2 * 1024 * 1024) == 0 &&
+       (copy->pool = mmap(NULL, copy->pool_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0)) != MAP_FAILED)
+      goto done;
+#endif
+
+   if ((copy->pool = mmap(NULL, copy->pool_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+      return false;
+
+#ifdef MADV_HUGEPAGE
+   madvise(copy->pool, copy->pool_size, MADV_HUGEPAGE);
+#endif
+
+#ifdef MAP_HUGETLB
+done:
+#endif
+   for (size_t i = 0; i < COPY_BUFFERS; ++i)
+      copy->slots[i].data = copy->pool + i * copy->buffer_size;
+
+   return true;
+}
+
+static size_t
+copy_direct(struct copy *copy)
+{
+   // small copies, or when the pipeline can't be set up
+   size_t trw = 0;
+   unsigned char buf[4096];
+   for (size_t rd, trd = 0; trd < copy->size && (rd = copy->produce(copy, buf, copy->offset + trd, (trd + sizeof(buf) > copy->size ? copy->size - trd : sizeof(buf)))); trd += rd)
+      trw += copy->consume(copy, buf, copy->offset + trd, rd);
+   return trw;
+}
+
+static size_t
+copy_run(struct copy *copy, const bool worker_produces)
+{
+   if (copy->size <= COPY_MIN_BUFFER)
+      return copy_direct(copy);
+
+   // no point in buffers larger than the copy
+   while (copy->buffer_size > COPY_MIN_BUFFER && copy->buffer_size / 2 >= copy->size)
+      copy->buffer_size /= 2;
+
+   if (!copy_alloc(copy))
+      return copy_direct(copy);
+
+   pthread_t thread;
+   if (pthread_create(&thread, NULL, (worker_produces ? copy_produce_worker : copy_consume_worker), copy) != 0) {
+      munmap(copy->pool, copy->pool_size);
+      return copy_direct(copy);
+   }
+
+   if (worker_produces) {
+      copy_consume(copy);
+   } else {
+      copy_produce(copy);
+   }
+
+   pthread_join(thread, NULL);
+   munmap(copy->pool, copy->pool_size);
+   return copy->trw;
+}
+
+static size_t
+file_buffer_size(FILE *file)
+{
+   // pipes are best fed a pipe buffer at a time, files and devices take the largest buffers
+   struct stat st;
+   if (fstat(fileno(file), &st) != 0)
+      return COPY_MIN_BUFFER;
+
+#ifdef F_GETPIPE_SZ
+   int pipe_size;
+   if (S_ISFIFO(st.st_mode) && (pipe_size = fcntl(fileno(file), F_GETPIPE_SZ)) > 0) {
+      size_t size = COPY_MIN_BUFFER;
+      while (size < (size_t)pipe_size && size < COPY_MAX_BUFFER)
+         size *= 2;
+      return size;
+   }
+#endif
+
+   return (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode) ? COPY_MAX_BUFFER : COPY_MIN_BUFFER);
+}
+
 static size_t
 file_istream_read(const struct mem_io_istream *stream, void *ptr, const size_t size)
 {
@@ -17,14 +220,33 @@ mem_io_istream_from_file(FILE *file)
    };
 }
 
+static size_t
+produce_from_stream(const struct copy *copy, void *ptr, const size_t offset, const size_t size)
+{
+   (void)offset;
+   const struct mem_io_istream *stream = copy->stream;
+   return stream->read(stream, ptr, size);
+}
+
+static size_t
+consume_to_io(const struct copy *copy, const void *ptr, const size_t offset, const size_t size)
+{
+   return copy->io->write(copy->io, ptr, offset, size);
+}
+
 size_t
 mem_io_write_from_stream(const struct mem_io *io, const struct mem_io_istream *stream, const size_t offset, const size_t size)
 {
-   size_t trw = 0;
-   unsigned char buf[4096];
-   for (size_t rd, trd = 0; (rd = stream->read(stream, buf, (trd + sizeof(buf) > size ? size - trd : sizeof(buf)))) && trd < size; trd += rd)
-      trw += io->write(io, buf, offset + trd, rd);
-   return trw;
+   struct copy copy = {
+      .produce = produce_from_stream,
+      .consume = consume_to_io,
+      .io = io,
+      .stream = stream,
+      .offset = offset,
+      .size = size,
+      .buffer_size = (stream->read == file_istream_read ? file_buffer_size(stream->backing) : COPY_MAX_BUFFER),
+   };
+   return copy_run(&copy, false);
 }
 
 static size_t
@@ -42,12 +264,31 @@ mem_io_ostream_from_file(FILE *file)
    };
 }
 
+static size_t
+produce_from_io(const struct copy *copy, void *ptr, const size_t offset, const size_t size)
+{
+   return copy->io->read(copy->io, ptr, offset, size);
+}
+
+static size_t
+consume_to_stream(const struct copy *copy, const void *ptr, const size_t offset, const size_t size)
+{
+   (void)offset;
+   const struct mem_io_ostream *stream = copy->stream;
+   return stream->write(stream, ptr, size);
+}
+
 size_t
 mem_io_read_to_stream(const struct mem_io *io, const struct mem_io_ostream *stream, const size_t offset, const size_t size)
 {
-   size_t trw = 0;
-   unsigned char buf[4096];
-   for (size_t rd, trd = 0; (rd = io->read(io, buf, offset + trd, (trd + sizeof(buf) > size ? size - trd : sizeof(buf)))) && trd < size; trd += rd)
-      trw += stream->write(stream, buf, rd);
-   return trw;
+   struct copy copy = {
+      .produce = produce_from_io,
+      .consume = consume_to_stream,
+      .io = io,
+      .stream = stream,
+      .offset = offset,
+      .size = size,
+      .buffer_size = (stream->write == file_ostream_write ? file_buffer_size(stream->backing) : COPY_MAX_BUFFER),
+   };
+   return copy_run(&copy, true);
 }
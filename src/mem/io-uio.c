@@ -33,9 +33,56 @@ mem_io_uio_read(const struct mem_io *io, void *ptr, const size_t offset, const s
    return (ret == (size_t)-1 ? 0 : ret);
 }
 
+static size_t
+mem_io_uio_batch(const struct mem_io *io, struct mem_io_batch *batch, const size_t n, ssize_t (*iofun)(pid_t, const struct iovec*, unsigned long, const struct iovec*, unsigned long, unsigned long))
+{
+   // transfer stops at the first entry that fails, so the rest are retried after it
+   size_t total = 0;
+   for (size_t i = 0; i < n;) {
+      struct iovec lio[64], rio[64];
+      const size_t count = (n - i > 64 ? 64 : n - i);
+      for (size_t j = 0; j < count; ++j) {
+         lio[j] = (struct iovec){ .iov_base = batch[i + j].ptr, .iov_len = batch[i + j].size };
+         rio[j] = (struct iovec){ .iov_base = (void*)(intptr_t)batch[i + j].offset, .iov_len = batch[i + j].size };
+      }
+
+      const ssize_t ret = iofun(io->pid, lio, count, rio, count, 0);
+      size_t left = (ret > 0 ? (size_t)ret : 0);
+      total += left;
+
+      size_t j = 0;
+      for (; j < count && left >= batch[i + j].size; left -= batch[i + j].size, ++j)
+         batch[i + j].done = batch[i + j].size;
+
+      if (j < count)
+         batch[i + j++].done = left;
+
+      i += j;
+   }
+   return total;
+}
+
+static size_t
+mem_io_uio_read_batch(const struct mem_io *io, struct mem_io_batch *batch, const size_t n)
+{
+   return mem_io_uio_batch(io, batch, n, process_vm_readv);
+}
+
+static size_t
+mem_io_uio_write_batch(const struct mem_io *io, struct mem_io_batch *batch, const size_t n)
+{
+   return mem_io_uio_batch(io, batch, n, process_vm_writev);
+}
+
 bool
 mem_io_uio_init(struct mem_io *io, const pid_t pid)
 {
-   *io = (struct mem_io){ .pid = pid, .read = mem_io_uio_read, .write = mem_io_uio_write };
+   *io = (struct mem_io){
+      .pid = pid,
+      .read = mem_io_uio_read,
+      .write = mem_io_uio_write,
+      .read_batch = mem_io_uio_read_batch,
+      .write_batch = mem_io_uio_write_batch
+   };
    return true;
 }
@@ -4,14 +4,47 @@
 #include <stdbool.h>
 #include <sys/types.h> // pid_t
 
+// One entry of a batched read or write, done is set to the number of bytes transferred
+struct mem_io_batch {
+   void *ptr;
+   size_t offset, size, done;
+};
+
+// read and write may be called from multiple threads with the same io
 struct mem_io {
    size_t (*read)(const struct mem_io *io, void *ptr, const size_t offset, const size_t size);
    size_t (*write)(const struct mem_io *io, const void *ptr, const size_t offset, const size_t size);
+   size_t (*read_batch)(const struct mem_io *io, struct mem_io_batch *batch, const size_t n); // optional
+   size_t (*write_batch)(const struct mem_io *io, struct mem_io_batch *batch, const size_t n); // optional
    void (*cleanup)(struct mem_io *io);
    void *backing;
    pid_t pid;
 };
 
+static inline size_t
+mem_io_read_batch(const struct mem_io *io, struct mem_io_batch *batch, const size_t n)
+{
+   if (io->read_batch)
+      return io->read_batch(io, batch, n);
+
+   size_t total = 0;
+   for (size_t i = 0; i < n; ++i)
+      total += (batch[i].done = io->read(io, batch[i].ptr, batch[i].offset, batch[i].size));
+   return total;
+}
+
+static inline size_t
+mem_io_write_batch(const struct mem_io *io, struct mem_io_batch *batch, const size_t n)
+{
+   if (io->write_batch)
+      return io->write_batch(io, batch, n);
+
+   size_t total = 0;
+   for (size_t i = 0; i < n; ++i)
+      total += (batch[i].done = io->write(io, batch[i].ptr, batch[i].offset, batch[i].size));
+   return total;
+}
+
 static inline void
 mem_io_release(struct mem_io *io)
 {
@@ -28,3 +61,7 @@ mem_io_uio_init(struct mem_io *io, const pid_t pid);
 
 bool
 mem_io_ptrace_init(struct mem_io *io, const pid_t pid);
+
+// Same as ptrace, but doesn't attach, for processes that are already stopped by other means (mem_freeze)
+bool
+mem_io_proc_mem_init(struct mem_io *io, const pid_t pid);
@@ -0,0 +1,46 @@
+#include "maps.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+bool
+mem_region_parse(struct mem_region *region, const char *line)
+{
+   *region = (struct mem_region){0};
+
+   int path = 0;
+   if (sscanf(line, "%zx-%zx %4s %zx %*s %*s %n", &region->start, &region->end, region->perms, &region->offset, &path) < 4 || region->start > region->end)
+      return false;
+
+   region->end = (region->end > 0 ? region->end - 1 : 0);
+   region->path = (path > 0 ? line + path : line + strlen(line));
+   return true;
+}
+
+bool
+mem_maps_for_each(const pid_t pid, bool (*cb)(const struct mem_region *region, const char *line, void *data), void *data)
+{
+   char path[128];
+   snprintf(path, sizeof(path), "/proc/%u/maps", pid);
+
+   FILE *f;
+   if (!(f = fopen(path, "rb"))) {
+      warn("fopen(%s)", path);
+      return false;
+   }
+
+   char *line = NULL;
+   size_t allocated = 0;
+   for (ssize_t len; (len = getline(&line, &allocated, f)) > 0;) {
+      line[len - (line[len - 1] == '\n')] = 0;
+
+      struct mem_region region;
+      if (mem_region_parse(&region, line) && !cb(&region, line, data))
+         break;
+   }
+
+   free(line);
+   fclose(f);
+   return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h> // pid_t
+
+// Line of /proc/<pid>/maps, end is inclusive like everywhere else in memutils
+struct mem_region {
+   size_t start, end, offset;
+   char perms[5];
+   const char *path; // points into the parsed line, empty for anonymous mappings
+};
+
+bool
+mem_region_parse(struct mem_region *region, const char *line);
+
+// Calls cb for every region of /proc/<pid>/maps, stops early if cb returns false
+bool
+mem_maps_for_each(const pid_t pid, bool (*cb)(const struct mem_region *region, const char *line, void *data), void *data);
@@ -0,0 +1,614 @@
+#include "symbols.h"
+#include "io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SYMBOLS_MAGIC "MEMSYMS1"
+
+struct header {
+   char magic[8];
+   uint64_t num_symbols, names_size;
+};
+
+// Either a mapped file, where positions are file offsets,
+// or a module in memory, where positions are relative to the module base
+struct image {
+   const unsigned char *file;
+   size_t file_size;
+   const struct mem_io *io;
+   size_t base;
+   Elf64_Ehdr ehdr;
+   uint64_t first_vaddr; // link address of offset 0
+   bool is64;
+};
+
+struct entry {
+   uint64_t address;
+   uint32_t size;
+   const char *name;
+};
+
+struct builder {
+   struct entry *entries;
+   size_t num_entries, allocated_entries;
+};
+
+static bool
+image_read(const struct image *image, void *dst, const uint64_t at, const size_t len)
+{
+   if (image->file) {
+      if (at > image->file_size || len > image->file_size - at)
+         return false;
+
+      memcpy(dst, image->file + at, len);
+      return true;
+   }
+
+   return (image->io->read(image->io, dst, image->base + at, len) == len);
+}
+
+static bool
+image_ehdr(struct image *image)
+{
+   const uint16_t endian = 1;
+   unsigned char ident[EI_NIDENT];
+   if (!image_read(image, ident, 0, sizeof(ident)) || memcmp(ident, ELFMAG, SELFMAG) ||
+       ident[EI_DATA] != (*(const unsigned char*)&endian ? ELFDATA2LSB : ELFDATA2MSB))
+      return false;
+
+   if ((image->is64 = (ident[EI_CLASS] == ELFCLASS64)))
+      return image_read(image, &image->ehdr, 0, sizeof(image->ehdr));
+
+   Elf32_Ehdr ehdr;
+   if (ident[EI_CLASS] != ELFCLASS32 || !image_read(image, &ehdr, 0, sizeof(ehdr)))
+      return false;
+
+   image->ehdr = (Elf64_Ehdr){
+      .e_type = ehdr.e_type, .e_phoff = ehdr.e_phoff, .e_shoff = ehdr.e_shoff,
+      .e_phentsize = ehdr.e_phentsize, .e_phnum = ehdr.e_phnum,
+      .e_shentsize = ehdr.e_shentsize, .e_shnum = ehdr.e_shnum, .e_shstrndx = ehdr.e_shstrndx,
+   };
+   return true;
+}
+
+static bool
+image_phdr(const struct image *image, const size_t i, Elf64_Phdr *phdr)
+{
+   const uint64_t at = image->ehdr.e_phoff + i * image->ehdr.e_phentsize;
+   if (image->is64)
+      return image_read(image, phdr, at, sizeof(*phdr));
+
+   Elf32_Phdr p;
+   if (!image_read(image, &p, at, sizeof(p)))
+      return false;
+
+   *phdr = (Elf64_Phdr){ .p_type = p.p_type, .p_offset = p.p_offset, .p_vaddr = p.p_vaddr, .p_filesz = p.p_filesz, .p_memsz = p.p_memsz };
+   return true;
+}
+
+static bool
+image_shdr(const struct image *image, const size_t i, Elf64_Shdr *shdr)
+{
+   const uint64_t at = image->ehdr.e_shoff + i * image->ehdr.e_shentsize;
+   if (image->is64)
+      return image_read(image, shdr, at, sizeof(*shdr));
+
+   Elf32_Shdr s;
+   if (!image_read(image, &s, at, sizeof(s)))
+      return false;
+
+   *shdr = (Elf64_Shdr){ .sh_type = s.sh_type, .sh_offset = s.sh_offset, .sh_size = s.sh_size, .sh_link = s.sh_link, .sh_entsize = s.sh_entsize };
+   return true;
+}
+
+static Elf64_Sym
+sym_at(const struct image *image, const unsigned char *p)
+{
+   Elf64_Sym sym;
+   if (image->is64) {
+      memcpy(&sym, p, sizeof(sym));
+      return sym;
+   }
+
+   Elf32_Sym s;
+   memcpy(&s, p, sizeof(s));
+   return (Elf64_Sym){ .st_name = s.st_name, .st_info = s.st_info, .st_shndx = s.st_shndx, .st_value = s.st_value, .st_size = s.st_size };
+}
+
+static bool
+image_init(struct image *image)
+{
+   // offset 0 is mapped by the first loadable segment
+   if (!image_ehdr(image))
+      return false;
+
+   for (size_t i = 0; i < image->ehdr.e_phnum; ++i) {
+      Elf64_Phdr phdr;
+      if (!image_phdr(image, i, &phdr))
+         return false;
+
+      if (phdr.p_type == PT_LOAD) {
+         image->first_vaddr = phdr.p_vaddr - phdr.p_offset;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static size_t
+image_build_id(const struct image *image, unsigned char *id, const size_t size)
+{
+   for (size_t i = 0; i < image->ehdr.e_phnum; ++i) {
+      Elf64_Phdr phdr;
+      if (!image_phdr(image, i, &phdr) || phdr.p_type != PT_NOTE || phdr.p_filesz > 4096)
+         continue;
+
+      unsigned char notes[4096];
+      if (!image_read(image, notes, (image->file ? phdr.p_offset : phdr.p_vaddr - image->first_vaddr), phdr.p_filesz))
+         continue;
+
+      // note headers are the same for both classes, name and desc are 4 byte aligned
+      for (size_t off = 0; off + sizeof(Elf64_Nhdr) <= phdr.p_filesz;) {
+         Elf64_Nhdr nhdr;
+         memcpy(&nhdr, notes + off, sizeof(nhdr));
+         const size_t name = off + sizeof(nhdr), desc = name + ((nhdr.n_namesz + 3) & ~3);
+         if (desc > phdr.p_filesz || nhdr.n_descsz > phdr.p_filesz - desc)
+            break;
+
+         if (nhdr.n_type == NT_GNU_BUILD_ID && nhdr.n_namesz == 4 && !memcmp(notes + name, "GNU", 4) && nhdr.n_descsz <= size) {
+            memcpy(id, notes + desc, nhdr.n_descsz);
+            return nhdr.n_descsz;
+         }
+
+         off = desc + ((nhdr.n_descsz + 3) & ~3);
+      }
+   }
+
+   return 0;
+}
+
+static void
+push_entry(struct builder *builder, const struct image *image, const Elf64_Sym *sym, const char *name)
+{
+   const unsigned char type = ELF64_ST_TYPE(sym->st_info);
+   if (sym->st_shndx == SHN_UNDEF || sym->st_shndx == SHN_ABS || !*name || sym->st_value < image->first_vaddr ||
+       (type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE && type != STT_GNU_IFUNC))
+      return;
+
+   const size_t step = 4096;
+   if (builder->num_entries >= builder->allocated_entries &&
+       !(builder->entries = realloc(builder->entries, sizeof(*builder->entries) * (builder->allocated_entries += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   builder->entries[builder->num_entries++] = (struct entry){
+      .address = sym->st_value - image->first_vaddr,
+      .size = (sym->st_size > UINT32_MAX ? UINT32_MAX : sym->st_size),
+      .name = name
+   };
+}
+
+static void
+push_table(struct builder *builder, const struct image *image, const unsigned char *syms, const size_t syms_size, const size_t entsize, const char *strs, const size_t strs_size)
+{
+   // strs must be nul terminated, entries smaller than a symbol come from a broken or hostile image
+   if (entsize < (image->is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym)))
+      return;
+
+   for (size_t off = 0; off + entsize <= syms_size; off += entsize) {
+      const Elf64_Sym sym = sym_at(image, syms + off);
+      if (sym.st_name < strs_size)
+         push_entry(builder, image, &sym, strs + sym.st_name);
+   }
+}
+
+static void
+collect_from_file(struct builder *builder, const struct image *image)
+{
+   // .symtab has everything .dynsym has, but stripped files only have .dynsym
+   for (size_t i = 0; i < image->ehdr.e_shnum; ++i) {
+      Elf64_Shdr shdr, strtab;
+      if (!image_shdr(image, i, &shdr) || (shdr.sh_type != SHT_SYMTAB && shdr.sh_type != SHT_DYNSYM) ||
+          !image_shdr(image, shdr.sh_link, &strtab) || strtab.sh_size == 0 ||
+          shdr.sh_offset > image->file_size || shdr.sh_size > image->file_size - shdr.sh_offset ||
+          strtab.sh_offset > image->file_size || strtab.sh_size > image->file_size - strtab.sh_offset ||
+          image->file[strtab.sh_offset + strtab.sh_size - 1] != 0)
+         continue;
+
+      push_table(builder, image, image->file + shdr.sh_offset, shdr.sh_size, shdr.sh_entsize,
+                 (const char*)image->file + strtab.sh_offset, strtab.sh_size);
+   }
+}
+
+static size_t
+gnu_hash_count(const struct image *image, const uint64_t at)
+{
+   // dynamic symbols past symoffset are chained by bucket, the last chain ends the table
+   uint32_t header[4]; // nbuckets, symoffset, bloom_size, bloom_shift
+   if (!image_read(image, header, at, sizeof(header)) || header[0] > 16 * 1024 * 1024)
+      return 0;
+
+   const uint64_t buckets_at = at + sizeof(header) + (uint64_t)header[2] * (image->is64 ? 8 : 4);
+   uint32_t *buckets;
+   if (!(buckets = calloc((size_t)header[0] + 1, sizeof(*buckets))))
+      err(EXIT_FAILURE, "calloc");
+
+   uint32_t last = 0;
+   if (image_read(image, buckets, buckets_at, (size_t)header[0] * sizeof(*buckets))) {
+      for (uint32_t i = 0; i < header[0]; ++i)
+         last = (buckets[i] > last ? buckets[i] : last);
+   }
+
+   free(buckets);
+
+   if (last < header[1])
+      return header[1];
+
+   const uint64_t chains_at = buckets_at + (uint64_t)header[0] * sizeof(uint32_t);
+   for (uint32_t chain[64];;) {
+      if (!image_read(image, chain, chains_at + (last - header[1]) * sizeof(uint32_t), sizeof(chain)))
+         return 0;
+
+      for (size_t i = 0; i < 64; ++i, ++last) {
+         if (chain[i] & 1)
+            return last + 1;
+      }
+   }
+}
+
+static void
+collect_from_memory(struct builder *builder, const struct image *image, char **strs_out, unsigned char **syms_out)
+{
+   // only the dynamic symbols are loaded, they are found through the dynamic section
+   Elf64_Phdr dynamic = {0};
+   for (size_t i = 0; i < image->ehdr.e_phnum && dynamic.p_type != PT_DYNAMIC; ++i) {
+      if (!image_phdr(image, i, &dynamic))
+         return;
+   }
+
+   if (dynamic.p_type != PT_DYNAMIC || dynamic.p_memsz > 64 * 1024)
+      return;
+
+   unsigned char *dyns;
+   if (!(dyns = malloc(dynamic.p_memsz + 1)))
+      err(EXIT_FAILURE, "malloc");
+
+   if (!image_read(image, dyns, dynamic.p_vaddr - image->first_vaddr, dynamic.p_memsz))
+      dynamic.p_memsz = 0;
+
+   // the dynamic loader relocates the pointers, except for modules it didn't load such as the vdso
+   uint64_t symtab = 0, strtab = 0, strsz = 0, syment = 0, hash = 0, gnu_hash = 0;
+   const size_t dynsz = (image->is64 ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn));
+   for (size_t off = 0; off + dynsz <= dynamic.p_memsz; off += dynsz) {
+      Elf64_Dyn dyn;
+      if (image->is64) {
+         memcpy(&dyn, dyns + off, sizeof(dyn));
+      } else {
+         Elf32_Dyn d;
+         memcpy(&d, dyns + off, sizeof(d));
+         dyn = (Elf64_Dyn){ .d_tag = d.d_tag, .d_un.d_val = d.d_un.d_val };
+      }
+
+      const uint64_t ptr = (dyn.d_un.d_ptr >= image->base ? dyn.d_un.d_ptr - image->base : dyn.d_un.d_ptr - image->first_vaddr);
+      switch (dyn.d_tag) {
+         case DT_SYMTAB: symtab = ptr; break;
+         case DT_STRTAB: strtab = ptr; break;
+         case DT_HASH: hash = ptr; break;
+         case DT_GNU_HASH: gnu_hash = ptr; break;
+         case DT_STRSZ: strsz = dyn.d_un.d_val; break;
+         case DT_SYMENT: syment = dyn.d_un.d_val; break;
+      }
+
+      if (dyn.d_tag == DT_NULL)
+         break;
+   }
+
+   free(dyns);
+
+   uint32_t nchain[2];
+   const size_t count = (hash && image_read(image, nchain, hash, sizeof(nchain)) ? nchain[1] : (gnu_hash ? gnu_hash_count(image, gnu_hash) : 0));
+   if (!symtab || !strtab || !strsz || !syment || syment > 1024 || !count || strsz > 256 * 1024 * 1024 || count > 16 * 1024 * 1024)
+      return;
+
+   if (!(*strs_out = malloc(strsz + 1)) || !(*syms_out = malloc(count * syment)))
+      err(EXIT_FAILURE, "malloc");
+
+   (*strs_out)[strsz] = 0;
+   if (image_read(image, *strs_out, strtab, strsz) && image_read(image, *syms_out, symtab, count * syment))
+      push_table(builder, image, *syms_out, count * syment, syment, *strs_out, strsz + 1);
+}
+
+static int
+entry_cmp(const void *a, const void *b)
+{
+   const struct entry *x = a, *y = b;
+   if (x->address != y->address)
+      return (x->address > y->address) - (x->address < y->address);
+   return strcmp(x->name, y->name);
+}
+
+struct by_name {
+   const char *name;
+   uint32_t index;
+};
+
+static int
+by_name_cmp(const void *a, const void *b)
+{
+   const struct by_name *x = a, *y = b;
+   const int r = strcmp(x->name, y->name);
+   return (r ? r : (x->index > y->index) - (x->index < y->index));
+}
+
+static void
+set_data(struct mem_symbols *symbols, void *data, const size_t size, const bool mapped)
+{
+   const struct header *header = data;
+   symbols->data = data;
+   symbols->data_size = size;
+   symbols->mapped = mapped;
+   symbols->num_symbols = header->num_symbols;
+   symbols->symbols = (const struct mem_symbol*)(header + 1);
+   symbols->by_name = (const uint32_t*)(symbols->symbols + header->num_symbols);
+   symbols->names = (const char*)(symbols->by_name + header->num_symbols);
+}
+
+static void
+build(struct mem_symbols *symbols, struct builder *builder)
+{
+   // sorted and deduplicated, .symtab and .dynsym share most of their symbols
+   qsort(builder->entries, builder->num_entries, sizeof(*builder->entries), entry_cmp);
+
+   size_t n = 0, names_size = 0;
+   for (size_t i = 0; i < builder->num_entries; ++i) {
+      if (n > 0 && !entry_cmp(&builder->entries[n - 1], &builder->entries[i]))
+         continue;
+
+      builder->entries[n++] = builder->entries[i];
+      names_size += strlen(builder->entries[i].name) + 1;
+   }
+
+   if (n > UINT32_MAX || names_size > UINT32_MAX)
+      n = names_size = 0;
+
+   const size_t size = sizeof(struct header) + n * (sizeof(struct mem_symbol) + sizeof(uint32_t)) + names_size;
+   struct header *header;
+   struct by_name *by_name;
+   if (!(header = malloc(size)) || !(by_name = malloc(sizeof(*by_name) * (n + 1))))
+      err(EXIT_FAILURE, "malloc");
+
+   *header = (struct header){ .num_symbols = n, .names_size = names_size };
+   memcpy(header->magic, SYMBOLS_MAGIC, sizeof(header->magic));
+   set_data(symbols, header, size, false);
+
+   struct mem_symbol *syms = (struct mem_symbol*)symbols->symbols;
+   char *names = (char*)symbols->names;
+   for (size_t i = 0, off = 0; i < n; ++i) {
+      const size_t len = strlen(builder->entries[i].name) + 1;
+      memcpy(names + off, builder->entries[i].name, len);
+      syms[i] = (struct mem_symbol){ .address = builder->entries[i].address, .name = off, .size = builder->entries[i].size };
+      by_name[i] = (struct by_name){ .name = names + off, .index = i };
+      off += len;
+   }
+
+   qsort(by_name, n, sizeof(*by_name), by_name_cmp);
+
+   uint32_t *indices = (uint32_t*)symbols->by_name;
+   for (size_t i = 0; i < n; ++i)
+      indices[i] = by_name[i].index;
+
+   free(by_name);
+}
+
+static bool
+cache_path(char *path, const size_t size, const unsigned char *id, const size_t id_len)
+{
+   const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+   int len;
+   if (xdg && *xdg) {
+      len = snprintf(path, size, "%s/memutils/symbols/", xdg);
+   } else if (home && *home) {
+      len = snprintf(path, size, "%s/.cache/memutils/symbols/", home);
+   } else {
+      return false;
+   }
+
+   for (size_t i = 0; len > 0 && (size_t)len + 3 < size && i < id_len; ++i)
+      len += snprintf(path + len, size - len, "%02x", id[i]);
+
+   return (len > 0 && (size_t)len + 1 < size);
+}
+
+static bool
+cache_load(struct mem_symbols *symbols, const char *path)
+{
+   int fd;
+   if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+      return false;
+
+   struct stat st;
+   void *data = MAP_FAILED;
+   if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct header))
+      data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+   close(fd);
+
+   if (data == MAP_FAILED)
+      return false;
+
+   // indices are checked once, so lookups can trust them
+   const struct header *header = data;
+   const size_t size = st.st_size;
+   if (memcmp(header->magic, SYMBOLS_MAGIC, sizeof(header->magic)) || header->num_symbols > UINT32_MAX || header->names_size > UINT32_MAX ||
+       size != sizeof(*header) + header->num_symbols * (sizeof(struct mem_symbol) + sizeof(uint32_t)) + header->names_size ||
+       (header->names_size > 0 && ((const char*)data)[size - 1] != 0))
+      goto fail;
+
+   set_data(symbols, data, size, true);
+   for (size_t i = 0; i < symbols->num_symbols; ++i) {
+      if (symbols->symbols[i].name >= header->names_size || symbols->by_name[i] >= header->num_symbols)
+         goto fail;
+   }
+
+   return true;
+
+fail:
+   munmap(data, size);
+   *symbols = (struct mem_symbols){0};
+   return false;
+}
+
+static void
+cache_store(const struct mem_symbols *symbols, const char *path)
+{
+   // best effort, written to a temporary first so readers never see a partial index
+   char dir[1024], tmp[1024 + 16];
+   snprintf(dir, sizeof(dir), "%s", path);
+   for (char *s = dir + 1; (s = strchr(s, '/')); ++s) {
+      *s = 0;
+      mkdir(dir, 0700);
+      *s = '/';
+   }
+
+   snprintf(tmp, sizeof(tmp), "%s.%u", path, (unsigned int)getpid());
+
+   int fd;
+   if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600)) == -1)
+      return;
+
+   const bool written = (write(fd, symbols->data, symbols->data_size) == (ssize_t)symbols->data_size);
+   close(fd);
+
+   if (!written || rename(tmp, path) != 0)
+      unlink(tmp);
+}
+
+static bool
+map_file(struct image *image, const char *path)
+{
+   int fd;
+   if (!path || path[0] != '/' || (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+      return false;
+
+   struct stat st;
+   void *file = MAP_FAILED;
+   if (fstat(fd, &st) == 0 && st.st_size > 0)
+      file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+   close(fd);
+
+   if (file == MAP_FAILED)
+      return false;
+
+   image->file = file;
+   image->file_size = st.st_size;
+   if (!image_init(image)) {
+      munmap(file, st.st_size);
+      image->file = NULL;
+      return false;
+   }
+
+   return true;
+}
+
+bool
+mem_symbols_load(struct mem_symbols *symbols, const char *path, const struct mem_io *io, const size_t base)
+{
+   *symbols = (struct mem_symbols){0};
+
+   struct image file = {0}, memory = { .io = io, .base = base };
+   const bool has_memory = (io && image_init(&memory)), has_file = map_file(&file, path);
+
+   // the file may have been replaced since it was mapped, memory wins if the build-ids differ
+   unsigned char id[64], file_id[64];
+   const size_t id_len = (has_memory ? image_build_id(&memory, id, sizeof(id)) : 0);
+   const size_t file_id_len = (has_file ? image_build_id(&file, file_id, sizeof(file_id)) : 0);
+   const bool use_file = (has_file && (!id_len || (id_len == file_id_len && !memcmp(id, file_id, id_len))));
+
+   char cache[1024];
+   const bool cached = (id_len || file_id_len) && cache_path(cache, sizeof(cache), (id_len ? id : file_id), (id_len ? id_len : file_id_len));
+   if (cached && cache_load(symbols, cache))
+      goto out;
+
+   struct builder builder = {0};
+   char *strs = NULL;
+   unsigned char *syms = NULL;
+   if (use_file) {
+      collect_from_file(&builder, &file);
+   } else if (has_memory) {
+      collect_from_memory(&builder, &memory, &strs, &syms);
+   }
+
+   if (builder.num_entries > 0) {
+      build(symbols, &builder);
+      // memory only has .dynsym, caching it would shadow the full .symtab index of the same build-id
+      if (cached && use_file)
+         cache_store(symbols, cache);
+   }
+
+   free(builder.entries);
+   free(strs);
+   free(syms);
+
+out:
+   if (has_file)
+      munmap((void*)file.file, file.file_size);
+
+   return (symbols->data != NULL);
+}
+
+const struct mem_symbol*
+mem_symbols_nearest(const struct mem_symbols *symbols, const size_t address)
+{
+   size_t lo = 0, hi = symbols->num_symbols;
+   while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (symbols->symbols[mid].address <= address) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+   return (lo > 0 ? &symbols->symbols[lo - 1] : NULL);
+}
+
+const struct mem_symbol*
+mem_symbols_find(const struct mem_symbols *symbols, const char *name)
+{
+   size_t lo = 0, hi = symbols->num_symbols;
+   while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (strcmp(symbols->names + symbols->symbols[symbols->by_name[mid]].name, name) < 0) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   if (lo < symbols->num_symbols && !strcmp(symbols->names + symbols->symbols[symbols->by_name[lo]].name, name))
+      return &symbols->symbols[symbols->by_name[lo]];
+
+   return NULL;
+}
+
+void
+mem_symbols_release(struct mem_symbols *symbols)
+{
+   if (!symbols)
+      return;
+
+   if (symbols->mapped) {
+      munmap(symbols->data, symbols->data_size);
+   } else {
+      free(symbols->data);
+   }
+
+   *symbols = (struct mem_symbols){0};
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct mem_io;
+
+// Symbol index of an ELF module, sorted by address and by name for O(log n) lookups both ways.
+// Symbols come from .symtab and .dynsym of the file when it's the one that is mapped,
+// otherwise from the dynamic symbols of the module in memory.
+// Indexes are cached by build-id under $XDG_CACHE_HOME/memutils/symbols, and are used straight from the mapped cache file.
+// Addresses are relative to the module base, that is the start of the region that maps offset 0 of the module.
+
+struct mem_symbol {
+   uint64_t address;
+   uint32_t name, size; // name is an offset to names
+};
+
+struct mem_symbols {
+   const struct mem_symbol *symbols; // by address
+   const uint32_t *by_name; // indices to symbols
+   const char *names;
+   size_t num_symbols;
+   void *data;
+   size_t data_size;
+   bool mapped;
+};
+
+// path may be NULL or not exist for modules that are only in memory, io may be NULL for modules that are only read from file
+bool
+mem_symbols_load(struct mem_symbols *symbols, const char *path, const struct mem_io *io, const size_t base);
+
+// Nearest symbol at or below address, returns NULL if there is none
+const struct mem_symbol*
+mem_symbols_nearest(const struct mem_symbols *symbols, const size_t address);
+
+// First symbol called name, returns NULL if there is none
+const struct mem_symbol*
+mem_symbols_find(const struct mem_symbols *symbols, const char *name);
+
+void
+mem_symbols_release(struct mem_symbols *symbols);
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include "mem/io.h"
+#include "mem/io-snapshot.h"
+#include "mem/maps.h"
+#include "manifest.h"
+#include "util.h"
+#include "bin.h"
+
+// Diff of two memory states by page hashes
+// Only pages with differing hashes are ever read, and only when both sides have bytes to compare,
+// so the cost follows the amount of changed memory rather than the total.
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr, "usage: %s [-o snapshot] [-n snapshot] old new\n"
+                   "       old and new are each a manifest written by region-rw, a snapshot or a pid\n"
+                   "       -o and -n give the bytes of a manifest side, so changes are found down to the byte\n"
+                   "       prints start-end kind length for every changed, added and removed range\n", argv0);
+   exit(EXIT_FAILURE);
+}
+
+#define BATCH_PAGES 64
+
+struct page {
+   uint64_t address, hash;
+};
+
+struct side {
+   struct page *pages;
+   size_t num_pages, allocated_pages;
+   struct mem_io io;
+   bool has_bytes;
+};
+
+enum kind {
+   KIND_NONE,
+   KIND_CHANGED,
+   KIND_ADDED,
+   KIND_REMOVED
+};
+
+struct run {
+   uint64_t start, end;
+   enum kind kind;
+};
+
+static struct {
+   struct side old, new;
+   struct run run;
+   size_t differing, fetched;
+} ctx;
+
+static void
+push_page(struct side *side, const uint64_t address, const uint64_t hash)
+{
+   const size_t step = 4096;
+   if (side->num_pages >= side->allocated_pages &&
+       !(side->pages = realloc(side->pages, sizeof(*side->pages) * (side->allocated_pages += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   side->pages[side->num_pages++] = (struct page){ .address = address, .hash = hash };
+}
+
+static void
+hash_region(struct side *side, const uint64_t start, const uint64_t size)
+{
+   uint64_t *hashes;
+   if (!(hashes = malloc(sizeof(*hashes) * (manifest_pages(size) + 1))))
+      err(EXIT_FAILURE, "malloc");
+
+   manifest_hash_region(&side->io, start, size, hashes);
+
+   for (uint64_t i = 0; i < manifest_pages(size); ++i)
+      push_page(side, start + i * MANIFEST_PAGE_SIZE, hashes[i]);
+
+   free(hashes);
+}
+
+static bool
+is_kernel_only(const char *path)
+{
+   // maps says these are readable, but process_vm_readv fails on them ([vvar], [vvar_vclock] and [vsyscall])
+   return (!strcmp(path, "[vsyscall]") || !strncmp(path, "[vvar", 5));
+}
+
+static bool
+pid_region_cb(const struct mem_region *region, const char *line, void *data)
+{
+   (void)line;
+   if (region->perms[0] == 'r' && !is_kernel_only(region->path))
+      hash_region(data, region->start, region->end - region->start + 1);
+   return true;
+}
+
+static void
+snapshot_region_cb(const char *line, void *data)
+{
+   struct mem_region region;
+   if (mem_region_parse(&region, line) && !is_kernel_only(region.path))
+      hash_region(data, region.start, region.end - region.start + 1);
+}
+
+static void
+load_manifest(struct side *side, FILE *f, const char *path)
+{
+   struct manifest_header header;
+   if (fread(&header, sizeof(header), 1, f) != 1 || header.page_size != MANIFEST_PAGE_SIZE)
+      errx(EXIT_FAILURE, "%s: not a manifest with %u byte pages", path, MANIFEST_PAGE_SIZE);
+
+   for (uint64_t r = 0; r < header.num_regions; ++r) {
+      struct manifest_region region;
+      if (fread(&region, sizeof(region), 1, f) != 1)
+         errx(EXIT_FAILURE, "%s: truncated manifest", path);
+
+      for (uint64_t i = 0; i < manifest_pages(region.size); ++i) {
+         uint64_t hash;
+         if (fread(&hash, sizeof(hash), 1, f) != 1)
+            errx(EXIT_FAILURE, "%s: truncated manifest", path);
+
+         push_page(side, region.start + i * MANIFEST_PAGE_SIZE, hash);
+      }
+   }
+}
+
+static bool
+is_pid(const char *arg)
+{
+   if (!*arg || arg[strspn(arg, "0123456789")])
+      return false;
+
+   char path[128];
+   snprintf(path, sizeof(path), "/proc/%s", arg);
+   return (access(path, F_OK) == 0);
+}
+
+static int
+page_cmp(const void *a, const void *b)
+{
+   const struct page *x = a, *y = b;
+   return (x->address > y->address) - (x->address < y->address);
+}
+
+static void
+load_side(struct side *side, const char *arg)
+{
+   if (is_pid(arg)) {
+      const pid_t pid = strtoull(arg, NULL, 10);
+      if (!mem_io_uio_init(&side->io, pid) || !mem_maps_for_each(pid, pid_region_cb, side))
+         exit(EXIT_FAILURE);
+
+      side->has_bytes = true;
+   } else {
+      FILE *f;
+      if (!(f = fopen(arg, "rb")))
+         err(EXIT_FAILURE, "fopen(%s)", arg);
+
+      char magic[8];
+      if (fread(magic, sizeof(magic), 1, f) != 1)
+         errx(EXIT_FAILURE, "%s: neither manifest nor snapshot", arg);
+
+      if (!memcmp(magic, MANIFEST_MAGIC, sizeof(magic))) {
+         rewind(f);
+         load_manifest(side, f, arg);
+      } else if (!memcmp(magic, MEM_SNAPSHOT_MAGIC, sizeof(magic))) {
+         if (!mem_io_snapshot_init(&side->io, arg))
+            exit(EXIT_FAILURE);
+
+         for_each_token_in_str(mem_io_snapshot_maps(&side->io), '\n', snapshot_region_cb, side);
+         side->has_bytes = true;
+      } else {
+         errx(EXIT_FAILURE, "%s: neither manifest nor snapshot", arg);
+      }
+
+      fclose(f);
+   }
+
+   qsort(side->pages, side->num_pages, sizeof(*side->pages), page_cmp);
+}
+
+static void
+flush_run(void)
+{
+   static const char *names[] = { "none", "changed", "added", "removed" };
+   if (ctx.run.kind != KIND_NONE)
+      printf("%" PRIx64 "-%" PRIx64 " %s %" PRIu64 "\n", ctx.run.start, ctx.run.end, names[ctx.run.kind], ctx.run.end - ctx.run.start);
+
+   ctx.run.kind = KIND_NONE;
+}
+
+static void
+emit(const enum kind kind, const uint64_t start, const uint64_t end)
+{
+   if (ctx.run.kind == kind && ctx.run.end == start) {
+      ctx.run.end = end;
+      return;
+   }
+
+   flush_run();
+   ctx.run = (struct run){ .start = start, .end = end, .kind = kind };
+}
+
+static void
+emit_byte_diffs(const uint64_t address, const unsigned char *a, const size_t a_len, const unsigned char *b, const size_t b_len)
+{
+   // bytes readable on only one side are changed as a whole
+   const size_t len = (a_len < b_len ? a_len : b_len);
+   for (size_t i = bin_mismatch(a, b, len), j; i < len; i = j + bin_mismatch(a + j, b + j, len - j)) {
+      for (j = i; j < len && a[j] != b[j]; ++j);
+      emit(KIND_CHANGED, address + i, address + j);
+   }
+
+   if (a_len != b_len)
+      emit(KIND_CHANGED, address + len, address + (a_len > b_len ? a_len : b_len));
+}
+
+static void
+compare_batch(const uint64_t *addresses, const size_t n, unsigned char *a, unsigned char *b)
+{
+   struct mem_io_batch batch_a[BATCH_PAGES], batch_b[BATCH_PAGES];
+   for (size_t i = 0; i < n; ++i) {
+      batch_a[i] = (struct mem_io_batch){ .ptr = a + i * MANIFEST_PAGE_SIZE, .offset = addresses[i], .size = MANIFEST_PAGE_SIZE };
+      batch_b[i] = (struct mem_io_batch){ .ptr = b + i * MANIFEST_PAGE_SIZE, .offset = addresses[i], .size = MANIFEST_PAGE_SIZE };
+   }
+
+   ctx.fetched += mem_io_read_batch(&ctx.old.io, batch_a, n);
+   ctx.fetched += mem_io_read_batch(&ctx.new.io, batch_b, n);
+
+   for (size_t i = 0; i < n; ++i)
+      emit_byte_diffs(addresses[i], a + i * MANIFEST_PAGE_SIZE, batch_a[i].done, b + i * MANIFEST_PAGE_SIZE, batch_b[i].done);
+}
+
+static void
+diff(void)
+{
+   const bool bytes = (ctx.old.has_bytes && ctx.new.has_bytes);
+   uint64_t pending[BATCH_PAGES];
+   size_t num_pending = 0;
+   unsigned char *a = NULL, *b = NULL;
+
+   if (bytes && (!(a = malloc(BATCH_PAGES * MANIFEST_PAGE_SIZE)) || !(b = malloc(BATCH_PAGES * MANIFEST_PAGE_SIZE))))
+      err(EXIT_FAILURE, "malloc");
+
+   for (size_t i = 0, j = 0; i < ctx.old.num_pages || j < ctx.new.num_pages;) {
+      const struct page *x = (i < ctx.old.num_pages ? &ctx.old.pages[i] : NULL), *y = (j < ctx.new.num_pages ? &ctx.new.pages[j] : NULL);
+
+      // pages are fetched in batches, pending ones go first so runs stay in address order
+      if (num_pending > 0 && (num_pending == BATCH_PAGES || !x || !y || x->address != y->address)) {
+         compare_batch(pending, num_pending, a, b);
+         num_pending = 0;
+      }
+
+      if (x && (!y || x->address < y->address)) {
+         emit(KIND_REMOVED, x->address, x->address + MANIFEST_PAGE_SIZE);
+         ++i;
+         continue;
+      }
+
+      if (y && (!x || y->address < x->address)) {
+         emit(KIND_ADDED, y->address, y->address + MANIFEST_PAGE_SIZE);
+         ++j;
+         continue;
+      }
+
+      if (x->hash != y->hash) {
+         ++ctx.differing;
+         if (bytes) {
+            pending[num_pending++] = x->address;
+         } else {
+            emit(KIND_CHANGED, x->address, x->address + MANIFEST_PAGE_SIZE);
+         }
+      }
+
+      ++i, ++j;
+   }
+
+   if (num_pending > 0)
+      compare_batch(pending, num_pending, a, b);
+
+   flush_run();
+   free(a);
+   free(b);
+}
+
+static void
+quit(void)
+{
+   mem_io_release(&ctx.old.io);
+   mem_io_release(&ctx.new.io);
+   free(ctx.old.pages);
+   free(ctx.new.pages);
+}
+
+int
+main(int argc, const char *argv[])
+{
+   const char *old_bytes = NULL, *new_bytes = NULL;
+   int arg = 1;
+   for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+      if (!strcmp(argv[arg], "-o")) {
+         old_bytes = argv[arg + 1];
+      } else if (!strcmp(argv[arg], "-n")) {
+         new_bytes = argv[arg + 1];
+      } else {
+         usage(argv[0]);
+      }
+   }
+
+   if (argc - arg < 2)
+      usage(argv[0]);
+
+   atexit(quit);
+   load_side(&ctx.old, argv[arg]);
+   load_side(&ctx.new, argv[arg + 1]);
+
+   if ((old_bytes && ctx.old.has_bytes) || (new_bytes && ctx.new.has_bytes))
+      errx(EXIT_FAILURE, "-o and -n are only for manifest sides");
+
+   if (old_bytes && !(ctx.old.has_bytes = mem_io_snapshot_init(&ctx.old.io, old_bytes)))
+      return EXIT_FAILURE;
+
+   if (new_bytes && !(ctx.new.has_bytes = mem_io_snapshot_init(&ctx.new.io, new_bytes)))
+      return EXIT_FAILURE;
+
+   diff();
+   warnx("%zu pages differ, fetched %zu bytes", ctx.differing, ctx.fetched);
+   return EXIT_SUCCESS;
+}
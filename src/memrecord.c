@@ -0,0 +1,549 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include "mem/io.h"
+#include "util.h"
+#include "bin.h"
+
+// Continuous sampling of small regions into a fixed size ring file
+// A sample is every entry read back to back with a single batched read per tick.
+// Samples are stored as xor against the previous sample, only the non-zero runs of it,
+// with a full keyframe every KEYFRAME_INTERVAL samples, so any sample still in the ring can be rebuilt.
+//
+// header | entries[num_entries] | data ring of records
+//
+// Record with len 0, or less than a record header left before the end, wraps to the start of the data ring.
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr, "usage: %s record pid ring size hz < entries\n"
+                   "       %s list ring\n"
+                   "       %s dump ring seq [entry]\n"
+                   "       entries are address size per line, or regions in /proc/<pid>/maps format\n"
+                   "       record samples entries of pid hz times a second into a ring file of size bytes until interrupted\n"
+                   "       dump writes the sample seq, or only its entry, to stdout\n", argv0, argv0, argv0);
+   exit(EXIT_FAILURE);
+}
+
+#define RING_MAGIC "MEMRING1"
+#define KEYFRAME_INTERVAL 256
+
+enum {
+   RECORD_KEYFRAME = 1,
+};
+
+struct ring_header {
+   char magic[8];
+   uint64_t file_size, data_offset, data_size;
+   uint64_t num_entries, sample_size, hz;
+   uint64_t first, head, num_records, next_seq; // first and head are offsets into the data ring
+};
+
+struct ring_entry {
+   uint64_t address, size;
+};
+
+struct ring_record {
+   uint32_t len, flags;
+   uint64_t seq, timestamp; // timestamp is CLOCK_REALTIME in ns
+};
+
+struct delta_run {
+   uint32_t offset, len;
+};
+
+static struct {
+   struct ring_header *header;
+   struct ring_entry *entries;
+   unsigned char *data;
+   size_t mapped;
+
+   struct mem_io io;
+   struct mem_io_batch *batch;
+   unsigned char *sample, *previous, *encoded;
+   size_t num_entries, allocated_entries;
+   volatile sig_atomic_t quit;
+} ctx;
+
+static size_t
+align8(const size_t len)
+{
+   return (len + 7) & ~(size_t)7;
+}
+
+static void
+entry_cb(const char *line, void *data)
+{
+   (void)data;
+   if (!*line || *line == '#')
+      return;
+
+   struct ring_entry entry;
+   const char *space = strchr(line, ' '), *dash = strchr(line, '-');
+   if (dash && (!space || dash < space)) {
+      struct region region;
+      if (!region_parse(&region, line))
+         return;
+
+      entry = (struct ring_entry){ .address = region.start, .size = region.end - region.start + 1 };
+   } else {
+      char *end;
+      entry.address = hexdecstrtoull(line, &end);
+      entry.size = (*end ? hexdecstrtoull(end + strspn(end, " \t"), NULL) : 0);
+   }
+
+   if (!entry.size) {
+      warnx("ignoring entry without size: %s", line);
+      return;
+   }
+
+   const size_t step = 64;
+   if (ctx.num_entries >= ctx.allocated_entries &&
+       !(ctx.entries = realloc(ctx.entries, sizeof(*ctx.entries) * (ctx.allocated_entries += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   ctx.entries[ctx.num_entries++] = entry;
+}
+
+static void
+ring_map(const char *path, const bool writable, const size_t size)
+{
+   int fd;
+   if ((fd = open(path, (writable ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY) | O_CLOEXEC, 0644)) == -1)
+      err(EXIT_FAILURE, "open(%s)", path);
+
+   struct stat st;
+   if (writable ? ftruncate(fd, size) != 0 : fstat(fd, &st) != 0)
+      err(EXIT_FAILURE, "%s", path);
+
+   ctx.mapped = (writable ? size : (size_t)st.st_size);
+   if (ctx.mapped < sizeof(*ctx.header))
+      errx(EXIT_FAILURE, "%s: not a ring", path);
+
+   void *map;
+   if ((map = mmap(NULL, ctx.mapped, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0)) == MAP_FAILED)
+      err(EXIT_FAILURE, "mmap(%s)", path);
+
+   close(fd);
+   ctx.header = map;
+}
+
+static struct ring_record*
+record_at(const uint64_t offset)
+{
+   // NULL for a wrap
+   if (offset + sizeof(struct ring_record) > ctx.header->data_size)
+      return NULL;
+
+   struct ring_record *record = (struct ring_record*)(ctx.data + offset);
+   return (record->len ? record : NULL);
+}
+
+static void
+ring_evict(const uint64_t lo, const uint64_t hi)
+{
+   // drops the oldest records while they start inside the space about to be written
+   while (ctx.header->num_records > 0) {
+      const struct ring_record *record;
+      if (!(record = record_at(ctx.header->first))) {
+         ctx.header->first = 0;
+         continue;
+      }
+
+      if (ctx.header->first < lo || ctx.header->first >= hi)
+         break;
+
+      ctx.header->first += record->len;
+      ctx.header->num_records--;
+   }
+}
+
+static void
+ring_append(const uint32_t flags, const uint64_t timestamp, const void *payload, const size_t len)
+{
+   const size_t size = align8(sizeof(struct ring_record) + len);
+   uint64_t at = ctx.header->head;
+
+   if (at + size > ctx.header->data_size) {
+      ring_evict(at, ctx.header->data_size);
+
+      if (at + sizeof(struct ring_record) <= ctx.header->data_size)
+         ((struct ring_record*)(ctx.data + at))->len = 0;
+
+      at = 0;
+   }
+
+   ring_evict(at, at + size);
+
+   if (!ctx.header->num_records)
+      ctx.header->first = at;
+
+   // the header is only updated once the record is complete, so readers never follow a torn one
+   struct ring_record *record = (struct ring_record*)(ctx.data + at);
+   *record = (struct ring_record){ .len = size, .flags = flags, .seq = ctx.header->next_seq, .timestamp = timestamp };
+   memcpy(record + 1, payload, len);
+
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+   ctx.header->head = at + size;
+   ctx.header->next_seq++;
+   ctx.header->num_records++;
+}
+
+static size_t
+delta_encode(const unsigned char *a, const unsigned char *b, const size_t len, unsigned char *out, const size_t cap)
+{
+   // runs of differing bytes, a run only ends on 8 equal bytes so tiny gaps don't cost a run header each
+   size_t w = 0;
+   for (size_t i = bin_mismatch(a, b, len); i < len;) {
+      size_t j = i + 1;
+      for (size_t same = 0; j < len && same < 8; ++j)
+         same = (a[j] == b[j] ? same + 1 : 0);
+
+      while (j > i && a[j - 1] == b[j - 1])
+         --j;
+
+      const struct delta_run run = { .offset = i, .len = j - i };
+      if (w + sizeof(run) + run.len > cap)
+         return cap + 1;
+
+      memcpy(out + w, &run, sizeof(run));
+      for (size_t k = 0; k < run.len; ++k)
+         out[w + sizeof(run) + k] = a[i + k] ^ b[i + k];
+
+      w += sizeof(run) + run.len;
+      i = j + bin_mismatch(a + j, b + j, len - j);
+   }
+   return w;
+}
+
+static bool
+delta_apply(unsigned char *sample, const size_t sample_size, const unsigned char *delta, const size_t len)
+{
+   // runs come from the ring, which may be torn by the recorder or corrupt, false if any run is out of bounds
+   for (size_t r = 0; r + sizeof(struct delta_run) <= len;) {
+      struct delta_run run;
+      memcpy(&run, delta + r, sizeof(run));
+      r += sizeof(run);
+
+      if ((size_t)run.offset + run.len > sample_size || run.len > len - r)
+         return false;
+
+      for (size_t k = 0; k < run.len; ++k)
+         sample[run.offset + k] ^= delta[r + k];
+
+      r += run.len;
+   }
+   return true;
+}
+
+static uint64_t
+now_realtime(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+take_sample(void)
+{
+   // unreadable bytes are stored as zero
+   mem_io_read_batch(&ctx.io, ctx.batch, ctx.num_entries);
+   for (size_t i = 0; i < ctx.num_entries; ++i) {
+      if (ctx.batch[i].done < ctx.batch[i].size)
+         memset((unsigned char*)ctx.batch[i].ptr + ctx.batch[i].done, 0, ctx.batch[i].size - ctx.batch[i].done);
+   }
+
+   const uint64_t timestamp = now_realtime(), seq = ctx.header->next_seq;
+   const size_t sample_size = ctx.header->sample_size;
+
+   size_t len;
+   if (seq % KEYFRAME_INTERVAL == 0 || (len = delta_encode(ctx.sample, ctx.previous, sample_size, ctx.encoded, sample_size)) > sample_size) {
+      ring_append(RECORD_KEYFRAME, timestamp, ctx.sample, sample_size);
+   } else {
+      ring_append(0, timestamp, ctx.encoded, len);
+   }
+
+   memcpy(ctx.previous, ctx.sample, sample_size);
+}
+
+static void
+sigterm(int sig)
+{
+   (void)sig;
+   ctx.quit = true;
+}
+
+static int
+record(const pid_t pid, const char *path, const size_t size, const uint64_t hz)
+{
+   for_each_token_in_file(stdin, '\n', entry_cb, NULL);
+
+   if (!ctx.num_entries)
+      errx(EXIT_FAILURE, "no entries to record");
+
+   if (!hz || hz > 1000000000)
+      errx(EXIT_FAILURE, "hz must be between 1 and 1000000000");
+
+   size_t sample_size = 0;
+   for (size_t i = 0; i < ctx.num_entries; ++i)
+      sample_size += ctx.entries[i].size;
+
+   // record lengths and delta run offsets are 32-bit
+   if (sample_size > UINT32_MAX - sizeof(struct ring_record))
+      errx(EXIT_FAILURE, "samples of %zu bytes are too large, the limit is 4 GiB", sample_size);
+
+   const size_t data_offset = align8(sizeof(struct ring_header) + sizeof(*ctx.entries) * ctx.num_entries);
+   if (size < data_offset || (size - data_offset) / 2 < align8(sizeof(struct ring_record) + sample_size))
+      errx(EXIT_FAILURE, "ring of %zu bytes can't hold two samples of %zu bytes", size, sample_size);
+
+   ring_map(path, true, size);
+   *ctx.header = (struct ring_header){
+      .file_size = size, .data_offset = data_offset, .data_size = size - data_offset,
+      .num_entries = ctx.num_entries, .sample_size = sample_size, .hz = hz,
+   };
+   memcpy(ctx.header->magic, RING_MAGIC, sizeof(ctx.header->magic));
+   memcpy((unsigned char*)ctx.header + sizeof(*ctx.header), ctx.entries, sizeof(*ctx.entries) * ctx.num_entries);
+   free(ctx.entries);
+   ctx.entries = (struct ring_entry*)((unsigned char*)ctx.header + sizeof(*ctx.header));
+   ctx.data = (unsigned char*)ctx.header + data_offset;
+
+   if (!(ctx.sample = calloc(1, sample_size)) || !(ctx.previous = calloc(1, sample_size)) ||
+       !(ctx.encoded = malloc(sample_size)) || !(ctx.batch = calloc(ctx.num_entries, sizeof(*ctx.batch))))
+      err(EXIT_FAILURE, "calloc");
+
+   for (size_t i = 0, off = 0; i < ctx.num_entries; off += ctx.entries[i++].size)
+      ctx.batch[i] = (struct mem_io_batch){ .ptr = ctx.sample + off, .offset = ctx.entries[i].address, .size = ctx.entries[i].size };
+
+   if (!mem_io_uio_init(&ctx.io, pid))
+      return EXIT_FAILURE;
+
+   int timer;
+   if ((timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) == -1)
+      err(EXIT_FAILURE, "timerfd_create");
+
+   const uint64_t interval = 1000000000 / hz;
+   const struct itimerspec spec = {
+      .it_interval = { .tv_sec = interval / 1000000000, .tv_nsec = interval % 1000000000 },
+      .it_value = { .tv_sec = interval / 1000000000, .tv_nsec = interval % 1000000000 },
+   };
+
+   if (timerfd_settime(timer, 0, &spec, NULL) != 0)
+      err(EXIT_FAILURE, "timerfd_settime");
+
+   signal(SIGINT, sigterm);
+   signal(SIGTERM, sigterm);
+
+   // expirations beyond one per read are ticks that were missed, the next sample is simply taken late
+   uint64_t samples = 0, missed = 0;
+   while (!ctx.quit) {
+      uint64_t expirations;
+      if (read(timer, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+         if (errno == EINTR)
+            continue;
+
+         err(EXIT_FAILURE, "read(timerfd)");
+      }
+
+      missed += expirations - 1;
+      take_sample();
+      ++samples;
+   }
+
+   close(timer);
+   warnx("recorded %" PRIu64 " samples, missed %" PRIu64 " ticks, %" PRIu64 " samples in the ring", samples, missed, ctx.header->num_records);
+   msync(ctx.header, ctx.mapped, MS_SYNC);
+   return EXIT_SUCCESS;
+}
+
+static void
+ring_open(const char *path)
+{
+   ring_map(path, false, 0);
+
+   const struct ring_header *header = ctx.header;
+   if (memcmp(header->magic, RING_MAGIC, sizeof(header->magic)) || header->file_size > ctx.mapped ||
+       header->data_offset + header->data_size > ctx.mapped || header->data_offset < sizeof(*header) + sizeof(*ctx.entries) * header->num_entries)
+      errx(EXIT_FAILURE, "%s: not a ring", path);
+
+   ctx.entries = (struct ring_entry*)((unsigned char*)ctx.header + sizeof(*ctx.header));
+   ctx.data = (unsigned char*)ctx.header + header->data_offset;
+}
+
+struct record_ref {
+   const struct ring_record *record;
+   uint64_t seq;
+};
+
+static size_t
+ring_records(struct record_ref **out)
+{
+   // a copy of the header, the recorder may be writing while we read
+   struct ring_header header;
+   memcpy(&header, ctx.header, sizeof(header));
+   __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+   struct record_ref *refs;
+   if (!(refs = calloc(header.num_records + 1, sizeof(*refs))))
+      err(EXIT_FAILURE, "calloc");
+
+   size_t n = 0;
+   for (uint64_t at = header.first; n < header.num_records;) {
+      const struct ring_record *record;
+      if (!(record = record_at(at))) {
+         at = 0;
+         continue;
+      }
+
+      if (record->len < sizeof(*record) || at + record->len > header.data_size || (n > 0 && record->seq != refs[n - 1].seq + 1))
+         break;
+
+      refs[n++] = (struct record_ref){ .record = record, .seq = record->seq };
+      at += record->len;
+   }
+
+   *out = refs;
+   return n;
+}
+
+static int
+list(void)
+{
+   struct record_ref *refs;
+   const size_t n = ring_records(&refs);
+
+   printf("# %" PRIu64 " entries, %" PRIu64 " bytes per sample at %" PRIu64 " hz\n", ctx.header->num_entries, ctx.header->sample_size, ctx.header->hz);
+   for (size_t i = 0; i < ctx.header->num_entries; ++i)
+      printf("# entry %zu: 0x%" PRIx64 " %" PRIu64 "\n", i, ctx.entries[i].address, ctx.entries[i].size);
+
+   // samples before the first keyframe lost theirs to the ring wrapping
+   bool keyed = false;
+   for (size_t i = 0; i < n; ++i) {
+      const struct ring_record *record = refs[i].record;
+      keyed = keyed || (record->flags & RECORD_KEYFRAME);
+      printf("%" PRIu64 " %" PRIu64 ".%09" PRIu64 " %s %zu%s\n", record->seq, record->timestamp / 1000000000, record->timestamp % 1000000000,
+             (record->flags & RECORD_KEYFRAME ? "key" : "delta"), record->len - sizeof(*record), (keyed ? "" : " unreachable"));
+   }
+
+   free(refs);
+   return EXIT_SUCCESS;
+}
+
+static int
+dump(const uint64_t seq, const bool has_entry, const size_t entry)
+{
+   if (has_entry && entry >= ctx.header->num_entries)
+      errx(EXIT_FAILURE, "entry %zu is out of range, ring has %" PRIu64 " entries", entry, ctx.header->num_entries);
+
+   struct record_ref *refs;
+   const size_t n = ring_records(&refs);
+
+   size_t target = n, key = n;
+   for (size_t i = 0; i < n && refs[i].seq <= seq; ++i) {
+      key = (refs[i].record->flags & RECORD_KEYFRAME ? i : key);
+      target = (refs[i].seq == seq ? i : target);
+   }
+
+   if (target == n)
+      errx(EXIT_FAILURE, "sample %" PRIu64 " is not in the ring", seq);
+
+   if (key == n)
+      errx(EXIT_FAILURE, "sample %" PRIu64 " is unreachable, its keyframe was overwritten", seq);
+
+   const size_t sample_size = ctx.header->sample_size;
+   unsigned char *sample;
+   if (!(sample = malloc(sample_size)))
+      err(EXIT_FAILURE, "malloc");
+
+   const uint32_t key_len = refs[key].record->len;
+   if (key_len < sizeof(*refs[key].record) + sample_size)
+      errx(EXIT_FAILURE, "sample %" PRIu64 " is corrupt or was overwritten while reading it", seq);
+
+   memcpy(sample, refs[key].record + 1, sample_size);
+   for (size_t i = key + 1; i <= target; ++i) {
+      const uint32_t len = refs[i].record->len;
+      if (len < sizeof(*refs[i].record) || !delta_apply(sample, sample_size, (const unsigned char*)(refs[i].record + 1), len - sizeof(*refs[i].record)))
+         errx(EXIT_FAILURE, "sample %" PRIu64 " is corrupt or was overwritten while reading it", seq);
+   }
+
+   // anything used may have been overwritten by the recorder meanwhile
+   for (size_t i = key; i <= target; ++i) {
+      if (refs[i].record->seq != refs[i].seq)
+         errx(EXIT_FAILURE, "sample %" PRIu64 " was overwritten while reading it", seq);
+   }
+
+   size_t off = 0, len = sample_size;
+   if (has_entry) {
+      for (size_t i = 0; i < entry; ++i)
+         off += ctx.entries[i].size;
+      len = ctx.entries[entry].size;
+   }
+
+   if (fwrite(sample + off, 1, len, stdout) != len)
+      err(EXIT_FAILURE, "fwrite");
+
+   free(sample);
+   free(refs);
+   return EXIT_SUCCESS;
+}
+
+static void
+quit(void)
+{
+   mem_io_release(&ctx.io);
+
+   // entries live in the ring once it's mapped
+   if (ctx.header) {
+      munmap(ctx.header, ctx.mapped);
+   } else {
+      free(ctx.entries);
+   }
+
+   free(ctx.batch);
+   free(ctx.sample);
+   free(ctx.previous);
+   free(ctx.encoded);
+}
+
+int
+main(int argc, const char *argv[])
+{
+   if (argc < 3)
+      usage(argv[0]);
+
+   atexit(quit);
+
+   if (!strcmp(argv[1], "record")) {
+      if (argc < 6)
+         usage(argv[0]);
+
+      return record(strtoull(argv[2], NULL, 10), argv[3], hexdecstrtoull(argv[4], NULL), hexdecstrtoull(argv[5], NULL));
+   }
+
+   if (!strcmp(argv[1], "list")) {
+      ring_open(argv[2]);
+      return list();
+   }
+
+   if (!strcmp(argv[1], "dump")) {
+      if (argc < 4)
+         usage(argv[0]);
+
+      ring_open(argv[2]);
+      return dump(hexdecstrtoull(argv[3], NULL), argc > 4, (argc > 4 ? hexdecstrtoull(argv[4], NULL) : 0));
+   }
+
+   usage(argv[0]);
+   return EXIT_FAILURE;
+}
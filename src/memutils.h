@@ -0,0 +1,21 @@
+#pragma once
+
+// libmemutils
+// Everything the memutils tools use to access memory of other processes, for use in-process.
+// Declarations here only change in backwards compatible ways within a major version.
+//
+// struct mem_io io;
+// if (!mem_io_uio_init(&io, pid))
+//    return false;
+// io.read(&io, buf, address, sizeof(buf));
+// mem_io_release(&io);
+
+#define MEMUTILS_VERSION_MAJOR 1
+#define MEMUTILS_VERSION_MINOR 2
+
+#include "mem/io.h"
+#include "mem/io-stream.h"
+#include "mem/io-snapshot.h"
+#include "mem/maps.h"
+#include "mem/freeze.h"
+#include "mem/symbols.h"
@@ -0,0 +1,720 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "mem/io.h"
+#include "mem/maps.h"
+#include "memutilsd.h"
+#include "util.h"
+#include "bin.h"
+
+// Sessions keep the backend, region table and a small page cache of a pid alive between requests.
+// Everything runs on a single thread, clients are served in turns from a poll loop.
+// Searches run a few chunks per turn, and clients with a full output buffer aren't read from until it drains.
+
+static void
+usage(const char *argv0)
+{
+   fprintf(stderr, "usage: %s socket\n"
+                   "       serves reads, writes and searches of process memory over a unix socket\n"
+                   "       protocol is described in memutilsd.h\n", argv0);
+   exit(EXIT_FAILURE);
+}
+
+#define PAGE_SIZE 4096
+#define CACHE_PAGES 256
+#define MAX_CLIENTS 64
+
+// output buffered for a client before its requests are put on hold, a single response may still go past this
+#define MAX_BUFFERED (4 * 1024 * 1024)
+
+// searches read this much per chunk and this many chunks per turn of the poll loop
+#define SEARCH_CHUNK (1024 * 1024)
+#define SEARCH_CHUNKS_PER_TURN 16
+
+struct buffer {
+   unsigned char *data;
+   size_t len, allocated;
+};
+
+struct session {
+   struct mem_io io;
+   struct mem_region *regions;
+   size_t num_regions, allocated_regions;
+   pid_t pid;
+
+   struct cache_page {
+      unsigned char data[PAGE_SIZE];
+      uint64_t page, stamp;
+      bool valid;
+   } *cache;
+};
+
+struct search {
+   struct buffer out; // addresses found so far, the response is only queued once the search ends
+   unsigned char *needle, *buf;
+   size_t next, end;
+   uint32_t id, needle_len, max_hits, hits;
+   pid_t pid;
+   bool active, all_regions;
+};
+
+struct client {
+   struct buffer in, out;
+   struct search search;
+   int fd;
+};
+
+static struct {
+   struct session *sessions;
+   size_t num_sessions, allocated_sessions;
+   struct client clients[MAX_CLIENTS];
+   size_t num_clients;
+   const char *path;
+   volatile sig_atomic_t quit;
+} ctx;
+
+static uint64_t
+now_ms(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void*
+buffer_reserve(struct buffer *buf, const size_t size)
+{
+   if (buf->len + size > buf->allocated) {
+      const size_t allocated = (buf->len + size > buf->allocated * 2 ? buf->len + size : buf->allocated * 2);
+      void *data;
+      if (!(data = realloc(buf->data, allocated)))
+         err(EXIT_FAILURE, "realloc");
+
+      buf->data = data;
+      buf->allocated = allocated;
+   }
+
+   void *ptr = buf->data + buf->len;
+   buf->len += size;
+   return ptr;
+}
+
+static void
+buffer_put(struct buffer *buf, const void *ptr, const size_t size)
+{
+   memcpy(buffer_reserve(buf, size), ptr, size);
+}
+
+static bool
+region_cb(const struct mem_region *region, const char *line, void *data)
+{
+   (void)line;
+   struct session *session = data;
+
+   const size_t step = 1024;
+   if (session->num_regions >= session->allocated_regions &&
+       !(session->regions = realloc(session->regions, sizeof(*session->regions) * (session->allocated_regions += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   // path points into the line, which doesn't outlive the callback
+   session->regions[session->num_regions] = *region;
+   session->regions[session->num_regions++].path = NULL;
+   return true;
+}
+
+static bool
+session_refresh_regions(struct session *session)
+{
+   session->num_regions = 0;
+   return mem_maps_for_each(session->pid, region_cb, session);
+}
+
+static void
+session_release(struct session *session)
+{
+   mem_io_release(&session->io);
+   free(session->regions);
+   free(session->cache);
+   *session = (struct session){0};
+}
+
+static struct session*
+session_find(const pid_t pid)
+{
+   for (size_t i = 0; i < ctx.num_sessions; ++i) {
+      if (ctx.sessions[i].pid == pid)
+         return &ctx.sessions[i];
+   }
+   return NULL;
+}
+
+static struct session*
+session_for_pid(const pid_t pid)
+{
+   struct session *found;
+   if ((found = session_find(pid)))
+      return found;
+
+   const size_t step = 16;
+   if (ctx.num_sessions >= ctx.allocated_sessions &&
+       !(ctx.sessions = realloc(ctx.sessions, sizeof(*ctx.sessions) * (ctx.allocated_sessions += step))))
+      err(EXIT_FAILURE, "realloc");
+
+   struct session *session = &ctx.sessions[ctx.num_sessions];
+   *session = (struct session){ .pid = pid };
+
+   if (!(session->cache = calloc(CACHE_PAGES, sizeof(*session->cache))))
+      err(EXIT_FAILURE, "calloc");
+
+   if (!mem_io_uio_init(&session->io, pid) || !session_refresh_regions(session)) {
+      session_release(session);
+      return NULL;
+   }
+
+   ctx.num_sessions++;
+   return session;
+}
+
+static void
+session_close(const pid_t pid)
+{
+   for (size_t i = 0; i < ctx.num_sessions; ++i) {
+      if (ctx.sessions[i].pid != pid)
+         continue;
+
+      session_release(&ctx.sessions[i]);
+      ctx.sessions[i] = ctx.sessions[--ctx.num_sessions];
+      return;
+   }
+}
+
+static size_t
+session_read_cached(struct session *session, unsigned char *ptr, const size_t address, const size_t size, const uint64_t max_age)
+{
+   // whole pages are cached, anything that can't be read as a whole page is read directly
+   const uint64_t now = now_ms();
+   size_t done = 0;
+   while (done < size) {
+      const size_t page = (address + done) & ~(size_t)(PAGE_SIZE - 1), off = address + done - page;
+      const size_t len = (PAGE_SIZE - off > size - done ? size - done : PAGE_SIZE - off);
+      struct cache_page *cached = &session->cache[(page / PAGE_SIZE) % CACHE_PAGES];
+
+      if (!cached->valid || cached->page != page || now - cached->stamp > max_age) {
+         if (session->io.read(&session->io, cached->data, page, PAGE_SIZE) != PAGE_SIZE) {
+            cached->valid = false;
+            return done + session->io.read(&session->io, ptr + done, address + done, size - done);
+         }
+
+         cached->page = page;
+         cached->stamp = now;
+         cached->valid = true;
+      }
+
+      memcpy(ptr + done, cached->data + off, len);
+      done += len;
+   }
+   return done;
+}
+
+static void
+session_invalidate(struct session *session, const size_t address, const size_t size)
+{
+   for (size_t page = address & ~(size_t)(PAGE_SIZE - 1); page < address + size; page += PAGE_SIZE) {
+      struct cache_page *cached = &session->cache[(page / PAGE_SIZE) % CACHE_PAGES];
+      cached->valid = (cached->valid && cached->page != page);
+   }
+}
+
+struct reader {
+   const unsigned char *data;
+   size_t len, pos;
+};
+
+static bool
+take(struct reader *r, void *ptr, const size_t size)
+{
+   if (r->len - r->pos < size)
+      return false;
+
+   memcpy(ptr, r->data + r->pos, size);
+   r->pos += size;
+   return true;
+}
+
+struct entry {
+   uint64_t address;
+   uint32_t size;
+};
+
+static bool
+take_entries(struct reader *r, struct entry **out, uint32_t *count, size_t *total)
+{
+   if (!take(r, count, sizeof(*count)) || *count > (r->len - r->pos) / (sizeof(uint64_t) + sizeof(uint32_t)))
+      return false;
+
+   if (!(*out = malloc(sizeof(**out) * (*count ? *count : 1))))
+      err(EXIT_FAILURE, "malloc");
+
+   *total = 0;
+   for (uint32_t i = 0; i < *count; ++i) {
+      if (!take(r, &(*out)[i].address, sizeof((*out)[i].address)) || !take(r, &(*out)[i].size, sizeof((*out)[i].size)))
+         return false;
+      *total += (*out)[i].size;
+   }
+
+   return (*total <= MEMUTILSD_MAX_PAYLOAD);
+}
+
+static uint8_t
+handle_read(struct session *session, struct reader *r, struct buffer *out)
+{
+   uint32_t max_age, count;
+   size_t total;
+   struct entry *entries = NULL;
+   if (!take(r, &max_age, sizeof(max_age)) || !take_entries(r, &entries, &count, &total)) {
+      free(entries);
+      return MEMUTILSD_BAD_REQUEST;
+   }
+
+   // done counts first, data is compacted after them once the sizes are known
+   const size_t header = out->len;
+   uint32_t *done = buffer_reserve(out, sizeof(*done) * count);
+   unsigned char *data = buffer_reserve(out, total);
+   done = (uint32_t*)(out->data + header);
+
+   if (max_age) {
+      for (uint32_t i = 0, off = 0; i < count; off += entries[i++].size)
+         done[i] = session_read_cached(session, data + off, entries[i].address, entries[i].size, max_age);
+   } else {
+      struct mem_io_batch *batch;
+      if (!(batch = malloc(sizeof(*batch) * (count ? count : 1))))
+         err(EXIT_FAILURE, "malloc");
+
+      for (uint32_t i = 0, off = 0; i < count; off += entries[i++].size)
+         batch[i] = (struct mem_io_batch){ .ptr = data + off, .offset = entries[i].address, .size = entries[i].size };
+
+      mem_io_read_batch(&session->io, batch, count);
+
+      for (uint32_t i = 0; i < count; ++i)
+         done[i] = batch[i].done;
+
+      free(batch);
+   }
+
+   size_t w = 0;
+   for (uint32_t i = 0, off = 0; i < count; off += entries[i++].size) {
+      memmove(data + w, data + off, done[i]);
+      w += done[i];
+   }
+
+   out->len -= total - w;
+   free(entries);
+   return MEMUTILSD_OK;
+}
+
+static uint8_t
+handle_write(struct session *session, struct reader *r, struct buffer *out)
+{
+   uint32_t count;
+   size_t total;
+   struct entry *entries = NULL;
+   if (!take_entries(r, &entries, &count, &total) || r->len - r->pos < total) {
+      free(entries);
+      return MEMUTILSD_BAD_REQUEST;
+   }
+
+   struct mem_io_batch *batch;
+   if (!(batch = malloc(sizeof(*batch) * (count ? count : 1))))
+      err(EXIT_FAILURE, "malloc");
+
+   for (uint32_t i = 0, off = 0; i < count; off += entries[i++].size) {
+      batch[i] = (struct mem_io_batch){ .ptr = (void*)(r->data + r->pos + off), .offset = entries[i].address, .size = entries[i].size };
+      session_invalidate(session, entries[i].address, entries[i].size);
+   }
+
+   mem_io_write_batch(&session->io, batch, count);
+
+   for (uint32_t i = 0; i < count; ++i) {
+      const uint32_t done = batch[i].done;
+      buffer_put(out, &done, sizeof(done));
+   }
+
+   free(batch);
+   free(entries);
+   return MEMUTILSD_OK;
+}
+
+static size_t
+search_chunk(struct session *session, struct search *search, const size_t off, const size_t end)
+{
+   // returns where the next chunk starts, or 0 once the range is done
+   const size_t span = end - off, overlap = search->needle_len - 1;
+   const size_t len = (span >= SEARCH_CHUNK + overlap ? SEARCH_CHUNK + overlap : span + 1);
+   const size_t rd = session->io.read(&session->io, search->buf, off, len);
+
+   // matches in the overlap are found by the next chunk
+   const unsigned char *buf = search->buf;
+   for (const unsigned char *s = buf, *m; search->hits < search->max_hits && s < buf + rd && (m = bin_search(s, rd - (s - buf), search->needle, search->needle_len)) && (size_t)(m - buf) < SEARCH_CHUNK; s = m + 1) {
+      const uint64_t address = off + (m - buf);
+      buffer_put(&search->out, &address, sizeof(address));
+      ++search->hits;
+   }
+
+   return (rd < len || span < SEARCH_CHUNK ? 0 : off + SEARCH_CHUNK);
+}
+
+static const struct mem_region*
+readable_region_from(const struct session *session, const size_t address)
+{
+   for (size_t i = 0; i < session->num_regions; ++i) {
+      if (session->regions[i].perms[0] == 'r' && session->regions[i].end >= address)
+         return &session->regions[i];
+   }
+   return NULL;
+}
+
+static void
+search_end(struct client *client, const uint8_t status)
+{
+   struct search *search = &client->search;
+   const uint32_t len = (status == MEMUTILSD_OK ? sizeof(search->hits) + search->out.len : 0);
+   const struct memutilsd_response res = { .id = search->id, .op = MEMUTILSD_SEARCH, .status = status, .len = len };
+   buffer_put(&client->out, &res, sizeof(res));
+
+   if (status == MEMUTILSD_OK) {
+      buffer_put(&client->out, &search->hits, sizeof(search->hits));
+      buffer_put(&client->out, search->out.data, search->out.len);
+   }
+
+   free(search->out.data);
+   free(search->needle);
+   free(search->buf);
+   *search = (struct search){0};
+}
+
+static void
+search_step(struct client *client)
+{
+   // the session is looked up every turn, as other clients may close it or grow the session table
+   struct search *search = &client->search;
+   struct session *session;
+   if (!(session = session_find(search->pid))) {
+      search_end(client, MEMUTILSD_NO_SESSION);
+      return;
+   }
+
+   bool done = false;
+   for (size_t n = 0; n < SEARCH_CHUNKS_PER_TURN && !done && search->hits < search->max_hits; ++n) {
+      size_t end = search->end;
+      if (search->all_regions) {
+         const struct mem_region *region;
+         if (!(region = readable_region_from(session, search->next))) {
+            done = true;
+            break;
+         }
+
+         search->next = (region->start > search->next ? region->start : search->next);
+         end = region->end;
+      }
+
+      const size_t next = search_chunk(session, search, search->next, end);
+      if (next) {
+         search->next = next;
+      } else if (search->all_regions && end != (size_t)~0) {
+         search->next = end + 1;
+      } else {
+         done = true;
+      }
+   }
+
+   if (done || search->hits >= search->max_hits)
+      search_end(client, MEMUTILSD_OK);
+}
+
+static uint8_t
+search_begin(struct client *client, const struct memutilsd_request *req, struct reader *r)
+{
+   uint64_t start, end;
+   uint32_t max_hits, needle_len;
+   if (!take(r, &start, sizeof(start)) || !take(r, &end, sizeof(end)) || !take(r, &max_hits, sizeof(max_hits)) ||
+       !take(r, &needle_len, sizeof(needle_len)) || !needle_len || r->len - r->pos < needle_len)
+      return MEMUTILSD_BAD_REQUEST;
+
+   // hits are capped so the response fits in a payload
+   const uint32_t hits_cap = (MEMUTILSD_MAX_PAYLOAD - sizeof(uint32_t)) / sizeof(uint64_t);
+   struct search *search = &client->search;
+   *search = (struct search){
+      .next = start, .end = end, .id = req->id, .needle_len = needle_len, .max_hits = (max_hits > hits_cap ? hits_cap : max_hits),
+      .pid = req->pid, .active = true, .all_regions = (!start && !end),
+   };
+
+   if (!(search->needle = malloc(needle_len)) || !(search->buf = malloc(SEARCH_CHUNK + needle_len)))
+      err(EXIT_FAILURE, "malloc");
+
+   memcpy(search->needle, r->data + r->pos, needle_len);
+
+   // an empty range ends on the first turn without hits
+   if (start > end)
+      search->max_hits = 0;
+
+   return MEMUTILSD_OK;
+}
+
+static uint8_t
+handle_maps(struct session *session, struct buffer *out)
+{
+   session_refresh_regions(session);
+
+   char path[128];
+   snprintf(path, sizeof(path), "/proc/%u/maps", session->pid);
+
+   FILE *f;
+   if (!(f = fopen(path, "rb")))
+      return MEMUTILSD_NO_SESSION;
+
+   size_t rd;
+   do {
+      rd = fread(buffer_reserve(out, 4096), 1, 4096, f);
+      out->len -= 4096 - rd;
+   } while (rd > 0);
+
+   fclose(f);
+   return MEMUTILSD_OK;
+}
+
+static void
+handle_request(struct client *client, const struct memutilsd_request *req, const unsigned char *payload)
+{
+   struct buffer *out = &client->out;
+   const size_t header_at = out->len;
+   struct memutilsd_response res = { .id = req->id, .op = req->op };
+   buffer_reserve(out, sizeof(res));
+
+   struct reader r = { .data = payload, .len = req->len };
+   struct session *session = NULL;
+   if (req->op == MEMUTILSD_CLOSE) {
+      session_close(req->pid);
+   } else if (!(session = session_for_pid(req->pid))) {
+      res.status = MEMUTILSD_NO_SESSION;
+   } else {
+      switch (req->op) {
+         case MEMUTILSD_READ: res.status = handle_read(session, &r, out); break;
+         case MEMUTILSD_WRITE: res.status = handle_write(session, &r, out); break;
+         case MEMUTILSD_SEARCH:
+            // answered once the search ends, which takes as many turns as it needs
+            if ((res.status = search_begin(client, req, &r)) == MEMUTILSD_OK) {
+               out->len = header_at;
+               return;
+            }
+            break;
+         case MEMUTILSD_MAPS: res.status = handle_maps(session, out); break;
+         default: res.status = MEMUTILSD_BAD_REQUEST; break;
+      }
+   }
+
+   // failed requests have no payload
+   if (res.status != MEMUTILSD_OK)
+      out->len = header_at + sizeof(res);
+
+   res.len = out->len - header_at - sizeof(res);
+   memcpy(out->data + header_at, &res, sizeof(res));
+}
+
+static bool
+client_process(struct client *client)
+{
+   // every complete request in the input is answered, which is what makes pipelining work
+   // the rest waits while a search runs or the output is full, so responses stay in order and memory bounded
+   size_t pos = 0;
+   while (!client->search.active && client->out.len < MAX_BUFFERED && client->in.len - pos >= sizeof(struct memutilsd_request)) {
+      struct memutilsd_request req;
+      memcpy(&req, client->in.data + pos, sizeof(req));
+
+      if (req.len > MEMUTILSD_MAX_PAYLOAD) {
+         const struct memutilsd_response res = { .id = req.id, .op = req.op, .status = MEMUTILSD_TOO_LARGE };
+         buffer_put(&client->out, &res, sizeof(res));
+         return false;
+      }
+
+      if (client->in.len - pos - sizeof(req) < req.len)
+         break;
+
+      handle_request(client, &req, client->in.data + pos + sizeof(req));
+      pos += sizeof(req) + req.len;
+   }
+
+   memmove(client->in.data, client->in.data + pos, client->in.len - pos);
+   client->in.len -= pos;
+   return true;
+}
+
+static bool
+client_flush(struct client *client)
+{
+   while (client->out.len > 0) {
+      const ssize_t wr = send(client->fd, client->out.data, client->out.len, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (wr < 0)
+         return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+
+      memmove(client->out.data, client->out.data + wr, client->out.len - wr);
+      client->out.len -= wr;
+   }
+   return true;
+}
+
+static void
+client_close(const size_t i)
+{
+   close(ctx.clients[i].fd);
+   free(ctx.clients[i].search.out.data);
+   free(ctx.clients[i].search.needle);
+   free(ctx.clients[i].search.buf);
+   free(ctx.clients[i].in.data);
+   free(ctx.clients[i].out.data);
+   ctx.clients[i] = ctx.clients[--ctx.num_clients];
+}
+
+static void
+client_accept(const int listener)
+{
+   int fd;
+   if ((fd = accept(listener, NULL, NULL)) == -1) {
+      warn("accept");
+      return;
+   }
+
+   if (ctx.num_clients >= MAX_CLIENTS) {
+      warnx("too many clients, dropping connection");
+      close(fd);
+      return;
+   }
+
+   fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+   ctx.clients[ctx.num_clients++] = (struct client){ .fd = fd };
+}
+
+static bool
+client_read(struct client *client)
+{
+   const size_t step = 64 * 1024;
+   unsigned char *ptr = buffer_reserve(&client->in, step);
+   const ssize_t rd = recv(client->fd, ptr, step, 0);
+   client->in.len -= step - (rd > 0 ? (size_t)rd : 0);
+
+   return !(rd == 0 || (rd < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR));
+}
+
+static bool
+client_is_busy(const struct client *client)
+{
+   return (client->search.active || client->out.len >= MAX_BUFFERED);
+}
+
+static void
+quit(void)
+{
+   for (size_t i = 0; i < ctx.num_sessions; ++i)
+      session_release(&ctx.sessions[i]);
+
+   while (ctx.num_clients > 0)
+      client_close(ctx.num_clients - 1);
+
+   free(ctx.sessions);
+
+   if (ctx.path)
+      unlink(ctx.path);
+}
+
+static void
+sigterm(int sig)
+{
+   (void)sig;
+   ctx.quit = true;
+}
+
+int
+main(int argc, const char *argv[])
+{
+   if (argc < 2)
+      usage(argv[0]);
+
+   struct sockaddr_un addr = { .sun_family = AF_UNIX };
+   if (strlen(argv[1]) >= sizeof(addr.sun_path))
+      errx(EXIT_FAILURE, "socket path is too long");
+
+   strcpy(addr.sun_path, argv[1]);
+
+   int listener;
+   if ((listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+      err(EXIT_FAILURE, "socket");
+
+   // anyone who can connect can read and write memory of our targets, so only the owner may
+   umask(077);
+   unlink(argv[1]);
+   if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+      err(EXIT_FAILURE, "bind(%s)", argv[1]);
+
+   if (listen(listener, MAX_CLIENTS) != 0)
+      err(EXIT_FAILURE, "listen");
+
+   ctx.path = argv[1];
+   atexit(quit);
+   signal(SIGINT, sigterm);
+   signal(SIGTERM, sigterm);
+   signal(SIGPIPE, SIG_IGN);
+
+   while (!ctx.quit) {
+      // busy clients aren't read from, running searches keep the loop from sleeping
+      struct pollfd fds[MAX_CLIENTS + 1];
+      fds[0] = (struct pollfd){ .fd = listener, .events = POLLIN };
+      bool searching = false;
+      for (size_t i = 0; i < ctx.num_clients; ++i) {
+         const struct client *client = &ctx.clients[i];
+         fds[i + 1] = (struct pollfd){ .fd = client->fd, .events = (client_is_busy(client) ? 0 : POLLIN) | (client->out.len ? POLLOUT : 0) };
+         searching = (searching || client->search.active);
+      }
+
+      const size_t num_clients = ctx.num_clients;
+      if (poll(fds, num_clients + 1, (searching ? 0 : -1)) < 0) {
+         if (errno == EINTR)
+            continue;
+
+         err(EXIT_FAILURE, "poll");
+      }
+
+      // backwards, so closing a client doesn't move the ones not yet looked at
+      for (size_t i = num_clients; i > 0; --i) {
+         struct client *client = &ctx.clients[i - 1];
+         const short revents = fds[i].revents;
+         bool ok = true;
+
+         if (revents & (POLLIN | POLLHUP | POLLERR))
+            ok = client_read(client);
+
+         if (ok && client->search.active)
+            search_step(client);
+
+         if (ok)
+            ok = client_process(client);
+
+         if (!client_flush(client) || !ok)
+            client_close(i - 1);
+      }
+
+      if (fds[0].revents & POLLIN)
+         client_accept(listener);
+   }
+
+   close(listener);
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+// memutilsd protocol
+// Every message is a header followed by len bytes of payload, integers are in host byte order.
+// Requests are answered in the order they were sent, so clients can pipeline as many as they like.
+//
+// MEMUTILSD_READ    max_age_ms:u32 count:u32 { address:u64 size:u32 } * count
+//                   -> { done:u32 } * count, data of every entry back to back (done bytes each)
+//                   max_age_ms > 0 allows serving pages from the session cache that are at most that old
+// MEMUTILSD_WRITE   count:u32 { address:u64 size:u32 } * count, data of every entry back to back
+//                   -> { done:u32 } * count
+// MEMUTILSD_SEARCH  start:u64 end:u64 max_hits:u32 needle_len:u32 needle
+//                   -> count:u32 { address:u64 } * count
+//                   start and end of 0 searches every readable region of the session
+// MEMUTILSD_MAPS    -> /proc/<pid>/maps as text, also refreshes the region table of the session
+// MEMUTILSD_CLOSE   -> nothing, drops the session of pid
+
+#define MEMUTILSD_MAX_PAYLOAD (16 * 1024 * 1024)
+
+enum memutilsd_op {
+   MEMUTILSD_READ = 1,
+   MEMUTILSD_WRITE,
+   MEMUTILSD_SEARCH,
+   MEMUTILSD_MAPS,
+   MEMUTILSD_CLOSE,
+};
+
+enum memutilsd_status {
+   MEMUTILSD_OK,
+   MEMUTILSD_BAD_REQUEST,
+   MEMUTILSD_NO_SESSION,
+   MEMUTILSD_TOO_LARGE,
+};
+
+struct memutilsd_request {
+   uint32_t len, id, pid;
+   uint8_t op, reserved[3];
+};
+
+struct memutilsd_response {
+   uint32_t len, id;
+   uint8_t op, status, reserved[2];
+};
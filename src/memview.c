@@ -1,4 +1,5 @@
 #include <unistd.h>
+#include <fcntl.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
@@ -10,9 +11,17 @@
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include <errno.h>
+#include <pthread.h>
 #include "mem/io.h"
+#include "mem/io-snapshot.h"
+#include "mem/maps.h"
+#include "mem/symbols.h"
 #include "util.h"
+#include "bin.h"
+#include "hex.h"
 
 // Some of this based on this nice essay: http://xn--rpa.cc/essays/term
 
@@ -47,11 +56,53 @@
 #define ESCA "\x1b["
 #define FMT(f) ESCA f "m"
 
+// Cell attributes, each one resets the previous so switching is always a single SGR
+enum attr {
+   ATTR_PLAIN,
+   ATTR_REVERSE,
+   ATTR_YELLOW,
+   ATTR_RED,
+   ATTR_CYAN,
+   ATTR_FADE_0,
+   ATTR_FADE_1,
+   ATTR_FADE_2,
+   ATTR_DIFF,
+};
+
+static const char *attr_sgr[] = {
+   [ATTR_PLAIN] = FMT(PLAIN),
+   [ATTR_REVERSE] = FMT(PLAIN ";" REVERSE),
+   [ATTR_YELLOW] = FMT(PLAIN ";" FG YELLOW),
+   [ATTR_RED] = FMT(PLAIN ";" FG RED),
+   [ATTR_CYAN] = FMT(PLAIN ";" FG CYAN),
+   [ATTR_FADE_0] = FMT(PLAIN ";" FG MAGNETA),
+   [ATTR_FADE_1] = FMT(PLAIN ";" FG RED),
+   [ATTR_FADE_2] = FMT(PLAIN ";" BR_FG RED),
+   [ATTR_DIFF] = FMT(PLAIN ";" BG RED ";" FG WHITE),
+};
+
+// live refresh rate limits, and how long changed bytes stay highlighted
+#define MIN_HZ 0.1
+#define MAX_HZ 240.0
+#define FADE_SECONDS 0.75
+
+// frames are paced to at least this rate, or the live refresh rate if it's higher
+#define FRAME_HZ 60.0
+
+struct cell {
+   char glyph[4]; // utf8, nul terminated unless all 4 bytes are used
+   unsigned char attr;
+};
+
 static void
 usage(const char *argv0)
 {
-   fprintf(stderr, "usage: %s pid [regions]\n"
-                   "       regions must be in /proc/<pid>/maps format\n", argv0);
+   fprintf(stderr, "usage: %s [-r hz] [-d pid|snapshot] pid [regions]\n"
+                   "       %s [-r hz] [-d pid|snapshot] snapshot [regions]\n"
+                   "       regions must be in /proc/<pid>/maps format\n"
+                   "       snapshot is a file written by region-rw's snapshot mode\n"
+                   "       -r sets how many times per second the screen is refreshed (default 1, max %g)\n"
+                   "       -d shows a second source side by side and highlights the bytes that differ\n", argv0, argv0, MAX_HZ);
    exit(EXIT_FAILURE);
 }
 
@@ -60,13 +111,45 @@ struct key {
    bool is_csi;
 };
 
+// everything the terminal has is read at once, keys are parsed out of this
+static struct {
+   unsigned char data[4096];
+   size_t len, pos;
+} term_input;
+
+static bool
+term_byte(unsigned char *byte)
+{
+   while (term_input.pos >= term_input.len) {
+      const ssize_t rd = read(TERM_FILENO, term_input.data, sizeof(term_input.data));
+      if (rd < 0 && errno == EINTR)
+         continue;
+
+      if (rd <= 0)
+         return false;
+
+      term_input.len = rd;
+      term_input.pos = 0;
+   }
+
+   *byte = term_input.data[term_input.pos++];
+   return true;
+}
+
+static bool
+term_input_pending(void)
+{
+   int pending;
+   return (term_input.pos < term_input.len || (ioctl(TERM_FILENO, FIONREAD, &pending) == 0 && pending > 0));
+}
+
 static bool
 get_key(struct key *key)
 {
    while (1) {
       unsigned char input;
-      if (fread(&input, 1, 1, TERM_STREAM) <= 0)
-         continue;
+      if (!term_byte(&input))
+         return false;
 
       switch (input) {
          case 0x04:
@@ -77,8 +160,8 @@ get_key(struct key *key)
             break;
          case 0x1b: // ^[
             *key = (struct key){0};
-            if (fread(&input, 1, 1, TERM_STREAM) <= 0)
-               continue;
+            if (!term_byte(&input))
+               return false;
             if (input != '[') {
                key->i = 0;
                break;
@@ -113,32 +196,50 @@ struct action {
    unsigned char seq[sizeof(((struct key*)0)->seq)];
    void (*fun)(void *arg);
    intptr_t arg;
+   bool merges; // repeats that arrive together are applied back to back, and only the end result is drawn
 };
 
+static const struct action*
+key_action(const struct key *key, const struct action *actions, const size_t nmemb)
+{
+   for (size_t i = 0; i < nmemb; ++i) {
+      if (strlen((const char*)actions[i].seq) == key->i && !memcmp(actions[i].seq, key->seq, key->i))
+         return &actions[i];
+   }
+   return NULL;
+}
+
 static bool
 key_press(const struct key *key, const struct action *actions, const size_t nmemb)
 {
-   for (size_t i = 0; i < nmemb; ++i) {
-      if (strlen((const char*)actions[i].seq) != key->i || memcmp(actions[i].seq, key->seq, key->i))
-         continue;
+   const struct action *action;
+   if (!(action = key_action(key, actions, nmemb)))
+      return false;
 
-      actions[i].fun((void*)actions[i].arg);
-      return true;
-   }
-   return false;
+   action->fun((void*)action->arg);
+   return true;
 }
 
 static struct {
    struct named_region {
       struct region region;
       const char *name;
+      size_t module; // 0 if not file backed, index + 1 otherwise
    } *named;
    size_t num_regions, allocated_regions, active_region;
 
+   // screen is drawn to cells[0], flush sends only cells that differ from cells[1] (what terminal shows)
    struct {
-      char *data;
-      const char *fmt;
+      struct cell *cells[2];
+      char *data, *text; // text holds the hex and chr of a row, encoded at once
       size_t pointer, size;
+      unsigned char attr, term_attr;
+      bool invalid;
+
+      struct {
+         size_t last, total, frames;
+         bool show;
+      } stats;
    } screen;
 
    struct {
@@ -152,6 +253,7 @@ static struct {
       struct termios initial, current;
       struct { unsigned int w; unsigned int h; } ws;
       struct { unsigned int x; unsigned int y; } cur;
+      volatile sig_atomic_t resized; // set by SIGWINCH, the main loop resizes
    } term;
 
    // kind of hack, lets make real action history someday
@@ -166,11 +268,81 @@ static struct {
       unsigned char pointer;
    } input;
 
+   // changed bytes fade out over fade_frames ticks
+   struct {
+      unsigned char *fade, fade_frames;
+      double hz;
+      int timer;
+   } live;
+
+   // at most one frame per interval, input and ticks in between only mark the screen dirty
+   struct {
+      uint64_t interval, last;
+      bool dirty;
+   } frame;
+
+   // search runs on its own thread, hits are appended under mutex and wake wakes up the main loop
+   struct {
+      pthread_t thread;
+      pthread_mutex_t mutex;
+      size_t *hits, num_hits, allocated_hits;
+      unsigned char needle[255];
+      size_t needle_len;
+      bool started, joinable, running, cancel;
+   } search;
+
+   // screens around the view and neighbouring region starts are read ahead on a worker thread
+   struct {
+      pthread_t thread;
+      pthread_mutex_t mutex;
+      pthread_cond_t cond;
+      struct prefetch_slot {
+         unsigned char *data;
+         size_t start, len, mapped, allocated;
+         unsigned long used;
+         enum { SLOT_EMPTY, SLOT_QUEUED, SLOT_READING, SLOT_READY } state;
+      } slots[8];
+      size_t correction;
+      unsigned long clock;
+      bool started, quit;
+   } prefetch;
+
+   // symbols of file backed regions, indexed on a worker thread the first time an address in them is shown
+   struct {
+      pthread_t thread;
+      pthread_mutex_t mutex;
+      pthread_cond_t cond;
+      struct module {
+         char *path;
+         size_t base; // start of the region mapping offset 0, ~0 if none is mapped
+         struct mem_symbols symbols;
+         enum { MODULE_UNLOADED, MODULE_QUEUED, MODULE_LOADING, MODULE_READY } state;
+      } *modules;
+      size_t num_modules, allocated_modules;
+      bool started, quit;
+   } symbols;
+
+   // second source compared against io at the same addresses
+   struct {
+      struct mem_io io;
+      unsigned char *data;
+      size_t mapped;
+      bool enabled;
+   } diff;
+
+   int wake[2];
    struct key last_key;
    struct mem_io io;
 
    uint8_t native_bits;
-} ctx = { .hexview.octects_per_group = 1 };
+} ctx = {
+   .hexview.octects_per_group = 1,
+   .live = { .hz = 1.0, .timer = -1 },
+   .search = { .mutex = PTHREAD_MUTEX_INITIALIZER },
+   .prefetch = { .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .correction = (size_t)~0 },
+   .symbols = { .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER },
+   .wake = { -1, -1 },
+};
 
 static const char*
 basename(const char *path)
@@ -186,31 +358,6 @@ skip_ws(const char *str)
    return str + skipped;
 }
 
-const char*
-hex_for_byte(unsigned char byte)
-{
-   // optimization to avoid vprintf for the hex view
-   static const char hex[256][3] = {
-      "00", "01", "02", "03", "04", "05", "06", "07", "08", "09", "0a", "0b", "0c", "0d", "0e", "0f",
-      "10", "11", "12", "13", "14", "15", "16", "17", "18", "19", "1a", "1b", "1c", "1d", "1e", "1f",
-      "20", "21", "22", "23", "24", "25", "26", "27", "28", "29", "2a", "2b", "2c", "2d", "2e", "2f",
-      "30", "31", "32", "33", "34", "35", "36", "37", "38", "39", "3a", "3b", "3c", "3d", "3e", "3f",
-      "40", "41", "42", "43", "44", "45", "46", "47", "48", "49", "4a", "4b", "4c", "4d", "4e", "4f",
-      "50", "51", "52", "53", "54", "55", "56", "57", "58", "59", "5a", "5b", "5c", "5d", "5e", "5f",
-      "60", "61", "62", "63", "64", "65", "66", "67", "68", "69", "6a", "6b", "6c", "6d", "6e", "6f",
-      "70", "71", "72", "73", "74", "75", "76", "77", "78", "79", "7a", "7b", "7c", "7d", "7e", "7f",
-      "80", "81", "82", "83", "84", "85", "86", "87", "88", "89", "8a", "8b", "8c", "8d", "8e", "8f",
-      "90", "91", "92", "93", "94", "95", "96", "97", "98", "99", "9a", "9b", "9c", "9d", "9e", "9f",
-      "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "a8", "a9", "aa", "ab", "ac", "ad", "ae", "af",
-      "b0", "b1", "b2", "b3", "b4", "b5", "b6", "b7", "b8", "b9", "ba", "bb", "bc", "bd", "be", "bf",
-      "c0", "c1", "c2", "c3", "c4", "c5", "c6", "c7", "c8", "c9", "ca", "cb", "cc", "cd", "ce", "cf",
-      "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7", "d8", "d9", "da", "db", "dc", "dd", "de", "df",
-      "e0", "e1", "e2", "e3", "e4", "e5", "e6", "e7", "e8", "e9", "ea", "eb", "ec", "ed", "ee", "ef",
-      "f0", "f1", "f2", "f3", "f4", "f5", "f6", "f7", "f8", "f9", "fa", "fb", "fc", "fd", "fe", "ff"
-   };
-   return hex[byte];
-}
-
 static void
 store_offset(const size_t offset)
 {
@@ -254,9 +401,10 @@ static size_t
 bytes_fits_row(void)
 {
    // 000000000000: 00 00 00 00 00 00 00 00 00 .........
-   const size_t preamble = snprintf(NULL, 0, "%.13zx: ", (size_t)0);
+   // 000000000000: 00 00 00 00 .... │ 00 00 00 00 .... (diff)
+   const size_t preamble = snprintf(NULL, 0, "%.13zx: ", (size_t)0) + (ctx.diff.enabled ? 2 : 0);
    if (ctx.term.ws.w <= preamble) return 0;
-   return (ctx.term.ws.w - preamble) / ((ctx.hexview.octects_per_group * 3 /* 00?? + ws */) + ctx.hexview.octects_per_group /* for chr view */);
+   return (ctx.term.ws.w - preamble) / (((ctx.hexview.octects_per_group * 3 /* 00?? + ws */) + ctx.hexview.octects_per_group /* for chr view */) * (ctx.diff.enabled ? 2 : 1));
 }
 
 static size_t
@@ -282,14 +430,42 @@ get_selection(void)
    return v;
 }
 
+static void
+screen_put(const char *glyph, const size_t len)
+{
+   if (ctx.term.cur.x >= ctx.term.ws.w || ctx.term.cur.y > ctx.term.ws.h)
+      return;
+
+   struct cell *cell = &ctx.screen.cells[0][ctx.term.cur.y * ctx.term.ws.w + ctx.term.cur.x++];
+   memset(cell->glyph, 0, sizeof(cell->glyph));
+   memcpy(cell->glyph, glyph, (len > sizeof(cell->glyph) ? sizeof(cell->glyph) : len));
+   cell->attr = ctx.screen.attr;
+}
+
+static void
+screen_nprint(const size_t len, const char *str)
+{
+   // len is in cells, one cell per utf8 sequence
+   for (size_t n = 0; *str && n < len; ++n) {
+      const unsigned char lead = *str;
+      size_t seq = (lead >= 0xf0 ? 4 : (lead >= 0xe0 ? 3 : (lead >= 0xc0 ? 2 : 1)));
+      for (size_t i = 1; i < seq; ++i) {
+         if (!str[i]) {
+            seq = i;
+            break;
+         }
+      }
+      screen_put(str, seq);
+      str += seq;
+   }
+}
+
 static void
 screen_vnprintf(const size_t len, const char *fmt, va_list ap)
 {
-   const size_t rlen = (len < (size_t)~0 ? len + 1 : len);
-   size_t mlen = ctx.screen.size - ctx.screen.pointer; mlen = (mlen > rlen ? rlen : mlen);
-   const size_t most = vsnprintf(ctx.screen.data + ctx.screen.pointer, mlen, fmt, ap);
-   ctx.screen.pointer += (most > mlen ? mlen : most);
-   ctx.screen.pointer = (ctx.screen.pointer > ctx.screen.size ? ctx.screen.size : ctx.screen.pointer);
+   char buf[1024];
+   vsnprintf(buf, sizeof(buf), fmt, ap);
+   screen_nprint(len, buf);
 }
 
 static void
@@ -312,15 +488,6 @@ screen_nprintf(const size_t len, const char *fmt, ...)
    va_end(ap);
 }
 
-static void
-screen_nprint(const size_t len, const char *str)
-{
-   size_t slen = strlen(str); slen = (slen > len ? len : slen);
-   const size_t mlen = (slen < ctx.screen.size - ctx.screen.pointer ? slen : ctx.screen.size - ctx.screen.pointer);
-   memcpy(ctx.screen.data + ctx.screen.pointer, str, mlen);
-   ctx.screen.pointer += mlen;
-}
-
 static void
 screen_print(const char *str)
 {
@@ -330,28 +497,20 @@ screen_print(const char *str)
 static void
 screen_putc(const char c)
 {
-   if (ctx.screen.pointer >= ctx.screen.size)
-      return;
-   ctx.screen.data[ctx.screen.pointer++] = c;
+   screen_put(&c, 1);
 }
 
 static void
-screen_format(const char *fmt)
+screen_format(const enum attr attr)
 {
-   // optimization for reducing format changes in hexview
-   if (ctx.screen.fmt == fmt)
-      return;
-
-   if (ctx.screen.fmt)
-      screen_print(FMT(PLAIN));
-
-   screen_print((ctx.screen.fmt = fmt));
+   ctx.screen.attr = attr;
 }
 
 static void
 screen_cursor(const unsigned int x, const unsigned int y)
 {
-   screen_printf(ESCA "%u;%u" JUMP, (ctx.term.cur.y = y) + 1, (ctx.term.cur.x = x) + 1);
+   ctx.term.cur.x = x;
+   ctx.term.cur.y = y;
 }
 
 static void
@@ -362,12 +521,116 @@ screen_fill(const unsigned int y, const char *str)
       screen_print(str);
 }
 
+static void
+screen_clear_line(void)
+{
+   if (ctx.term.cur.y > ctx.term.ws.h)
+      return;
+
+   for (size_t x = 0; x < ctx.term.ws.w; ++x)
+      ctx.screen.cells[0][ctx.term.cur.y * ctx.term.ws.w + x] = (struct cell){ .glyph = " ", .attr = ATTR_PLAIN };
+}
+
+static void
+screen_clear(void)
+{
+   for (size_t i = 0; i < (size_t)ctx.term.ws.w * (ctx.term.ws.h + 1); ++i)
+      ctx.screen.cells[0][i] = (struct cell){ .glyph = " ", .attr = ATTR_PLAIN };
+}
+
+static void
+screen_emit(const char *str, const size_t len)
+{
+   if (ctx.screen.pointer + len > ctx.screen.size) {
+      fwrite(ctx.screen.data, 1, ctx.screen.pointer, TERM_STREAM);
+      ctx.screen.pointer = 0;
+   }
+
+   memcpy(ctx.screen.data + ctx.screen.pointer, str, len);
+   ctx.screen.pointer += len;
+   ctx.screen.stats.last += len;
+}
+
+static void
+__attribute__((format(printf, 1, 2)))
+screen_emitf(const char *fmt, ...)
+{
+   char buf[32];
+   va_list ap;
+   va_start(ap, fmt);
+   const int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+   va_end(ap);
+   screen_emit(buf, (len < 0 ? 0 : ((size_t)len >= sizeof(buf) ? sizeof(buf) - 1 : (size_t)len)));
+}
+
+static bool
+cell_eq(const struct cell *a, const struct cell *b)
+{
+   return (a->attr == b->attr && !memcmp(a->glyph, b->glyph, sizeof(a->glyph)));
+}
+
+static void
+screen_emit_cell(const struct cell *cell)
+{
+   if (cell->attr != ctx.screen.term_attr) {
+      screen_emit(attr_sgr[cell->attr], strlen(attr_sgr[cell->attr]));
+      ctx.screen.term_attr = cell->attr;
+   }
+
+   const char *nul = memchr(cell->glyph, 0, sizeof(cell->glyph));
+   screen_emit(cell->glyph, (nul ? (size_t)(nul - cell->glyph) : sizeof(cell->glyph)));
+}
+
 static void
 screen_flush(void)
 {
+   const unsigned int w = ctx.term.ws.w, h = ctx.term.ws.h + 1;
+   ctx.screen.stats.last = 0;
+
+   if (ctx.screen.invalid) {
+      // terminal contents are unknown (startup, resize), start from a clear screen
+      screen_emit(ESCA TERM_CLEAR FMT(PLAIN), sizeof(ESCA TERM_CLEAR FMT(PLAIN)) - 1);
+      ctx.screen.term_attr = ATTR_PLAIN;
+      for (size_t i = 0; i < (size_t)w * h; ++i)
+         ctx.screen.cells[1][i] = (struct cell){ .glyph = " ", .attr = ATTR_PLAIN };
+      ctx.screen.invalid = false;
+   }
+
+   for (unsigned int y = 0, tx = ~0u, ty = ~0u; y < h; ++y) {
+      const struct cell *back = ctx.screen.cells[0] + (size_t)y * w, *front = ctx.screen.cells[1] + (size_t)y * w;
+      for (unsigned int x = 0; x < w; ++x) {
+         if (cell_eq(&back[x], &front[x]))
+            continue;
+
+         if (ty == y && tx < x) {
+            // rewriting a short unchanged gap is cheaper than moving the cursor, if it doesn't need SGR changes
+            bool rewrite = (x - tx <= 4);
+            for (unsigned int g = tx; rewrite && g < x; ++g)
+               rewrite = (back[g].attr == ctx.screen.term_attr);
+
+            if (rewrite) {
+               for (unsigned int g = tx; g < x; ++g)
+                  screen_emit_cell(&back[g]);
+            } else {
+               screen_emitf(ESCA "%u" "C", x - tx);
+            }
+         } else if (ty != y || tx != x) {
+            screen_emitf(ESCA "%u;%u" JUMP, y + 1, x + 1);
+         }
+
+         screen_emit_cell(&back[x]);
+
+         // cursor is in pending wrap state after the last column, don't trust it
+         ty = y; tx = (x + 1 < w ? x + 1 : ~0u);
+      }
+   }
+
    fwrite(ctx.screen.data, 1, ctx.screen.pointer, TERM_STREAM);
    ctx.screen.pointer = 0;
-   ctx.screen.fmt = FMT(PLAIN);
+   memcpy(ctx.screen.cells[1], ctx.screen.cells[0], sizeof(struct cell) * w * h);
+
+   ctx.screen.stats.total += ctx.screen.stats.last;
+   ctx.screen.stats.frames += (ctx.screen.stats.last > 0);
 }
 
 static size_t
@@ -394,10 +657,31 @@ static void
 repaint_top_bar(const struct named_region *named)
 {
    screen_cursor(0, 0);
-   screen_print(ESCA CLEAR_LINE);
+   screen_clear_line();
    screen_nprintf(ctx.term.ws.w, "%s", named->name);
 }
 
+static void
+repaint_stats(const struct named_region *named)
+{
+   if (!ctx.screen.stats.show)
+      return;
+
+   // cheap to redraw the whole bar, only changed cells are sent
+   repaint_top_bar(named);
+
+   // bytes written to the terminal by the previous frame, and average of the frames that wrote anything
+   const size_t avg = (ctx.screen.stats.frames ? ctx.screen.stats.total / ctx.screen.stats.frames : 0);
+   const size_t len = snprintf(NULL, 0, " %zu B/frame %zu B avg", ctx.screen.stats.last, avg);
+   if (ctx.term.ws.w <= len)
+      return;
+
+   screen_cursor(ctx.term.ws.w - len, 0);
+   screen_format(ATTR_REVERSE);
+   screen_nprintf(len, " %zu B/frame %zu B avg", ctx.screen.stats.last, avg);
+   screen_format(ATTR_PLAIN);
+}
+
 static void
 draw_error(const char *line, void *data)
 {
@@ -408,87 +692,390 @@ draw_error(const char *line, void *data)
 }
 
 static void
-repaint_hexview(const struct named_region *named, const bool update)
+update_fade(const bool reset)
 {
-   const size_t bs = bytes_fits_screen(), bw = bytes_fits_row();
-   const size_t start = named->region.start + scroll_for_offset(named, ctx.hexview.offset), len = named->region.end - start;
-   const bool scrolled = (ctx.hexview.scroll != ctx.last_hexview.scroll);
+   const size_t bs = bytes_fits_screen();
+   for (size_t i = 0; i < bs; ++i) {
+      if (reset || i >= ctx.hexview.memory[0].mapped)
+         ctx.live.fade[i] = 0;
+      else if (ctx.hexview.memory[0].data[i] != ctx.hexview.memory[1].data[i])
+         ctx.live.fade[i] = ctx.live.fade_frames;
+      else
+         ctx.live.fade[i] -= (ctx.live.fade[i] > 0);
+   }
+}
 
-   if (update || scrolled) {
-      memcpy(ctx.hexview.memory[1].data, ctx.hexview.memory[0].data, ctx.hexview.memory[0].mapped * !scrolled);
-      ctx.hexview.memory[0].mapped = ctx.io.read(&ctx.io, ctx.hexview.memory[0].data, start, (bs > len ? len : bs));
-      memcpy(ctx.hexview.memory[1].data, ctx.hexview.memory[0].data, ctx.hexview.memory[0].mapped * scrolled);
+static enum attr
+attr_for_fade(const unsigned char fade, const enum attr plain)
+{
+   // newest changes are the brightest
+   static const enum attr levels[] = { ATTR_FADE_0, ATTR_FADE_1, ATTR_FADE_2 };
+   if (!fade)
+      return plain;
+   return levels[(fade - 1) * ARRAY_SIZE(levels) / ctx.live.fade_frames];
+}
+
+static void
+wake_main_loop(void)
+{
+   (void)! write(ctx.wake[1], "", 1);
+}
+
+static void*
+prefetch_thread(void *arg)
+{
+   (void)arg;
+   pthread_mutex_lock(&ctx.prefetch.mutex);
+   while (!ctx.prefetch.quit) {
+      // correction of the visible screen goes before read-ahead
+      struct prefetch_slot *slot = NULL;
+      for (size_t i = 0; i < ARRAY_SIZE(ctx.prefetch.slots); ++i) {
+         if (ctx.prefetch.slots[i].state == SLOT_QUEUED && (!slot || i == ctx.prefetch.correction))
+            slot = &ctx.prefetch.slots[i];
+      }
+
+      if (!slot) {
+         pthread_cond_wait(&ctx.prefetch.cond, &ctx.prefetch.mutex);
+         continue;
+      }
+
+      // slot data is only touched by this thread while reading
+      slot->state = SLOT_READING;
+      pthread_mutex_unlock(&ctx.prefetch.mutex);
+      const size_t mapped = ctx.io.read(&ctx.io, slot->data, slot->start, slot->len);
+      pthread_mutex_lock(&ctx.prefetch.mutex);
+      slot->mapped = mapped;
+      slot->state = SLOT_READY;
+
+      if ((size_t)(slot - ctx.prefetch.slots) == ctx.prefetch.correction)
+         wake_main_loop();
+   }
+   pthread_mutex_unlock(&ctx.prefetch.mutex);
+   return NULL;
+}
+
+static void
+prefetch_stop(void)
+{
+   if (!ctx.prefetch.started)
+      return;
+
+   pthread_mutex_lock(&ctx.prefetch.mutex);
+   ctx.prefetch.quit = true;
+   pthread_cond_signal(&ctx.prefetch.cond);
+   pthread_mutex_unlock(&ctx.prefetch.mutex);
+   pthread_join(ctx.prefetch.thread, NULL);
+
+   for (size_t i = 0; i < ARRAY_SIZE(ctx.prefetch.slots); ++i)
+      free(ctx.prefetch.slots[i].data);
+}
+
+static size_t
+prefetch_queue(const size_t start, const size_t len)
+{
+   // must be called with the mutex held, reuses the least recently queued slot that isn't being read
+   struct prefetch_slot *victim = NULL;
+   for (size_t i = 0; i < ARRAY_SIZE(ctx.prefetch.slots); ++i) {
+      struct prefetch_slot *slot = &ctx.prefetch.slots[i];
+      if (slot->state != SLOT_EMPTY && slot->start == start && slot->len == len) {
+         victim = slot;
+         break;
+      }
+      if (slot->state != SLOT_READING && (!victim || slot->used < victim->used))
+         victim = slot;
    }
 
-   screen_format(FMT(PLAIN));
-   for (size_t pointer = 0; pointer < ctx.hexview.memory[0].mapped;) {
-      screen_cursor(0, 2 + (pointer / bw));
-      screen_printf(FMT(FG YELLOW) "%.13zx: " FMT(PLAIN), start + pointer);
-      ctx.screen.fmt = FMT(FG YELLOW);
+   if (!victim || victim->state == SLOT_READING)
+      return (victim ? (size_t)(victim - ctx.prefetch.slots) : (size_t)~0);
 
-      const size_t row_start = pointer;
-      for (size_t x = 0; x < bw && pointer < bs; ++x) {
-         const bool selected = (start + pointer == ctx.hexview.offset);
+   if (victim->allocated < len) {
+      free(victim->data);
+      if (!(victim->data = malloc(len))) {
+         *victim = (struct prefetch_slot){0};
+         return (size_t)~0;
+      }
+      victim->allocated = len;
+   }
 
-         bool changed = false;
-         for (size_t o = pointer; o < pointer + ctx.hexview.octects_per_group && o < bs; ++o) {
-            if (ctx.hexview.memory[0].data[o] == ctx.hexview.memory[1].data[o])
-               continue;
+   victim->start = start;
+   victim->len = len;
+   victim->used = ++ctx.prefetch.clock;
+   victim->state = SLOT_QUEUED;
+   pthread_cond_signal(&ctx.prefetch.cond);
+   return victim - ctx.prefetch.slots;
+}
 
-            changed = true;
-            break;
-         }
+static bool
+prefetch_covers(const size_t start, const size_t len)
+{
+   for (size_t i = 0; i < ARRAY_SIZE(ctx.prefetch.slots); ++i) {
+      const struct prefetch_slot *slot = &ctx.prefetch.slots[i];
+      if (slot->state != SLOT_EMPTY && slot->start <= start && slot->start + slot->len >= start + len)
+         return true;
+   }
+   return false;
+}
 
-         if (selected)
-            screen_format(FMT(REVERSE));
-         else if (changed)
-            screen_format(FMT(FG RED));
-         else
-            screen_format(FMT(PLAIN));
+static void
+prefetch_around(const struct named_region *named, const size_t start, const size_t len)
+{
+   if (!ctx.prefetch.started || !len)
+      return;
 
-         for (size_t o = 0; o < ctx.hexview.octects_per_group && pointer < bs; ++o) {
-            if (pointer > ctx.hexview.memory[0].mapped) {
-               screen_print("  ");
-            } else {
-               screen_print(hex_for_byte(ctx.hexview.memory[0].data[pointer++]));
-            }
-         }
+   pthread_mutex_lock(&ctx.prefetch.mutex);
+
+   // a screen above and below the view as one read, clamped to the region
+   const size_t lo = (start - named->region.start > len ? start - len : named->region.start);
+   const size_t hi = (named->region.end - start > len * 2 ? start + len * 2 : named->region.end + 1);
+   if (hi > lo && (!prefetch_covers(lo, start - lo) || !prefetch_covers(start, hi - start)))
+      prefetch_queue(lo, hi - lo);
+
+   const size_t active = (size_t)(named - ctx.named);
+   for (size_t i = 0; active > 0 && ctx.num_regions > 2 && i < 2; ++i) {
+      size_t region = (i ? (active > 1 ? active - 1 : ctx.num_regions - 1) : (active + 1 < ctx.num_regions ? active + 1 : 1));
+      const struct region *r = &ctx.named[region].region;
+      const size_t rlen = (r->end - r->start > len ? len : r->end - r->start);
+      if (rlen > 0 && !prefetch_covers(r->start, rlen))
+         prefetch_queue(r->start, rlen);
+   }
 
-         if (selected)
-            screen_format(FMT(PLAIN));
+   pthread_mutex_unlock(&ctx.prefetch.mutex);
+}
 
-         screen_print(" ");
+static void
+module_load(struct module *module)
+{
+   // must be called with the mutex held, which is released while indexing
+   module->state = MODULE_LOADING;
+   pthread_mutex_unlock(&ctx.symbols.mutex);
+   if (module->base != (size_t)~0)
+      mem_symbols_load(&module->symbols, module->path, &ctx.io, module->base);
+   pthread_mutex_lock(&ctx.symbols.mutex);
+   module->state = MODULE_READY;
+   pthread_cond_broadcast(&ctx.symbols.cond);
+}
+
+static void*
+symbols_thread(void *arg)
+{
+   (void)arg;
+   pthread_mutex_lock(&ctx.symbols.mutex);
+   while (!ctx.symbols.quit) {
+      struct module *module = NULL;
+      for (size_t i = 0; !module && i < ctx.symbols.num_modules; ++i) {
+         if (ctx.symbols.modules[i].state == MODULE_QUEUED)
+            module = &ctx.symbols.modules[i];
+      }
+
+      if (!module) {
+         pthread_cond_wait(&ctx.symbols.cond, &ctx.symbols.mutex);
+         continue;
+      }
+
+      module_load(module);
+      wake_main_loop();
+   }
+   pthread_mutex_unlock(&ctx.symbols.mutex);
+   return NULL;
+}
+
+static void
+symbols_stop(void)
+{
+   if (ctx.symbols.started) {
+      pthread_mutex_lock(&ctx.symbols.mutex);
+      ctx.symbols.quit = true;
+      pthread_cond_broadcast(&ctx.symbols.cond);
+      pthread_mutex_unlock(&ctx.symbols.mutex);
+      pthread_join(ctx.symbols.thread, NULL);
+   }
+
+   for (size_t i = 0; i < ctx.symbols.num_modules; ++i) {
+      mem_symbols_release(&ctx.symbols.modules[i].symbols);
+      free(ctx.symbols.modules[i].path);
+   }
+
+   free(ctx.symbols.modules);
+}
+
+static bool
+symbol_for_offset(const struct named_region *named, const size_t offset, const char **name, size_t *off)
+{
+   // never waits, modules not indexed yet are queued and the bottom bar is repainted once they are
+   if (!named->module || !ctx.symbols.started)
+      return false;
+
+   pthread_mutex_lock(&ctx.symbols.mutex);
+   struct module *module = &ctx.symbols.modules[named->module - 1];
+   const struct mem_symbol *symbol = NULL;
+   if (module->state == MODULE_UNLOADED) {
+      module->state = MODULE_QUEUED;
+      pthread_cond_broadcast(&ctx.symbols.cond);
+   } else if (module->state == MODULE_READY && offset >= module->base) {
+      if ((symbol = mem_symbols_nearest(&module->symbols, offset - module->base))) {
+         *name = module->symbols.names + symbol->name;
+         *off = offset - module->base - symbol->address;
+      }
+   }
+   pthread_mutex_unlock(&ctx.symbols.mutex);
+   return (symbol != NULL);
+}
+
+static bool
+symbol_address(const char *name, size_t *address)
+{
+   // modules are searched in maps order, so the executable goes first, indexing the ones not indexed yet
+   const struct mem_symbol *symbol = NULL;
+   pthread_mutex_lock(&ctx.symbols.mutex);
+   for (size_t i = 0; !symbol && i < ctx.symbols.num_modules; ++i) {
+      struct module *module = &ctx.symbols.modules[i];
+      if (module->state == MODULE_UNLOADED || module->state == MODULE_QUEUED)
+         module_load(module);
+
+      while (module->state != MODULE_READY)
+         pthread_cond_wait(&ctx.symbols.cond, &ctx.symbols.mutex);
+
+      if ((symbol = mem_symbols_find(&module->symbols, name)))
+         *address = module->base + symbol->address;
+   }
+   pthread_mutex_unlock(&ctx.symbols.mutex);
+   return (symbol != NULL);
+}
+
+static size_t
+read_view(const size_t start, const size_t len, unsigned char *data)
+{
+   if (ctx.prefetch.started) {
+      pthread_mutex_lock(&ctx.prefetch.mutex);
+      for (size_t i = 0; i < ARRAY_SIZE(ctx.prefetch.slots); ++i) {
+         const struct prefetch_slot *slot = &ctx.prefetch.slots[i];
+         if (slot->state != SLOT_READY || slot->start > start || slot->start + slot->len < start + len)
+            continue;
+
+         // render what was read ahead now, and read the screen again to correct stale bytes
+         const size_t off = start - slot->start;
+         const size_t mapped = (slot->mapped > off ? (slot->mapped - off > len ? len : slot->mapped - off) : 0);
+         memcpy(data, slot->data + off, mapped);
+         ctx.prefetch.correction = prefetch_queue(start, len);
+         pthread_mutex_unlock(&ctx.prefetch.mutex);
+         return mapped;
       }
+      pthread_mutex_unlock(&ctx.prefetch.mutex);
+   }
+
+   return ctx.io.read(&ctx.io, data, start, len);
+}
+
+static bool
+byte_differs(const size_t i, const unsigned char *data, const size_t mapped, const unsigned char *other, const size_t other_mapped)
+{
+   return (other && i < mapped && (i >= other_mapped || data[i] != other[i]));
+}
 
-      for (size_t x = row_start; x < row_start + bw; ++x) {
-         const bool selected = (start + x == ctx.hexview.offset);
-         const bool changed = (ctx.hexview.memory[0].data[x] != ctx.hexview.memory[1].data[x]);
+static void
+repaint_pane(const size_t start, const size_t row, const unsigned char *data, const size_t mapped, const unsigned char *other, const size_t other_mapped, const bool fades)
+{
+   // single row of hex and chr view, bytes that differ from other are highlighted
+   const size_t bs = bytes_fits_screen(), bw = bytes_fits_row();
+   const size_t hex_len = bw * ctx.hexview.octects_per_group, avail = (mapped > row ? mapped - row : 0);
+   char *hex = ctx.screen.text, *chr = ctx.screen.text + hex_len * 2;
+   hex_encode(hex, data + row, (avail > hex_len ? hex_len : avail));
+   hex_ascii(chr, data + row, (avail > bw ? bw : avail));
+
+   for (size_t x = 0, pointer = row; x < bw && pointer < bs; ++x) {
+      const bool selected = (start + pointer == ctx.hexview.offset);
+
+      unsigned char fade = 0;
+      bool differs = false;
+      for (size_t o = pointer; o < pointer + ctx.hexview.octects_per_group && o < bs; ++o) {
+         fade = (fades && ctx.live.fade[o] > fade ? ctx.live.fade[o] : fade);
+         differs = (differs || byte_differs(o, data, mapped, other, other_mapped));
+      }
 
-         if (selected)
-            screen_format(FMT(REVERSE));
-         else if (changed)
-            screen_format(FMT(FG RED));
-         else
-            screen_format(FMT(FG CYAN));
+      if (selected)
+         screen_format(ATTR_REVERSE);
+      else
+         screen_format(differs ? ATTR_DIFF : attr_for_fade(fade, ATTR_PLAIN));
 
-         if (x > ctx.hexview.memory[0].mapped) {
-            screen_print(" ");
+      for (size_t o = 0; o < ctx.hexview.octects_per_group && pointer < bs; ++o, ++pointer) {
+         if (pointer >= mapped) {
+            screen_print("  ");
          } else {
-            screen_print((char[]){(isprint(ctx.hexview.memory[0].data[x]) ? ctx.hexview.memory[0].data[x] : '.'), 0});
+            screen_put(hex + (pointer - row) * 2, 1);
+            screen_put(hex + (pointer - row) * 2 + 1, 1);
          }
+      }
+
+      if (selected || differs)
+         screen_format(ATTR_PLAIN);
 
-         if (selected)
-            screen_format(FMT(PLAIN));
+      screen_print(" ");
+   }
+
+   for (size_t x = row; x < row + bw; ++x) {
+      const bool selected = (start + x == ctx.hexview.offset);
+
+      if (selected)
+         screen_format(ATTR_REVERSE);
+      else if (x < bs && byte_differs(x, data, mapped, other, other_mapped))
+         screen_format(ATTR_DIFF);
+      else
+         screen_format(attr_for_fade((fades && x < bs ? ctx.live.fade[x] : 0), ATTR_CYAN));
+
+      if (x >= mapped) {
+         screen_print(" ");
+      } else {
+         screen_put(chr + (x - row), 1);
       }
+
+      if (selected)
+         screen_format(ATTR_PLAIN);
    }
-   screen_format(FMT(PLAIN));
+}
+
+static void
+repaint_hexview(const struct named_region *named, const bool update)
+{
+   const size_t bs = bytes_fits_screen(), bw = bytes_fits_row();
+   const size_t start = named->region.start + scroll_for_offset(named, ctx.hexview.offset), len = named->region.end - start;
+   const bool scrolled = (ctx.hexview.scroll != ctx.last_hexview.scroll);
+
+   if (update || scrolled) {
+      memcpy(ctx.hexview.memory[1].data, ctx.hexview.memory[0].data, ctx.hexview.memory[0].mapped * !scrolled);
+      if (scrolled)
+         ctx.hexview.memory[0].mapped = read_view(start, (bs > len ? len : bs), ctx.hexview.memory[0].data);
+      else
+         ctx.hexview.memory[0].mapped = ctx.io.read(&ctx.io, ctx.hexview.memory[0].data, start, (bs > len ? len : bs));
+      memcpy(ctx.hexview.memory[1].data, ctx.hexview.memory[0].data, ctx.hexview.memory[0].mapped * scrolled);
+      update_fade(scrolled);
+
+      if (ctx.diff.enabled)
+         ctx.diff.mapped = ctx.diff.io.read(&ctx.diff.io, ctx.diff.data, start, (bs > len ? len : bs));
+
+      if (scrolled)
+         prefetch_around(named, start, (bs > len ? len : bs));
+   }
+
+   for (size_t row = 0; bw > 0 && row < ctx.hexview.memory[0].mapped; row += bw) {
+      screen_cursor(0, 2 + (row / bw));
+      screen_format(ATTR_YELLOW);
+      screen_printf("%.13zx: ", start + row);
+      repaint_pane(start, row, ctx.hexview.memory[0].data, ctx.hexview.memory[0].mapped, (ctx.diff.enabled ? ctx.diff.data : NULL), ctx.diff.mapped, true);
+
+      if (ctx.diff.enabled) {
+         screen_format(ATTR_PLAIN);
+         screen_print("│ ");
+         repaint_pane(start, row, ctx.diff.data, ctx.diff.mapped, ctx.hexview.memory[0].data, ctx.hexview.memory[0].mapped, false);
+      }
+   }
+   screen_format(ATTR_PLAIN);
 
    if (!ctx.hexview.memory[0].mapped)
       screen_cursor(0, 1);
 
    for (size_t i = 0; bw > 0 && i < (bs - ctx.hexview.memory[0].mapped) / bw; ++i) {
       screen_cursor(0, ctx.term.cur.y + 1);
-      screen_print(ESCA CLEAR_LINE);
+      screen_clear_line();
    }
 
    if (!ctx.hexview.memory[0].mapped && ctx.term.ws.h > 3) {
@@ -498,13 +1085,88 @@ repaint_hexview(const struct named_region *named, const bool update)
    }
 }
 
+static void
+apply_correction(void)
+{
+   if (!ctx.prefetch.started)
+      return;
+
+   pthread_mutex_lock(&ctx.prefetch.mutex);
+   const size_t c = ctx.prefetch.correction;
+   const struct prefetch_slot *slot = (c < ARRAY_SIZE(ctx.prefetch.slots) ? &ctx.prefetch.slots[c] : NULL);
+   if (!slot || slot->state != SLOT_READY) {
+      pthread_mutex_unlock(&ctx.prefetch.mutex);
+      return;
+   }
+
+   ctx.prefetch.correction = (size_t)~0;
+
+   // only applies if the view hasn't moved since, changes against the read-ahead copy are highlighted
+   const struct named_region *named = named_region_for_offset(ctx.hexview.offset, false);
+   const size_t bs = bytes_fits_screen(), start = named->region.start + ctx.hexview.scroll, len = named->region.end - start;
+   const bool applies = (slot->start == start && slot->len == (bs > len ? len : bs));
+   if (applies) {
+      memcpy(ctx.hexview.memory[1].data, ctx.hexview.memory[0].data, ctx.hexview.memory[0].mapped);
+      memcpy(ctx.hexview.memory[0].data, slot->data, slot->mapped);
+      ctx.hexview.memory[0].mapped = slot->mapped;
+      update_fade(false);
+   }
+
+   pthread_mutex_unlock(&ctx.prefetch.mutex);
+
+   if (applies)
+      repaint_hexview(named, false);
+}
+
+static size_t
+search_lower_bound(const size_t offset)
+{
+   // hits are sorted, must be called with the mutex held
+   size_t lo = 0, hi = ctx.search.num_hits;
+   while (lo < hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (ctx.search.hits[mid] < offset)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+
 static void
 repaint_bottom_bar(void)
 {
    screen_cursor(0, ctx.term.ws.h);
-   screen_print(ESCA CLEAR_LINE);
+   screen_clear_line();
    screen_nprintf(ctx.term.ws.w, "%zx", ctx.hexview.offset);
 
+   const char *symbol;
+   size_t symbol_off;
+   if (symbol_for_offset(named_region_for_offset(ctx.hexview.offset, false), ctx.hexview.offset, &symbol, &symbol_off)) {
+      screen_format(ATTR_CYAN);
+      if (symbol_off > 0)
+         screen_nprintf(ctx.term.ws.w - ctx.term.cur.x * (ctx.term.cur.x < ctx.term.ws.w), " %s+%zx", symbol, symbol_off);
+      else
+         screen_nprintf(ctx.term.ws.w - ctx.term.cur.x * (ctx.term.cur.x < ctx.term.ws.w), " %s", symbol);
+      screen_format(ATTR_PLAIN);
+   }
+
+   if (ctx.search.started) {
+      pthread_mutex_lock(&ctx.search.mutex);
+      const size_t hit = search_lower_bound(ctx.hexview.offset);
+      const bool on_hit = (hit < ctx.search.num_hits && ctx.search.hits[hit] == ctx.hexview.offset);
+      const size_t num_hits = ctx.search.num_hits;
+      pthread_mutex_unlock(&ctx.search.mutex);
+
+      const bool running = __atomic_load_n(&ctx.search.running, __ATOMIC_ACQUIRE);
+      screen_format(ATTR_YELLOW);
+      if (on_hit)
+         screen_nprintf(ctx.term.ws.w - ctx.term.cur.x * (ctx.term.cur.x < ctx.term.ws.w), " hit %zu/%zu%s", hit + 1, num_hits, (running ? "..." : ""));
+      else
+         screen_nprintf(ctx.term.ws.w - ctx.term.cur.x * (ctx.term.cur.x < ctx.term.ws.w), " %zu hits%s", num_hits, (running ? "..." : ""));
+      screen_format(ATTR_PLAIN);
+   }
+
    {
       const union selection v = get_selection();
       size_t strlen = snprintf(NULL, 0, "[%u] [%u] [%u] [%lu]", v.u8, v.u16, v.u32, v.u64);
@@ -535,6 +1197,8 @@ repaint_dynamic_areas(const bool full_repaint)
       ctx.last_hexview.scroll = (size_t)~0; // avoid diffing
    }
 
+   repaint_stats(named);
+
    if (memcmp(&ctx.hexview, &ctx.last_hexview, sizeof(ctx.hexview))) {
       repaint_hexview(named, (full_repaint || named != last_active));
       ctx.last_hexview = ctx.hexview;
@@ -547,7 +1211,7 @@ static void
 repaint(void)
 {
    ctx.last_hexview.scroll = (size_t)~0; // avoid diffing
-   screen_print(ESCA TERM_CLEAR FMT(PLAIN));
+   screen_clear();
    repaint_static_areas();
    repaint_top_bar(named_region_for_offset(ctx.hexview.offset, false));
    repaint_dynamic_areas(true);
@@ -555,10 +1219,8 @@ repaint(void)
 }
 
 static void
-resize(int sig)
+resize(void)
 {
-   signal(sig, SIG_IGN);
-
    struct winsize ws;
    ioctl(TERM_FILENO, TIOCGWINSZ, &ws);
    ctx.term.ws.w = (ws.ws_col > 0 ? ws.ws_col : 0);
@@ -570,25 +1232,163 @@ resize(int sig)
          err(EXIT_FAILURE, "malloc");
    }
 
+   free(ctx.diff.data); ctx.diff.data = NULL;
+   if (ctx.diff.enabled && !(ctx.diff.data = malloc(bytes_fits_screen())))
+      err(EXIT_FAILURE, "malloc");
+
+   free(ctx.live.fade); ctx.live.fade = NULL;
+   if (!(ctx.live.fade = calloc(1, bytes_fits_screen() + 1)))
+      err(EXIT_FAILURE, "calloc");
+
+   for (size_t i = 0; i < ARRAY_SIZE(ctx.screen.cells); ++i) {
+      free(ctx.screen.cells[i]); ctx.screen.cells[i] = NULL;
+      if (!(ctx.screen.cells[i] = malloc(sizeof(struct cell) * (ctx.term.ws.w * (ctx.term.ws.h + 1) + 1))))
+         err(EXIT_FAILURE, "malloc");
+   }
+
+   // a row is at most a quarter of the width in bytes, as each byte takes a hex cell pair, a space and a chr cell
+   free(ctx.screen.text); ctx.screen.text = NULL;
+   if (!(ctx.screen.text = malloc(ctx.term.ws.w * 3 + 1)))
+      err(EXIT_FAILURE, "malloc");
+
    ctx.screen.pointer = 0;
-   ctx.screen.size = ((ctx.term.ws.w * 2) * (ctx.term.ws.h * 2)); // bit extra for formatting
+   ctx.screen.size = 64 * 1024; // flushed in pieces if a frame needs more
+   ctx.screen.invalid = true;
    free(ctx.screen.data); ctx.screen.data = NULL;
    if (!(ctx.screen.data = malloc(ctx.screen.size)))
       err(EXIT_FAILURE, "malloc");
 
    repaint();
-   signal(sig, resize);
+}
+
+static void
+sigwinch(int sig)
+{
+   // buffers are only reallocated by the main loop, the handler just wakes it up
+   (void)sig;
+   const int saved = errno;
+   ctx.term.resized = true;
+   wake_main_loop();
+   errno = saved;
+}
+
+static void
+start_thread(pthread_t *thread, void* (*fun)(void*))
+{
+   // signals are handled by the main thread only, as the handlers use its state
+   sigset_t all, old;
+   sigfillset(&all);
+   pthread_sigmask(SIG_SETMASK, &all, &old);
+   const int ret = pthread_create(thread, NULL, fun, NULL);
+   pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+   if (ret != 0)
+      errx(EXIT_FAILURE, "pthread_create: %s", strerror(ret));
+}
+
+static bool
+region_is_readable(const struct named_region *named)
+{
+   char perms[5] = {0};
+   return (sscanf(named->name, "%*s %4s", perms) == 1 && perms[0] == 'r');
+}
+
+static void
+search_push(const size_t offset)
+{
+   const size_t step = 1024, max_hits = 1024 * 1024;
+   pthread_mutex_lock(&ctx.search.mutex);
+   if (ctx.search.num_hits < max_hits && (ctx.search.num_hits < ctx.search.allocated_hits ||
+       (ctx.search.hits = realloc(ctx.search.hits, sizeof(*ctx.search.hits) * (ctx.search.allocated_hits += step)))))
+      ctx.search.hits[ctx.search.num_hits++] = offset;
+   pthread_mutex_unlock(&ctx.search.mutex);
+}
+
+
+static void*
+search_thread(void *arg)
+{
+   (void)arg;
+   const size_t chunk = 1024 * 1024, overlap = ctx.search.needle_len - 1;
+
+   unsigned char *buf;
+   if (!(buf = malloc(chunk + overlap)))
+      goto out;
+
+   // regions are in address order, so hits come out sorted
+   for (size_t i = 1; i < ctx.num_regions && !__atomic_load_n(&ctx.search.cancel, __ATOMIC_RELAXED); ++i) {
+      const struct named_region *named = &ctx.named[i];
+      if (!region_is_readable(named))
+         continue;
+
+      for (size_t off = named->region.start; off <= named->region.end && !__atomic_load_n(&ctx.search.cancel, __ATOMIC_RELAXED); off += chunk) {
+         const size_t left = named->region.end - off + 1, len = (left > chunk + overlap ? chunk + overlap : left);
+         const size_t rd = ctx.io.read(&ctx.io, buf, off, len);
+
+         const size_t num_hits = ctx.search.num_hits;
+         for (const unsigned char *s = buf, *m; s < buf + rd && (m = bin_search(s, rd - (s - buf), ctx.search.needle, ctx.search.needle_len)); s = m + 1) {
+            // matches in the overlap are found by the next chunk
+            if ((size_t)(m - buf) >= chunk)
+               break;
+            search_push(off + (m - buf));
+         }
+
+         if (num_hits != ctx.search.num_hits)
+            wake_main_loop();
+      }
+   }
+
+   free(buf);
+
+out:
+   __atomic_store_n(&ctx.search.running, false, __ATOMIC_RELEASE);
+   wake_main_loop();
+   return NULL;
+}
+
+static void
+search_cancel(void)
+{
+   // started stays set while hits are shown, joinable only until the thread is joined
+   if (!ctx.search.joinable)
+      return;
+
+   __atomic_store_n(&ctx.search.cancel, true, __ATOMIC_RELAXED);
+   pthread_join(ctx.search.thread, NULL);
+   ctx.search.joinable = false;
+   __atomic_store_n(&ctx.search.cancel, false, __ATOMIC_RELAXED);
+}
+
+static void
+search_start(const unsigned char *needle, const size_t needle_len)
+{
+   search_cancel();
+
+   pthread_mutex_lock(&ctx.search.mutex);
+   ctx.search.num_hits = 0;
+   pthread_mutex_unlock(&ctx.search.mutex);
+
+   memcpy(ctx.search.needle, needle, needle_len);
+   ctx.search.needle_len = needle_len;
+   ctx.search.running = true;
+
+   start_thread(&ctx.search.thread, search_thread);
+   ctx.search.started = ctx.search.joinable = true;
 }
 
 static void
 next_region(void *ptr)
 {
+   search_cancel();
+
+   // relative to the offset rather than active region, merged repeats run before the active region is updated
    intptr_t arg = (intptr_t)ptr;
+   const size_t active = (size_t)(named_region_for_offset(ctx.hexview.offset, false) - ctx.named);
    size_t region;
-   if (arg < 0 && ctx.active_region < (size_t)(arg * -1))
-      region = ctx.num_regions - ((arg * -1) - ctx.active_region);
+   if (arg < 0 && active < (size_t)(arg * -1))
+      region = ctx.num_regions - ((arg * -1) - active);
    else
-      region = (ctx.active_region + arg) % ctx.num_regions;
+      region = (active + arg) % ctx.num_regions;
    region = (!region ? (arg < 0 ? ctx.num_regions - 1 : 1) : region);
    ctx.hexview.offset = ctx.named[region].region.start;
 }
@@ -654,11 +1454,13 @@ __attribute__((format(printf, 1, 2)))
 error(const char *fmt, ...)
 {
    screen_cursor(0, ctx.term.ws.h);
-   screen_print(ESCA CLEAR_LINE);
-   screen_nprint(ctx.term.ws.w + sizeof(FMT(FG RED) FMT(PLAIN)), FMT(FG RED) "error: " FMT(PLAIN));
+   screen_clear_line();
+   screen_format(ATTR_RED);
+   screen_nprint(ctx.term.ws.w, "error: ");
+   screen_format(ATTR_PLAIN);
    va_list ap; va_start(ap, fmt); screen_vnprintf(ctx.term.ws.w - sizeof("error:"), fmt, ap); va_end(ap);
    screen_flush();
-   for (char input = 0; input == 0;) (void)! fread(&input, 1, 1, TERM_STREAM);
+   for (unsigned char input = 0; input == 0 && term_byte(&input););
 }
 
 static void
@@ -695,24 +1497,28 @@ input(const char *prompt)
    memset(&ctx.input, 0, sizeof(ctx.input));
    while (true) {
       screen_cursor(0, ctx.term.ws.h);
-      screen_print(ESCA CLEAR_LINE FMT(FG YELLOW));
+      screen_clear_line();
+      screen_format(ATTR_YELLOW);
       screen_nprintf(ctx.term.ws.w, "%s: ", prompt);
-      screen_print(FMT(PLAIN));
+      screen_format(ATTR_PLAIN);
 
       const size_t plen = strlen(prompt) + 2;
       const size_t mlen = ctx.term.ws.w - plen * (ctx.term.ws.w > plen);
       for (const char *c = ctx.input.data; c < ctx.input.data + mlen && *c; ++c) {
          if (c == ctx.input.data + ctx.input.pointer)
-            screen_format(FMT(REVERSE));
+            screen_format(ATTR_REVERSE);
 
          screen_putc(*c);
 
          if (c == ctx.input.data + ctx.input.pointer)
-            screen_format(FMT(PLAIN));
+            screen_format(ATTR_PLAIN);
       }
 
-      if (ctx.input.pointer >= strlen(ctx.input.data))
-         screen_print(FMT(REVERSE) " " FMT(PLAIN));
+      if (ctx.input.pointer >= strlen(ctx.input.data)) {
+         screen_format(ATTR_REVERSE);
+         screen_putc(' ');
+         screen_format(ATTR_PLAIN);
+      }
 
       screen_flush();
 
@@ -757,12 +1563,32 @@ goto_offset(void *arg)
    if (!(v = input("offset")))
       return;
 
+   search_cancel();
+
    char *invalid;
    const bool is_plus = (v[0] == '+');
    const bool is_minus = (v[0] == '-');
-   const size_t ret = hexdecstrtoull(v + (is_plus || is_minus), &invalid);
+   size_t ret = hexdecstrtoull(v + (is_plus || is_minus), &invalid);
+
+   // anything that isn't a number is a symbol, optionally followed by +offset
+   if (*invalid != 0 && !is_plus && !is_minus) {
+      char name[sizeof(ctx.input.data)];
+      snprintf(name, sizeof(name), "%s", v);
+
+      char *add;
+      size_t add_off = 0;
+      if ((add = strchr(name, '+'))) {
+         *add = 0;
+         add_off = hexdecstrtoull(add + 1, &invalid);
+      }
+
+      if ((add && *invalid != 0) || !symbol_address(name, &ret)) {
+         error("invalid offset or unknown symbol `%s`", v);
+         return;
+      }
 
-   if (*invalid != 0) {
+      ret += add_off;
+   } else if (*invalid != 0) {
       error("invalid offset `%s`", v);
       return;
    }
@@ -782,6 +1608,7 @@ static void
 follow(void *arg)
 {
    (void)arg;
+   search_cancel();
    store_offset(ctx.hexview.offset);
    const union selection v = get_selection();
    switch (ctx.native_bits) {
@@ -799,38 +1626,247 @@ undo(void *arg)
    if (!ctx.undo.pointer)
       return;
 
+   search_cancel();
    ctx.hexview.offset = ctx.undo.data[0];
    memmove(ctx.undo.data, ctx.undo.data + 1, --ctx.undo.pointer * sizeof(ctx.undo.data[0]));
 }
 
+static uint64_t
+now_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static void
-write_bytes(void *arg)
+set_refresh_rate(const double hz)
+{
+   ctx.live.hz = (hz < MIN_HZ ? MIN_HZ : (hz > MAX_HZ ? MAX_HZ : hz));
+
+   const double fade = ctx.live.hz * FADE_SECONDS + 0.5;
+   ctx.live.fade_frames = (fade < 3 ? 3 : (unsigned char)fade);
+
+   const long ns = 1e9 / ctx.live.hz;
+   const struct itimerspec spec = {
+      .it_interval = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 },
+      .it_value = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 },
+   };
+
+   if (ctx.live.timer != -1 && timerfd_settime(ctx.live.timer, 0, &spec, NULL) != 0)
+      err(EXIT_FAILURE, "timerfd_settime");
+
+   ctx.frame.interval = 1e9 / (ctx.live.hz > FRAME_HZ ? ctx.live.hz : FRAME_HZ);
+}
+
+static void
+scale_refresh_rate(void *arg)
+{
+   const intptr_t dir = (intptr_t)arg;
+   set_refresh_rate(dir > 0 ? ctx.live.hz * 2 : ctx.live.hz / 2);
+}
+
+static void
+toggle_stats(void *arg)
 {
    (void)arg;
-   const char *v;
-   if (!(v = input("bytes")))
-      return;
+   ctx.screen.stats.show = !ctx.screen.stats.show;
 
-   unsigned char bytes[255] = {0}, i = 0;
-   for (const char *s = skip_ws(v); i < sizeof(bytes) && *s; s += 2, s += !!isspace(*s)) {
+   if (!ctx.screen.stats.show)
+      repaint_top_bar(named_region_for_offset(ctx.hexview.offset, false));
+}
+
+static bool
+parse_hex_bytes(const char *v, unsigned char bytes[255], unsigned char *out_len)
+{
+   unsigned char i = 0;
+   for (const char *s = skip_ws(v); i < 255 && *s; s += 2, s += !!isspace(*s)) {
       unsigned int x;
       if (!sscanf(s, "%2x", &x)) {
          error("invalid input `%s`", v);
-         return;
+         return false;
       }
-      if (i >= sizeof(bytes)) {
+      if (i >= 255) {
          error("input is too long, sorry :( (max 255 bytes)");
-         return;
+         return false;
       }
       bytes[i++] = x;
    }
+   *out_len = i;
+   return true;
+}
+
+static void
+write_bytes(void *arg)
+{
+   (void)arg;
+   const char *v;
+   if (!(v = input("bytes")))
+      return;
+
+   unsigned char bytes[255] = {0}, i = 0;
+   if (!parse_hex_bytes(v, bytes, &i))
+      return;
 
    ctx.io.write(&ctx.io, bytes, ctx.hexview.offset, i);
 }
 
+static bool
+parse_typed_value(const char *v, unsigned char bytes[255], unsigned char *out_len)
+{
+   // u8:1 i16:-1 u32:0x10 u64:... f32:1.5 f64:1.5, in native byte order
+   char type[4] = {0};
+   int n = 0;
+   if (sscanf(v, "%3[uif0-9]:%n", type, &n) != 1 || !n)
+      return false;
+
+   char *invalid;
+   const char *value = v + n;
+   union { uint8_t u8; uint16_t u16; uint32_t u32; uint64_t u64; float f32; double f64; } t;
+   if (type[0] == 'f') {
+      const double d = strtod(value, &invalid);
+      if (!strcmp(type, "f32")) {
+         t.f32 = d; *out_len = sizeof(t.f32);
+      } else if (!strcmp(type, "f64")) {
+         t.f64 = d; *out_len = sizeof(t.f64);
+      } else {
+         return false;
+      }
+   } else {
+      const uint64_t u = (type[0] == 'i' ? (uint64_t)strtoll(value, &invalid, 0) : strtoull(value, &invalid, 0));
+      if (!strcmp(type + 1, "8")) {
+         t.u8 = u; *out_len = sizeof(t.u8);
+      } else if (!strcmp(type + 1, "16")) {
+         t.u16 = u; *out_len = sizeof(t.u16);
+      } else if (!strcmp(type + 1, "32")) {
+         t.u32 = u; *out_len = sizeof(t.u32);
+      } else if (!strcmp(type + 1, "64")) {
+         t.u64 = u; *out_len = sizeof(t.u64);
+      } else {
+         return false;
+      }
+   }
+
+   if (*invalid != 0 || invalid == value)
+      return false;
+
+   memcpy(bytes, &t, *out_len);
+   return true;
+}
+
+static void
+search(void *arg)
+{
+   (void)arg;
+   const char *v;
+   if (!(v = input("search (hex bytes, \"string or u8..u64/i8..i64/f32/f64:value)")))
+      return;
+
+   unsigned char bytes[255] = {0}, len = 0;
+   if (v[0] == '"') {
+      const char *end = strchr(v + 1, '"');
+      len = (end ? (size_t)(end - v - 1) : strlen(v + 1));
+      memcpy(bytes, v + 1, len);
+   } else if (strchr(v, ':')) {
+      if (!parse_typed_value(v, bytes, &len)) {
+         error("invalid typed value `%s`", v);
+         return;
+      }
+   } else if (!parse_hex_bytes(v, bytes, &len)) {
+      return;
+   }
+
+   if (!len)
+      return;
+
+   search_start(bytes, len);
+}
+
+static void
+search_jump(void *arg)
+{
+   const intptr_t dir = (intptr_t)arg;
+   pthread_mutex_lock(&ctx.search.mutex);
+
+   // wraps around at either end
+   if (ctx.search.num_hits > 0) {
+      size_t hit = search_lower_bound(ctx.hexview.offset);
+      if (dir > 0) {
+         hit += (hit < ctx.search.num_hits && ctx.search.hits[hit] == ctx.hexview.offset);
+         hit = (hit < ctx.search.num_hits ? hit : 0);
+      } else {
+         hit = (hit > 0 ? hit - 1 : ctx.search.num_hits - 1);
+      }
+      store_offset(ctx.hexview.offset);
+      ctx.hexview.offset = ctx.search.hits[hit];
+   }
+
+   pthread_mutex_unlock(&ctx.search.mutex);
+}
+
+static void
+next_difference(void *arg)
+{
+   (void)arg;
+   if (!ctx.diff.enabled) {
+      error("nothing to diff against, start with -d");
+      return;
+   }
+
+   // both sources are compared in large chunks instead of screen by screen
+   const size_t chunk = 4 * 1024 * 1024;
+   unsigned char *a, *b;
+   if (!(a = malloc(chunk)) || !(b = malloc(chunk))) {
+      free(a);
+      error("out of memory");
+      return;
+   }
+
+   bool found = false;
+   const struct named_region *named = named_region_for_offset(ctx.hexview.offset, false);
+   for (size_t off = ctx.hexview.offset + 1; !found && off > ctx.hexview.offset && off <= named->region.end;) {
+      const size_t left = named->region.end - off + 1, len = (left > chunk ? chunk : left);
+      const size_t ra = ctx.io.read(&ctx.io, a, off, len), rb = ctx.diff.io.read(&ctx.diff.io, b, off, len);
+      const size_t n = (ra < rb ? ra : rb), m = bin_mismatch(a, b, n);
+
+      // memory that is readable on one side only counts as a difference
+      if (m < n || ra != rb) {
+         store_offset(ctx.hexview.offset);
+         ctx.hexview.offset = off + m;
+         found = true;
+      } else if (n < len) {
+         break;
+      }
+
+      off += len;
+   }
+
+   free(a);
+   free(b);
+
+   if (!found)
+      error("no differences until the end of the region");
+}
+
 static void
 quit(void)
 {
+   search_cancel();
+   free(ctx.search.hits);
+
+   prefetch_stop();
+   symbols_stop();
+
+   if (ctx.diff.enabled)
+      mem_io_release(&ctx.diff.io);
+
+   free(ctx.diff.data);
+
+   for (size_t i = 0; i < ARRAY_SIZE(ctx.wake); ++i) {
+      if (ctx.wake[i] != -1)
+         close(ctx.wake[i]);
+   }
+
    for (size_t i = 1; i < ctx.num_regions; ++i)
       free((char*)ctx.named[i].name);
 
@@ -839,6 +1875,15 @@ quit(void)
    for (size_t i = 0; i < ARRAY_SIZE(ctx.hexview.memory); ++i)
       free(ctx.hexview.memory[i].data);
 
+   for (size_t i = 0; i < ARRAY_SIZE(ctx.screen.cells); ++i)
+      free(ctx.screen.cells[i]);
+
+   free(ctx.live.fade);
+
+   if (ctx.live.timer != -1)
+      close(ctx.live.timer);
+
+   free(ctx.screen.text);
    free(ctx.screen.data);
 
    if (!memcmp(&ctx.term.initial, &ctx.term.current, sizeof(ctx.term.initial)))
@@ -902,6 +1947,36 @@ grow_regions_if_needed(void)
       err(EXIT_FAILURE, "realloc");
 }
 
+static size_t
+module_for_line(const char *line)
+{
+   // regions of a file are a module, and so is the vdso which only exists in memory
+   struct mem_region region;
+   if (!mem_region_parse(&region, line) || (region.path[0] != '/' && strcmp(region.path, "[vdso]")))
+      return 0;
+
+   size_t i = 0;
+   for (; i < ctx.symbols.num_modules && strcmp(ctx.symbols.modules[i].path, region.path); ++i);
+
+   if (i == ctx.symbols.num_modules) {
+      const size_t step = 64;
+      if (ctx.symbols.num_modules >= ctx.symbols.allocated_modules &&
+          !(ctx.symbols.modules = realloc(ctx.symbols.modules, sizeof(*ctx.symbols.modules) * (ctx.symbols.allocated_modules += step))))
+         err(EXIT_FAILURE, "realloc");
+
+      char *path;
+      if (!(path = strdup(region.path)))
+         err(EXIT_FAILURE, "strdup");
+
+      ctx.symbols.modules[ctx.symbols.num_modules++] = (struct module){ .path = path, .base = (size_t)~0 };
+   }
+
+   if (region.offset == 0 && region.start < ctx.symbols.modules[i].base)
+      ctx.symbols.modules[i].base = region.start;
+
+   return i + 1;
+}
+
 static void
 region_cb(const char *line, void *data)
 {
@@ -926,21 +2001,41 @@ region_cb(const char *line, void *data)
 
    snprintf(name, name_sz, "%.*s %s", region_len_without_name, line, base);
    ctx.active_region = (strstr(name, "[heap]") ? ctx.num_regions : ctx.active_region);
+   ctx.named[ctx.num_regions].module = module_for_line(line);
    ctx.named[ctx.num_regions++].name = name;
 }
 
 int
 main(int argc, char *argv[])
 {
+   const char *diff = NULL;
+   while (argc > 2 && argv[1][0] == '-') {
+      if (!strcmp(argv[1], "-r")) {
+         char *invalid;
+         const double hz = strtod(argv[2], &invalid);
+         if (*invalid != 0 || !(hz > 0))
+            errx(EXIT_FAILURE, "invalid refresh rate `%s`", argv[2]);
+
+         set_refresh_rate(hz);
+      } else if (!strcmp(argv[1], "-d")) {
+         diff = argv[2];
+      } else {
+         usage(argv[0]);
+      }
+      argv += 2; argc -= 2;
+   }
+
    if (argc < 2)
       usage(argv[0]);
 
-   const pid_t pid = strtoull(argv[1], NULL, 10);
+   char *invalid;
+   const pid_t pid = strtoull(argv[1], &invalid, 10);
+   const bool is_snapshot = (*invalid != 0);
 
    FILE *regions_file = NULL;
    if (argc > 2 && !(regions_file = fopen(argv[2], "rb"))) {
       err(EXIT_FAILURE, "fopen(%s)", argv[2]);
-   } else if (argc == 2) {
+   } else if (argc == 2 && !is_snapshot) {
       char path[128];
       snprintf(path, sizeof(path), "/proc/%u/maps", pid);
       if (!(regions_file = fopen(path, "rb")))
@@ -951,61 +2046,163 @@ main(int argc, char *argv[])
    grow_regions_if_needed();
    ctx.named[0] = (struct named_region){ .region = { .start = 0, .end = (size_t)~0 }, .name = "unknown" };
 
-   mem_io_uio_init(&ctx.io, pid);
-   for_each_token_in_file(regions_file, '\n', region_cb, NULL);
-   fclose(regions_file);
+   if (is_snapshot) {
+      if (!mem_io_snapshot_init(&ctx.io, argv[1]))
+         exit(EXIT_FAILURE);
+   } else {
+      mem_io_uio_init(&ctx.io, pid);
+   }
+
+   if (diff) {
+      const pid_t diff_pid = strtoull(diff, &invalid, 10);
+      if (*invalid != 0 ? !mem_io_snapshot_init(&ctx.diff.io, diff) : !mem_io_uio_init(&ctx.diff.io, diff_pid))
+         exit(EXIT_FAILURE);
+
+      ctx.diff.enabled = true;
+   }
+
+   if (regions_file) {
+      for_each_token_in_file(regions_file, '\n', region_cb, NULL);
+      fclose(regions_file);
+   } else {
+      for_each_token_in_str(mem_io_snapshot_maps(&ctx.io), '\n', region_cb, NULL);
+   }
    ctx.hexview.offset = ctx.named[ctx.active_region].region.start;
 
+   if ((ctx.live.timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+      err(EXIT_FAILURE, "timerfd_create");
+
+   set_refresh_rate(ctx.live.hz);
+
+   // non-blocking, a full pipe already wakes the main loop and writers may hold locks
+   if (pipe(ctx.wake) != 0)
+      err(EXIT_FAILURE, "pipe");
+
+   for (size_t i = 0; i < ARRAY_SIZE(ctx.wake); ++i) {
+      if (fcntl(ctx.wake[i], F_SETFL, O_NONBLOCK) == -1 || fcntl(ctx.wake[i], F_SETFD, FD_CLOEXEC) == -1)
+         err(EXIT_FAILURE, "fcntl");
+   }
+
+   start_thread(&ctx.prefetch.thread, prefetch_thread);
+   ctx.prefetch.started = true;
+
+   start_thread(&ctx.symbols.thread, symbols_thread);
+   ctx.symbols.started = true;
+
    init();
-   signal(SIGWINCH, resize);
-   resize(0);
+   signal(SIGWINCH, sigwinch);
+   resize();
 
    const struct action actions[] = {
-      { .seq = { 0x1b, '[', '1', ';', '2', 'C', 0 }, .fun = next_region, .arg = 1 },
-      { .seq = { 0x1b, '[', '1', ';', '2', 'D', 0 }, .fun = next_region, .arg = -1 },
-      { .seq = { 0x1b, '[', '5', '~', 0 }, .fun = navigate, .arg = MOVE_PAGE_UP },
-      { .seq = { 0x1b, '[', '6', '~', 0 }, .fun = navigate, .arg = MOVE_PAGE_DOWN },
+      { .seq = { 0x1b, '[', '1', ';', '2', 'C', 0 }, .fun = next_region, .arg = 1, .merges = true },
+      { .seq = { 0x1b, '[', '1', ';', '2', 'D', 0 }, .fun = next_region, .arg = -1, .merges = true },
+      { .seq = { 0x1b, '[', '5', '~', 0 }, .fun = navigate, .arg = MOVE_PAGE_UP, .merges = true },
+      { .seq = { 0x1b, '[', '6', '~', 0 }, .fun = navigate, .arg = MOVE_PAGE_DOWN, .merges = true },
       { .seq = { 0x1b, '[', 'H', 0 }, .fun = navigate, .arg = MOVE_START },
       { .seq = { 0x1b, '[', 'F', 0 }, .fun = navigate, .arg = MOVE_END },
-      { .seq = { 0x1b, '[', 'A', 0 }, .fun = navigate, .arg = MOVE_UP },
-      { .seq = { 0x1b, '[', 'B', 0 }, .fun = navigate, .arg = MOVE_DOWN },
-      { .seq = { 0x1b, '[', 'C', 0 }, .fun = navigate, .arg = MOVE_RIGHT },
-      { .seq = { 0x1b, '[', 'D', 0 }, .fun = navigate, .arg = MOVE_LEFT },
+      { .seq = { 0x1b, '[', 'A', 0 }, .fun = navigate, .arg = MOVE_UP, .merges = true },
+      { .seq = { 0x1b, '[', 'B', 0 }, .fun = navigate, .arg = MOVE_DOWN, .merges = true },
+      { .seq = { 0x1b, '[', 'C', 0 }, .fun = navigate, .arg = MOVE_RIGHT, .merges = true },
+      { .seq = { 0x1b, '[', 'D', 0 }, .fun = navigate, .arg = MOVE_LEFT, .merges = true },
       { .seq = { 'q', 0 }, .fun = q_quit },
       { .seq = { 'o', 0 }, .fun = goto_offset },
       { .seq = { 'f', 0 }, .fun = follow },
       { .seq = { 'u', 0 }, .fun = undo },
       { .seq = { 'w', 0 }, .fun = write_bytes },
+      { .seq = { 's', 0 }, .fun = toggle_stats },
+      { .seq = { '/', 0 }, .fun = search },
+      { .seq = { 'n', 0 }, .fun = search_jump, .arg = 1 },
+      { .seq = { 'd', 0 }, .fun = next_difference },
+      { .seq = { 'N', 0 }, .fun = search_jump, .arg = -1 },
+      { .seq = { '+', 0 }, .fun = scale_refresh_rate, .arg = 1 },
+      { .seq = { '-', 0 }, .fun = scale_refresh_rate, .arg = -1 },
    };
 
    while (true) {
       fd_set set;
       FD_ZERO(&set);
       FD_SET(TERM_FILENO, &set);
-      struct timeval timeout = { .tv_sec = 1 };
-      if (select(TERM_FILENO + 1, &set, NULL, NULL, &timeout) < 0) {
+      FD_SET(ctx.live.timer, &set);
+
+      FD_SET(ctx.wake[0], &set);
+
+      int nfds = (TERM_FILENO > ctx.live.timer ? TERM_FILENO : ctx.live.timer);
+      nfds = (nfds > ctx.wake[0] ? nfds : ctx.wake[0]);
+
+      // a dirty screen is drawn once its frame is due, so a flood of keys costs a frame per interval
+      const uint64_t now = now_ns(), due = ctx.frame.last + ctx.frame.interval;
+      const uint64_t wait = (due > now ? due - now : 0);
+      struct timeval timeout = { .tv_sec = wait / 1000000000, .tv_usec = wait % 1000000000 / 1000 };
+
+      if (select(nfds + 1, &set, NULL, NULL, (ctx.frame.dirty ? &timeout : NULL)) < 0) {
          if (errno == EINTR)
             continue;
 
          err(EXIT_FAILURE, "select");
       }
 
-      if (!FD_ISSET(TERM_FILENO, &set)) {
-         // timeout
-         repaint_hexview(named_region_for_offset(ctx.hexview.offset, false), true);
-         repaint_bottom_bar();
-         screen_flush();
-         continue;
+      if (FD_ISSET(TERM_FILENO, &set)) {
+         // every pending key is handled before drawing, merging keys wait until a different key or the end of input
+         const struct action *merging = NULL;
+         size_t repeat = 0;
+         do {
+            struct key key = {0};
+            if (!get_key(&key))
+               goto quit;
+
+            const struct action *action = key_action(&key, actions, ARRAY_SIZE(actions));
+            ctx.last_key = key;
+
+            if (action && action == merging) {
+               ++repeat;
+               continue;
+            }
+
+            for (; merging && repeat > 0; --repeat)
+               merging->fun((void*)merging->arg);
+
+            merging = (action && action->merges ? action : NULL);
+            repeat = !!merging;
+
+            if (action && !action->merges)
+               action->fun((void*)action->arg);
+         } while (term_input_pending());
+
+         for (; merging && repeat > 0; --repeat)
+            merging->fun((void*)merging->arg);
+
+         ctx.frame.dirty = true;
       }
 
-      struct key key = {0};
-      if (!get_key(&key))
-         goto quit;
+      if (FD_ISSET(ctx.live.timer, &set)) {
+         // missed ticks are dropped, only the visible bytes are read once per tick, a moved view is read when drawn
+         uint64_t expirations;
+         if (read(ctx.live.timer, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            if (!memcmp(&ctx.hexview, &ctx.last_hexview, sizeof(ctx.hexview)))
+               repaint_hexview(named_region_for_offset(ctx.hexview.offset, false), true);
+            ctx.frame.dirty = true;
+         }
+      }
 
-      key_press(&key, actions, ARRAY_SIZE(actions));
-      ctx.last_key = key;
-      repaint_dynamic_areas(false);
-      screen_flush();
+      if (FD_ISSET(ctx.wake[0], &set)) {
+         char drain[64];
+         while (read(ctx.wake[0], drain, sizeof(drain)) == sizeof(drain));
+
+         if (ctx.term.resized) {
+            ctx.term.resized = false;
+            resize();
+         }
+
+         apply_correction();
+         ctx.frame.dirty = true;
+      }
+
+      if (ctx.frame.dirty && now_ns() >= ctx.frame.last + ctx.frame.interval) {
+         repaint_dynamic_areas(false);
+         screen_flush();
+         ctx.frame.last = now_ns();
+         ctx.frame.dirty = false;
+      }
    }
 
 quit:
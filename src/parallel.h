@@ -0,0 +1,50 @@
+#pragma once
+
+#include <pthread.h>
+#include <unistd.h>
+#include <err.h>
+
+// Tiny parallel for, workers pull indices from a shared counter until nmemb is reached.
+// The calling thread works as well, so nmemb of 1 never spawns anything.
+
+struct parallel {
+   void (*fun)(const size_t i, void *data);
+   void *data;
+   size_t next, nmemb;
+};
+
+static inline size_t
+parallel_threads(void)
+{
+   const long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+   return (nproc > 64 ? 64 : (nproc < 1 ? 1 : nproc));
+}
+
+static inline void*
+parallel_worker(void *arg)
+{
+   struct parallel *p = arg;
+   for (size_t i; (i = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED)) < p->nmemb;)
+      p->fun(i, p->data);
+   return NULL;
+}
+
+static inline void
+parallel_for(const size_t nmemb, void (*fun)(const size_t i, void *data), void *data)
+{
+   struct parallel p = { .fun = fun, .data = data, .nmemb = nmemb };
+
+   pthread_t threads[64];
+   size_t spawned = 0;
+   for (const size_t n = parallel_threads(); spawned + 1 < n && spawned + 1 < nmemb; ++spawned) {
+      if (pthread_create(&threads[spawned], NULL, parallel_worker, &p) != 0) {
+         warnx("pthread_create failed, continuing with %zu threads", spawned + 1);
+         break;
+      }
+   }
+
+   parallel_worker(&p);
+
+   for (size_t i = 0; i < spawned; ++i)
+      pthread_join(threads[i], NULL);
+}
@@ -0,0 +1,11 @@
+#include "cli/cli.h"
+#include "mem/io.h"
+
+// This brute-map uses ptrace
+// The process is stopped only once while every zero offset region is read, searching happens after detaching.
+
+int
+main(int argc, const char *argv[])
+{
+   return proc_brute_map(argc, argv, mem_io_ptrace_init);
+}
@@ -0,0 +1,11 @@
+#include "cli/cli.h"
+#include "mem/io.h"
+
+// This memscan uses ptrace
+// The process is stopped for the duration of each scan, so values can't change halfway through.
+
+int
+main(int argc, const char *argv[])
+{
+   return proc_memscan(argc, argv, mem_io_ptrace_init);
+}
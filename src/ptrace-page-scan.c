@@ -0,0 +1,11 @@
+#include "cli/cli.h"
+#include "mem/io.h"
+
+// This page-scan uses ptrace
+// The process stays stopped for the whole scan, as pages are classified while they are read.
+
+int
+main(int argc, const char *argv[])
+{
+   return proc_page_scan(argc, argv, mem_io_ptrace_init);
+}
@@ -0,0 +1,11 @@
+#include "cli/cli.h"
+#include "mem/io.h"
+
+// This pe-map uses ptrace
+// This works with older kernels, but it also ensures the headers are read without racing, as it stops the process.
+
+int
+main(int argc, const char *argv[])
+{
+   return proc_pe_map(argc, argv, mem_io_ptrace_init);
+}
@@ -0,0 +1,11 @@
+#include "cli/cli.h"
+#include "mem/io.h"
+
+// This pointer-scan uses ptrace
+// The process is stopped only while the pointer index is built, searching happens after detaching.
+
+int
+main(int argc, const char *argv[])
+{
+   return proc_pointer_scan(argc, argv, mem_io_ptrace_init);
+}
@@ -0,0 +1,11 @@
+#include "cli/cli.h"
+#include "mem/io.h"
+
+// This strings uses ptrace
+// The process stays stopped for the whole scan, as strings are found while memory is read.
+
+int
+main(int argc, const char *argv[])
+{
+   return proc_strings(argc, argv, mem_io_ptrace_init);
+}
@@ -0,0 +1,11 @@
+#include "cli/cli.h"
+#include "mem/io.h"
+
+// This pe-map uses uio
+// It needs recent kernel, but may be racy as it reads while process is running.
+
+int
+main(int argc, const char *argv[])
+{
+   return proc_pe_map(argc, argv, mem_io_uio_init);
+}